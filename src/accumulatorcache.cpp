@@ -0,0 +1,135 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "accumulatorcache.h"
+
+#include "libzerocoin/bignum.h"
+#include "sync.h"
+#include "util.h"
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <utility>
+
+namespace {
+
+/**
+ * Accumulator values by checksum. Spends name their accumulator by checksum,
+ * so wallet spend creation and spend validation both look values up here
+ * before going to the zerocoin database.
+ *
+ * Entries are split over independently locked stripes by checksum, and each
+ * stripe evicts its least recently used entry once it holds its share of
+ * -maxaccumulatorcachesize.
+ */
+class CAccumulatorValueCache
+{
+private:
+    static const unsigned int STRIPES = 8;
+
+    typedef std::list<std::pair<uint32_t, CBigNum> > lru_type;
+
+    struct Stripe {
+        CCriticalSection cs;
+        //! most recently used first
+        lru_type listLru;
+        std::map<uint32_t, lru_type::iterator> mapEntries;
+        uint64_t nHits;
+        uint64_t nMisses;
+
+        Stripe() : nHits(0), nMisses(0) {}
+    };
+
+    Stripe stripes[STRIPES];
+
+    Stripe& GetStripe(uint32_t nChecksum) { return stripes[nChecksum % STRIPES]; }
+
+public:
+    bool Get(uint32_t nChecksum, CBigNum& bnValue)
+    {
+        Stripe& stripe = GetStripe(nChecksum);
+        LOCK(stripe.cs);
+        std::map<uint32_t, lru_type::iterator>::iterator it = stripe.mapEntries.find(nChecksum);
+        if (it == stripe.mapEntries.end()) {
+            stripe.nMisses++;
+            return false;
+        }
+        stripe.listLru.splice(stripe.listLru.begin(), stripe.listLru, it->second);
+        bnValue = it->second->second;
+        stripe.nHits++;
+        return true;
+    }
+
+    void Set(uint32_t nChecksum, const CBigNum& bnValue)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxaccumulatorcachesize", DEFAULT_MAX_ACCUMULATOR_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+        size_t nMaxStripeSize = std::max<int64_t>(nMaxCacheSize / STRIPES, 1);
+
+        Stripe& stripe = GetStripe(nChecksum);
+        LOCK(stripe.cs);
+        std::map<uint32_t, lru_type::iterator>::iterator it = stripe.mapEntries.find(nChecksum);
+        if (it != stripe.mapEntries.end()) {
+            it->second->second = bnValue;
+            stripe.listLru.splice(stripe.listLru.begin(), stripe.listLru, it->second);
+            return;
+        }
+
+        while (stripe.listLru.size() >= nMaxStripeSize) {
+            stripe.mapEntries.erase(stripe.listLru.back().first);
+            stripe.listLru.pop_back();
+        }
+
+        stripe.listLru.push_front(std::make_pair(nChecksum, bnValue));
+        stripe.mapEntries.insert(std::make_pair(nChecksum, stripe.listLru.begin()));
+    }
+
+    void Erase(uint32_t nChecksum)
+    {
+        Stripe& stripe = GetStripe(nChecksum);
+        LOCK(stripe.cs);
+        std::map<uint32_t, lru_type::iterator>::iterator it = stripe.mapEntries.find(nChecksum);
+        if (it == stripe.mapEntries.end())
+            return;
+        stripe.listLru.erase(it->second);
+        stripe.mapEntries.erase(it);
+    }
+
+    CAccumulatorCacheStats GetStats()
+    {
+        CAccumulatorCacheStats stats;
+        for (unsigned int i = 0; i < STRIPES; i++) {
+            LOCK(stripes[i].cs);
+            stats.nEntries += stripes[i].mapEntries.size();
+            stats.nHits += stripes[i].nHits;
+            stats.nMisses += stripes[i].nMisses;
+        }
+        return stats;
+    }
+};
+
+CAccumulatorValueCache accumulatorValueCache;
+
+}
+
+bool GetCachedAccumulatorValue(uint32_t nChecksum, CBigNum& bnValue)
+{
+    return accumulatorValueCache.Get(nChecksum, bnValue);
+}
+
+void SetCachedAccumulatorValue(uint32_t nChecksum, const CBigNum& bnValue)
+{
+    accumulatorValueCache.Set(nChecksum, bnValue);
+}
+
+void EraseCachedAccumulatorValue(uint32_t nChecksum)
+{
+    accumulatorValueCache.Erase(nChecksum);
+}
+
+CAccumulatorCacheStats GetAccumulatorCacheStats()
+{
+    return accumulatorValueCache.GetStats();
+}
@@ -0,0 +1,31 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_ACCUMULATORCACHE_H
+#define SNODECOIN_ACCUMULATORCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class CBigNum;
+
+//! -maxaccumulatorcachesize default (entries)
+static const int64_t DEFAULT_MAX_ACCUMULATOR_CACHE_SIZE = 4096;
+
+struct CAccumulatorCacheStats
+{
+    size_t nEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    CAccumulatorCacheStats() : nEntries(0), nHits(0), nMisses(0) {}
+};
+
+/** Accumulator values by checksum, bounded by -maxaccumulatorcachesize and evicting the least recently used */
+bool GetCachedAccumulatorValue(uint32_t nChecksum, CBigNum& bnValue);
+void SetCachedAccumulatorValue(uint32_t nChecksum, const CBigNum& bnValue);
+void EraseCachedAccumulatorValue(uint32_t nChecksum);
+CAccumulatorCacheStats GetAccumulatorCacheStats();
+
+#endif // SNODECOIN_ACCUMULATORCACHE_H
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "accumulators.h"
+#include "accumulatorcache.h"
 #include "accumulatormap.h"
 #include "chainparams.h"
 #include "main.h"
@@ -13,7 +14,6 @@
 
 using namespace libzerocoin;
 
-std::map<uint32_t, CBigNum> mapAccumulatorValues;
 std::list<uint256> listAccCheckpointsNoDB;
 
 uint32_t ParseChecksum(uint256 nChecksum, CoinDenomination denomination)
@@ -35,17 +35,16 @@ uint32_t GetChecksum(const CBigNum &bnValue)
 
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue)
 {
-    if (mapAccumulatorValues.count(nChecksum)) {
-        bnAccValue = mapAccumulatorValues.at(nChecksum);
+    if (GetCachedAccumulatorValue(nChecksum, bnAccValue))
         return true;
-    }
 
     if (fMemoryOnly)
         return false;
 
-    if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue)) {
+    if (zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue))
+        SetCachedAccumulatorValue(nChecksum, bnAccValue);
+    else
         bnAccValue = 0;
-    }
 
     return true;
 }
@@ -60,7 +59,7 @@ void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bo
 {
     if(!fMemoryOnly)
         zerocoinDB->WriteAccumulatorValue(nChecksum, bnValue);
-    mapAccumulatorValues.insert(make_pair(nChecksum, bnValue));
+    SetCachedAccumulatorValue(nChecksum, bnValue);
 }
 
 void DatabaseChecksums(AccumulatorMap& mapAccumulators)
@@ -77,7 +76,7 @@ void DatabaseChecksums(AccumulatorMap& mapAccumulators)
 bool EraseChecksum(uint32_t nChecksum)
 {
     //erase from both memory and database
-    mapAccumulatorValues.erase(nChecksum);
+    EraseCachedAccumulatorValue(nChecksum);
     return zerocoinDB->EraseAccumulatorValue(nChecksum);
 }
 
@@ -111,7 +110,7 @@ bool LoadAccumulatorValuesFromDB(const uint256 nCheckpoint)
                 listAccCheckpointsNoDB.push_back(nCheckpoint);
             return false;
         }
-        mapAccumulatorValues.insert(make_pair(nChecksum, bnValue));
+        SetCachedAccumulatorValue(nChecksum, bnValue);
     }
     return true;
 }
@@ -152,8 +151,45 @@ bool EraseCheckpoints(int nStartHeight, int nEndHeight)
     return true;
 }
 
+//Read a block from disk and get the pubcoins it mints
+bool ReadBlockPubcoinList(const CBlockIndex* pindex, bool fFilterInvalid, std::list<PublicCoin>& listPubcoins)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: failed to read block from disk\n", __func__);
+
+    return BlockToPubcoinList(block, listPubcoins, fFilterInvalid);
+}
+
+//Get the blocks whose mints are accumulated into the checkpoint at nHeight, in the order they are accumulated
+void GetAccumulationBlocks(int nHeight, std::vector<const CBlockIndex*>& vBlocks)
+{
+    vBlocks.clear();
+
+    //Accumulate all coins over the last ten blocks that havent been accumulated (height - 20 through height - 11)
+    int nAccumulationOffset = 20;
+    if (nHeight < Params().Zerocoin_StartHeight() || nHeight % 10 != 0 || nHeight <= nAccumulationOffset)
+        return;
+
+    int nStart = nHeight - nAccumulationOffset;
+
+    //On a specific block, a recalculation of the accumulators will be forced
+    if (nHeight == Params().Zerocoin_Block_RecalculateAccumulators())
+        nStart = Params().Zerocoin_Block_LastGoodCheckpoint() - 10;
+
+    //make sure each block is eligible for accumulation
+    for (int i = std::max(nStart, Params().Zerocoin_StartHeight()); i < nHeight - 10; i++)
+        vBlocks.push_back(chainActive[i]);
+}
+
 //Get checkpoint value for a specific block height
 bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, AccumulatorMap& mapAccumulators)
+{
+    return CalculateAccumulatorCheckpoint(nHeight, nCheckpoint, mapAccumulators, ReadBlockPubcoinList);
+}
+
+//Get checkpoint value for a specific block height, taking each block's pubcoins from getPubcoins
+bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, AccumulatorMap& mapAccumulators, const PubcoinListFn& getPubcoins)
 {
     if (nHeight < Params().Zerocoin_StartHeight()) {
         nCheckpoint = 0;
@@ -185,11 +221,8 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
     int nAccumulationOffset = 20;
     
     if (nHeight > nAccumulationOffset) {
-        CBlockIndex *pindex = chainActive[nHeight - nAccumulationOffset];
-
         //On a specific block, a recalculation of the accumulators will be forced
         if (nHeight == Params().Zerocoin_Block_RecalculateAccumulators()) {
-            pindex = chainActive[Params().Zerocoin_Block_LastGoodCheckpoint() - 10];
             mapAccumulators.Reset();
             if (!mapAccumulators.Load(chainActive[Params().Zerocoin_Block_LastGoodCheckpoint()]->nAccumulatorCheckpoint)) {
                 LogPrintf("%s: failed to reset to previous checkpoint when recalculating accumulators\n", __func__);
@@ -204,26 +237,17 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
             }
         }
 
-        while (pindex->nHeight < nHeight - 10) {
+        std::vector<const CBlockIndex*> vBlocks;
+        GetAccumulationBlocks(nHeight, vBlocks);
+        for (const CBlockIndex* pindex : vBlocks) {
             // checking whether we should stop this process due to a shutdown request
             if (ShutdownRequested()) {
                 return false;
             }
 
-            //make sure this block is eligible for accumulation
-            if (pindex->nHeight < Params().Zerocoin_StartHeight()) {
-                pindex = chainActive[pindex->nHeight + 1];
-                continue;
-            }
-
             //grab mints from this block
-            CBlock block;
-            if(!ReadBlockFromDisk(block, pindex)) {
-                return error("%s: failed to read block from disk\n", __func__);
-            }
-
             std::list<PublicCoin> listPubcoins;
-            if (!BlockToPubcoinList(block, listPubcoins, fFilterInvalid)) {
+            if (!getPubcoins(pindex, fFilterInvalid, listPubcoins)) {
                 return error("%s: failed to get zerocoin mintlist from block %d\n", __func__, pindex->nHeight);
             }
 
@@ -236,7 +260,6 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
                     return error("%s: failed to add pubcoin to accumulator at height %n\n", __func__, pindex->nHeight);
                 }
             }
-            pindex = chainActive.Next(pindex);
         }
     }
     // if there were no new mints found, the accumulator checkpoint will be the same as the last checkpoint
@@ -299,7 +322,106 @@ bool ValidateAccumulatorCheckpoint(const CBlock& block, CBlockIndex* pindex, Acc
     return true;
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError)
+//The invalid outpoint map is only guaranteed to be populated once the accumulators have been recalculated
+bool PubcoinIndexEligible(int nHeight)
+{
+    return nHeight >= Params().Zerocoin_Block_RecalculateAccumulators();
+}
+
+//Record the filtered pubcoin values of each denomination minted in this block
+bool IndexBlockPubcoins(const CBlock& block, const CBlockIndex* pindex)
+{
+    if (pindex->vMintDenominationsInBlock.empty() || !PubcoinIndexEligible(pindex->nHeight))
+        return true;
+
+    list<PublicCoin> listPubcoins;
+    if (!BlockToPubcoinList(block, listPubcoins, true))
+        return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+
+    map<CoinDenomination, vector<CBigNum> > mapPubcoins;
+    for (const PublicCoin& pubcoin : listPubcoins)
+        mapPubcoins[pubcoin.getDenomination()].emplace_back(pubcoin.getValue());
+
+    for (auto& denom : zerocoinDenomList) {
+        //an empty entry is still written so that a fully filtered block does not fall back to disk
+        if (!pindex->MintedDenomination(denom))
+            continue;
+
+        if (!zerocoinDB->WritePubcoinIndex(pindex->nHeight, denom, mapPubcoins[denom]))
+            return error("%s: failed to write pubcoin index for block %d", __func__, pindex->nHeight);
+    }
+
+    return true;
+}
+
+bool EraseBlockPubcoins(const CBlockIndex* pindex)
+{
+    for (auto& denom : zerocoinDenomList) {
+        if (!pindex->MintedDenomination(denom))
+            continue;
+
+        if (!zerocoinDB->ErasePubcoinIndex(pindex->nHeight, denom))
+            return false;
+    }
+
+    return true;
+}
+
+//Read the pubcoins of a block that is not indexed (connected before the index existed) and index it for the next spend
+bool static ReadBlockPubcoins(const CBlockIndex* pindex, CoinDenomination denom, vector<CBigNum>& vPubcoins)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: failed to read block %d from disk", __func__, pindex->nHeight);
+
+    list<PublicCoin> listPubcoins;
+    if (!BlockToPubcoinList(block, listPubcoins, true))
+        return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+
+    for (const PublicCoin& pubcoin : listPubcoins) {
+        if (pubcoin.getDenomination() == denom)
+            vPubcoins.emplace_back(pubcoin.getValue());
+    }
+
+    if (!IndexBlockPubcoins(block, pindex))
+        LogPrint("zero", "%s : failed to backfill pubcoin index for block %d\n", __func__, pindex->nHeight);
+
+    return true;
+}
+
+bool GetBlockPubcoins(const CBlockIndex* pindex, CoinDenomination denom, vector<CBigNum>& vPubcoins)
+{
+    if (zerocoinDB->ReadPubcoinIndex(pindex->nHeight, denom, vPubcoins))
+        return true;
+
+    return ReadBlockPubcoins(pindex, denom, vPubcoins);
+}
+
+bool GetRangePubcoins(int nHeightStart, int nHeightEnd, CoinDenomination denom, map<int, vector<CBigNum> >& mapPubcoins)
+{
+    map<int, vector<CBigNum> > mapIndexed;
+    if (!zerocoinDB->ReadPubcoinIndexRange(nHeightStart, nHeightEnd, denom, mapIndexed))
+        return error("%s: failed to read pubcoin index from block %d to %d", __func__, nHeightStart, nHeightEnd);
+
+    for (int nHeight = nHeightStart; nHeight < nHeightEnd; nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (!pindex->MintedDenomination(denom))
+            continue;
+
+        map<int, vector<CBigNum> >::iterator it = mapIndexed.find(nHeight);
+        if (it != mapIndexed.end()) {
+            mapPubcoins[nHeight].swap(it->second);
+            continue;
+        }
+
+        if (!ReadBlockPubcoins(pindex, denom, mapPubcoins[nHeight]))
+            return false;
+    }
+
+    return true;
+}
+
+bool GetAccumulatorWitnessMints(const PublicCoin& coin, int nSecurityLevel, const CZerocoinWitness* pwitnessCache, CWitnessMints& mints)
 {
     uint256 txid;
     if (!zerocoinDB->ReadCoinMint(coin.getValue(), txid)) {
@@ -352,13 +474,13 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     }
 
     //Get the accumulator that is right before the cluster of blocks containing our mint was added to the accumulator
+    Accumulator accumulator(Params().Zerocoin_Params(), coin.getDenomination());
     CBigNum bnAccValue = 0;
     if (GetAccumulatorValueFromDB(nCheckpointBeforeMint, coin.getDenomination(), bnAccValue)) {
-        if (bnAccValue > 0) {
+        if (bnAccValue > 0)
             accumulator.setValue(bnAccValue);
-            witness.resetValue(accumulator, coin);
-        }
     }
+    mints.bnWitnessValue = accumulator.getValue();
 
     //security level: this is an important prevention of tracing the coins via timing. Security level represents how many checkpoints
     //of accumulated coins are added *beyond* the checkpoint that the mint being spent was added too. If each spend added the exact same
@@ -372,13 +494,12 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
             nSecurityLevel = 99;
     }
 
-    //add the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
+    //find the block at which the witness stops accumulating pubcoins, this only needs the block index
     pindex = chainActive[nAccStartHeight];
     int nChainHeight = chainActive.Height();
     int nHeightStop = nChainHeight % 10;
     nHeightStop = nChainHeight - nHeightStop - 20; // at least two checkpoints deep
     int nCheckpointsAdded = 0;
-    nMintsAdded = 0;
     while (pindex->nHeight < nHeightStop + 1) {
         if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
             ++nCheckpointsAdded;
@@ -396,37 +517,71 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
             break;
         }
 
-        // if this block contains mints of the denomination that is being spent, then add them to the witness
-        if (pindex->MintedDenomination(coin.getDenomination())) {
-            //grab mints from this block
-            CBlock block;
-            if(!ReadBlockFromDisk(block, pindex)) {
-                LogPrintf("%s: failed to read block from disk while adding pubcoins to witness\n", __func__);
-                return false;
-            }
-
-            list<PublicCoin> listPubcoins;
-            if(!BlockToPubcoinList(block, listPubcoins, true)) {
-                LogPrintf("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
-                return false;
-            }
+        pindex = chainActive[pindex->nHeight + 1];
+    }
+    mints.bnAccumulatorValue = accumulator.getValue();
+    mints.nHeightAccStart = nAccStartHeight;
+    mints.nHeightAccEnd = pindex->nHeight;
+    mints.hashBlockAccEnd = mints.nHeightAccEnd > nAccStartHeight ? chainActive[mints.nHeightAccEnd - 1]->GetBlockHash() : uint256(0);
+
+    //resume from the cached witness if it is still on the active chain and has not advanced past where this spend stops
+    int nHeight = nAccStartHeight;
+    mints.nMintsAdded = 0;
+    mints.vPubcoins.clear();
+    if (pwitnessCache && !pwitnessCache->IsNull() && pwitnessCache->GetPubCoin() == coin.getValue() &&
+            pwitnessCache->GetHeightAccStart() == nAccStartHeight && pwitnessCache->GetHeightAccEnd() <= mints.nHeightAccEnd &&
+            chainActive[pwitnessCache->GetHeightAccEnd() - 1]->GetBlockHash() == pwitnessCache->GetBlockHashAccEnd()) {
+        mints.bnWitnessValue = pwitnessCache->GetWitnessValue();
+        nHeight = pwitnessCache->GetHeightAccEnd();
+        mints.nMintsAdded = pwitnessCache->GetMintsAdded();
+        LogPrint("zero", "%s : resuming witness from cache at height %d\n", __func__, nHeight);
+    }
 
-            //add the mints to the witness
-            for (const PublicCoin pubcoin : listPubcoins) {
-                if (pubcoin.getDenomination() != coin.getDenomination())
-                    continue;
+    //collect the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
+    //the blocks that contain mints of the denomination that is being spent come from a single scan of the pubcoin index
+    map<int, vector<CBigNum> > mapPubcoins;
+    if (!GetRangePubcoins(nHeight, mints.nHeightAccEnd, coin.getDenomination(), mapPubcoins)) {
+        LogPrintf("%s: failed to get zerocoin mintlist from block %d\n", __func__, nHeight);
+        return false;
+    }
 
-                if (pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
-                    continue;
+    for (const auto& it : mapPubcoins) {
+        for (const CBigNum& bnPubcoin : it.second) {
+            if (it.first == nHeightMintAdded && bnPubcoin == coin.getValue())
+                continue;
 
-                witness.addRawValue(pubcoin.getValue());
-                ++nMintsAdded;
-            }
+            mints.vPubcoins.emplace_back(bnPubcoin);
         }
-
-        pindex = chainActive[pindex->nHeight + 1];
     }
 
+    return true;
+}
+
+int AddAccumulatorWitnessMints(const PublicCoin& coin, const CWitnessMints& mints, Accumulator& accumulator, AccumulatorWitness& witness, CZerocoinWitness* pwitnessCache)
+{
+    accumulator.setValue(mints.bnAccumulatorValue);
+    Accumulator accumulatorWitness(Params().Zerocoin_Params(), coin.getDenomination(), mints.bnWitnessValue);
+    witness.resetValue(accumulatorWitness, coin);
+
+    //add the mints to the witness
+    for (const CBigNum& bnPubcoin : mints.vPubcoins)
+        witness.addRawValue(bnPubcoin);
+    int nMintsAdded = mints.nMintsAdded + mints.vPubcoins.size();
+
+    //remember how far the witness got, never moving the cache backwards
+    if (pwitnessCache && mints.nHeightAccEnd > mints.nHeightAccStart && (pwitnessCache->IsNull() || mints.nHeightAccEnd >= pwitnessCache->GetHeightAccEnd()))
+        pwitnessCache->Update(witness.getValue(), mints.nHeightAccStart, mints.nHeightAccEnd, mints.hashBlockAccEnd, nMintsAdded);
+
+    return nMintsAdded;
+}
+
+bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CZerocoinWitness* pwitnessCache)
+{
+    CWitnessMints mints;
+    if (!GetAccumulatorWitnessMints(coin, nSecurityLevel, pwitnessCache, mints))
+        return false;
+    nMintsAdded = AddAccumulatorWitnessMints(coin, mints, accumulator, witness, pwitnessCache);
+
     if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
         strError = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
         LogPrintf("%s : %s\n", __func__, strError);
@@ -435,8 +590,8 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
 
     // calculate how many mints of this denomination existed in the accumulator we initialized
     int nZerocoinStartHeight = GetZerocoinStartHeight();
-    pindex = chainActive[nZerocoinStartHeight];
-    while (pindex->nHeight < nAccStartHeight) {
+    CBlockIndex* pindex = chainActive[nZerocoinStartHeight];
+    while (pindex->nHeight < mints.nHeightAccStart) {
         nMintsAdded += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), coin.getDenomination());
         pindex = chainActive[pindex->nHeight + 1];
     }
@@ -14,11 +14,38 @@
 #include "chain.h"
 #include "uint256.h"
 
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError);
+#include <list>
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+
+/** What a witness takes in to reach the checkpoint a spend stops at, gathered from the chain under cs_main */
+struct CWitnessMints {
+    CBigNum bnWitnessValue;     //!< witness value the pubcoins are added to
+    CBigNum bnAccumulatorValue; //!< accumulator the finished witness belongs to
+    int nHeightAccStart;
+    int nHeightAccEnd;
+    uint256 hashBlockAccEnd;
+    int nMintsAdded;            //!< mints already in bnWitnessValue
+    std::vector<CBigNum> vPubcoins;
+
+    CWitnessMints() : nHeightAccStart(0), nHeightAccEnd(0), nMintsAdded(0) {}
+};
+
+bool GetAccumulatorWitnessMints(const libzerocoin::PublicCoin& coin, int nSecurityLevel, const CZerocoinWitness* pwitnessCache, CWitnessMints& mints);
+//! Adds the gathered pubcoins to the witness without touching the chain, returning the mints it holds
+int AddAccumulatorWitnessMints(const libzerocoin::PublicCoin& coin, const CWitnessMints& mints, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, CZerocoinWitness* pwitnessCache = NULL);
+bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CZerocoinWitness* pwitnessCache = NULL);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
+typedef boost::function<bool(const CBlockIndex*, bool, std::list<libzerocoin::PublicCoin>&)> PubcoinListFn;
+
+bool ReadBlockPubcoinList(const CBlockIndex* pindex, bool fFilterInvalid, std::list<libzerocoin::PublicCoin>& listPubcoins);
+void GetAccumulationBlocks(int nHeight, std::vector<const CBlockIndex*>& vBlocks);
 bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, AccumulatorMap& mapAccumulators);
+bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, AccumulatorMap& mapAccumulators, const PubcoinListFn& getPubcoins);
 void DatabaseChecksums(AccumulatorMap& mapAccumulators);
 bool LoadAccumulatorValuesFromDB(const uint256 nCheckpoint);
 bool EraseAccumulatorValues(const uint256& nCheckpointErase, const uint256& nCheckpointPrevious);
@@ -26,5 +53,9 @@ uint32_t ParseChecksum(uint256 nChecksum, libzerocoin::CoinDenomination denomina
 uint32_t GetChecksum(const CBigNum &bnValue);
 bool InvalidCheckpointRange(int nHeight);
 bool ValidateAccumulatorCheckpoint(const CBlock& block, CBlockIndex* pindex, AccumulatorMap& mapAccumulators);
+bool IndexBlockPubcoins(const CBlock& block, const CBlockIndex* pindex);
+bool EraseBlockPubcoins(const CBlockIndex* pindex);
+bool GetBlockPubcoins(const CBlockIndex* pindex, libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vPubcoins);
+bool GetRangePubcoins(int nHeightStart, int nHeightEnd, libzerocoin::CoinDenomination denom, std::map<int, std::vector<CBigNum> >& mapPubcoins);
 
 #endif //SNODECOIN_ACCUMULATORS_H
@@ -213,9 +213,13 @@ bool CActiveMasternode::SendMasternodePing(std::string& errorMessage)
         }
 
         LogPrint("masternode", "dseep - relaying from active mn, %s \n", vin.ToString().c_str());
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vin << vchMasterNodeSignature << masterNodeSignatureTime << false;
+        CSerializeDataRef msg = MakeNetMessage("dseep", ss);
+
         LOCK(cs_vNodes);
         BOOST_FOREACH (CNode* pnode, vNodes)
-            pnode->PushMessage("dseep", vin, vchMasterNodeSignature, masterNodeSignatureTime, false);
+            pnode->PushMessage(msg);
 
         /*
          * END OF "REMOVE"
@@ -333,9 +337,13 @@ bool CActiveMasternode::Register(CTxIn vin, CService service, CKey keyCollateral
         return false;
     }
 
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vin << service << vchMasterNodeSignature << masterNodeSignatureTime << pubKeyCollateralAddress << pubKeyMasternode << -1 << -1 << masterNodeSignatureTime << PROTOCOL_VERSION << donationAddress << donationPercantage;
+    CSerializeDataRef msg = MakeNetMessage("dsee", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes)
-        pnode->PushMessage("dsee", vin, service, vchMasterNodeSignature, masterNodeSignatureTime, pubKeyCollateralAddress, pubKeyMasternode, -1, -1, masterNodeSignatureTime, PROTOCOL_VERSION, donationAddress, donationPercantage);
+        pnode->PushMessage(msg);
 
     /*
      * END OF "REMOVE"
@@ -6,7 +6,10 @@
 #ifndef BITCOIN_ALLOCATORS_H
 #define BITCOIN_ALLOCATORS_H
 
+#include <assert.h>
+#include <cstddef>
 #include <map>
+#include <new>
 #include <string.h>
 #include <string>
 #include <vector>
@@ -258,6 +261,176 @@ struct zero_after_free_allocator : public std::allocator<T> {
     }
 };
 
+//
+// Memory resource for node based containers with many small entries, like
+// the coins cache. Allocations of up to MAX_BLOCK_SIZE_BYTES are carved out
+// of big chunks, and go back onto a free list for their size when released,
+// so the container does not pay malloc's overhead for every node. Bigger
+// allocations (bucket arrays) go straight to operator new.
+//
+// Chunks are only returned when the resource is destroyed. Not thread-safe.
+//
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    struct ListNode {
+        ListNode* next;
+        explicit ListNode(ListNode* nextIn) : next(nextIn) {}
+    };
+
+    //! Every block is a multiple of this, so freed blocks can hold a ListNode
+    static const std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > sizeof(ListNode) ? ALIGN_BYTES : sizeof(ListNode);
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned for std::max_align_t");
+
+    const std::size_t nChunkSizeBytes;
+    std::vector<void*> vChunks;
+    //! Free lists, by the number of ELEM_ALIGN_BYTES units of their blocks
+    std::vector<ListNode*> vFreeLists;
+    std::size_t nFreeListBytes;
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return bytes == 0 ? 1 : (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES;
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PlaceIntoFreeList(void* p, std::size_t nIndex)
+    {
+        vFreeLists[nIndex] = new (p) ListNode(vFreeLists[nIndex]);
+        nFreeListBytes += nIndex * ELEM_ALIGN_BYTES;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk is smaller than the block that did
+        // not fit, so it has a free list to go to
+        if (pAvailableBegin != pAvailableEnd)
+            PlaceIntoFreeList(pAvailableBegin, (pAvailableEnd - pAvailableBegin) / ELEM_ALIGN_BYTES);
+
+        void* p = ::operator new(nChunkSizeBytes);
+        vChunks.push_back(p);
+        pAvailableBegin = static_cast<char*>(p);
+        pAvailableEnd = pAvailableBegin + nChunkSizeBytes;
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    explicit PoolResource(std::size_t nChunkSizeBytesIn = 256 * 1024)
+        : nChunkSizeBytes(nChunkSizeBytesIn / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES),
+          vFreeLists(MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1, (ListNode*)NULL),
+          nFreeListBytes(0), pAvailableBegin(NULL), pAvailableEnd(NULL)
+    {
+        assert(nChunkSizeBytes >= MAX_BLOCK_SIZE_BYTES);
+    }
+
+    ~PoolResource()
+    {
+        for (std::vector<void*>::iterator it = vChunks.begin(); it != vChunks.end(); ++it)
+            ::operator delete(*it);
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment))
+            return ::operator new(bytes);
+
+        const std::size_t nIndex = NumElemAlignBytes(bytes);
+        if (vFreeLists[nIndex] != NULL) {
+            ListNode* node = vFreeLists[nIndex];
+            vFreeLists[nIndex] = node->next;
+            nFreeListBytes -= nIndex * ELEM_ALIGN_BYTES;
+            return node;
+        }
+
+        const std::size_t nRoundBytes = nIndex * ELEM_ALIGN_BYTES;
+        if ((std::size_t)(pAvailableEnd - pAvailableBegin) < nRoundBytes)
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nRoundBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        PlaceIntoFreeList(p, NumElemAlignBytes(bytes));
+    }
+
+    std::size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+    std::size_t NumAllocatedChunks() const { return vChunks.size(); }
+    //! Bytes of the chunks that sit on the free lists, ready to be handed out again
+    std::size_t FreeListBytes() const { return nFreeListBytes; }
+};
+
+//
+// Allocator that takes memory from a PoolResource. All copies and rebinds
+// share the resource, which has to outlive the container.
+//
+template <typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    explicit PoolAllocator(ResourceType* resourceIn) throw() : resource(resourceIn) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) throw() : resource(other.GetResource())
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* GetResource() const { return resource; }
+
+private:
+    ResourceType* resource;
+};
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.GetResource() == b.GetResource();
+}
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "main.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "streams.h"
+#include "util.h"
+
+#include <assert.h>
+
+bool CBlockMessageCache::Get(const uint256& hash, CSerializeDataRef& msg)
+{
+    LOCK(cs);
+    std::map<uint256, lru_type::iterator>::iterator it = mapEntries.find(hash);
+    if (it == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    listLru.splice(listLru.begin(), listLru, it->second);
+    msg = it->second->second;
+    nHits++;
+    nBytesServed += msg->size();
+    return true;
+}
+
+void CBlockMessageCache::Insert(const uint256& hash, const CSerializeDataRef& msg, size_t nMaxBytes)
+{
+    LOCK(cs);
+    if (mapEntries.count(hash) || msg->size() > nMaxBytes)
+        return;
+
+    while (nBytes + msg->size() > nMaxBytes) {
+        nBytes -= listLru.back().second->size();
+        mapEntries.erase(listLru.back().first);
+        listLru.pop_back();
+    }
+
+    listLru.push_front(std::make_pair(hash, msg));
+    mapEntries.insert(std::make_pair(hash, listLru.begin()));
+    nBytes += msg->size();
+}
+
+CBlockCacheStats CBlockMessageCache::GetStats()
+{
+    LOCK(cs);
+    CBlockCacheStats stats;
+    stats.nEntries = mapEntries.size();
+    stats.nBytes = nBytes;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nBytesServed = nBytesServed;
+    return stats;
+}
+
+namespace {
+CBlockMessageCache blockMessageCache;
+}
+
+CSerializeDataRef GetBlockMessage(const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    CSerializeDataRef msg;
+    if (blockMessageCache.Get(hash, msg))
+        return msg;
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        assert(!"cannot load block from disk");
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    ss << block;
+    msg = MakeNetMessage("block", ss);
+
+    int64_t nMaxCacheSize = GetArg("-maxblockcachesize", DEFAULT_MAX_BLOCK_CACHE_SIZE);
+    if (nMaxCacheSize > 0)
+        blockMessageCache.Insert(hash, msg, nMaxCacheSize << 20);
+    return msg;
+}
+
+void ReadBlockFromMessage(const CSerializeData& msg, CBlock& block)
+{
+    CDataStream ss(msg.begin() + CMessageHeader::HEADER_SIZE, msg.end(), SER_NETWORK, PROTOCOL_VERSION);
+    ss >> block;
+}
+
+CBlockCacheStats GetBlockCacheStats()
+{
+    return blockMessageCache.GetStats();
+}
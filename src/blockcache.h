@@ -0,0 +1,71 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_BLOCKCACHE_H
+#define SNODECOIN_BLOCKCACHE_H
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <utility>
+
+#include <stddef.h>
+#include <stdint.h>
+
+class CBlock;
+class CBlockIndex;
+
+//! -maxblockcachesize default (megabytes)
+static const int64_t DEFAULT_MAX_BLOCK_CACHE_SIZE = 16;
+
+struct CBlockCacheStats
+{
+    size_t nEntries;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nBytesServed; //! Bytes of block messages served from the cache instead of disk
+
+    CBlockCacheStats() : nEntries(0), nBytes(0), nHits(0), nMisses(0), nBytesServed(0) {}
+};
+
+/**
+ * Recently served blocks in their wire form, as complete "block" messages
+ * that every peer asking for the block shares. Bounded by the total size of
+ * the messages, evicting the least recently used.
+ */
+class CBlockMessageCache
+{
+private:
+    typedef std::list<std::pair<uint256, CSerializeDataRef> > lru_type;
+
+    CCriticalSection cs;
+    //! most recently used first
+    lru_type listLru;
+    std::map<uint256, lru_type::iterator> mapEntries;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nBytesServed;
+
+public:
+    CBlockMessageCache() : nBytes(0), nHits(0), nMisses(0), nBytesServed(0) {}
+
+    bool Get(const uint256& hash, CSerializeDataRef& msg);
+    void Insert(const uint256& hash, const CSerializeDataRef& msg, size_t nMaxBytes);
+    CBlockCacheStats GetStats();
+};
+
+/** The "block" message for a block, from the cache or else read from disk and cached. Requires cs_main. */
+CSerializeDataRef GetBlockMessage(const CBlockIndex* pindex);
+
+/** Deserialize the block carried by a "block" message */
+void ReadBlockFromMessage(const CSerializeData& msg, CBlock& block);
+
+CBlockCacheStats GetBlockCacheStats();
+
+#endif // SNODECOIN_BLOCKCACHE_H
@@ -0,0 +1,188 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/unordered_map.hpp>
+
+namespace {
+//! Upper bound on the transactions of a block, for sanity checking compact blocks
+const size_t MAX_BLOCK_TXN = MAX_BLOCK_SIZE_CURRENT / ::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION);
+
+//! Short IDs are evenly spread unless the peer chose them, so a crowded bucket means a bogus block
+const size_t MAX_SHORTTXID_BUCKET_SIZE = 12;
+} // anon namespace
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) : nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+                                                                            header(block.GetBlockHeader()),
+                                                                            vchBlockSig(block.vchBlockSig)
+{
+    FillShortTxIDSelector();
+
+    // The coinbase, followed by the coinstake of a proof-of-stake block
+    size_t nPrefill = block.IsProofOfStake() ? 2 : 1;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (i < nPrefill) {
+            PrefilledTransaction prefilled;
+            prefilled.index = 0; // right after the previous one
+            prefilled.tx = block.vtx[i];
+            prefilledtxn.push_back(prefilled);
+        } else {
+            shorttxids.push_back(GetShortID(block.vtx[i].GetHash()));
+        }
+    }
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header << nonce;
+    uint256 hash;
+    CSHA256().Write((const unsigned char*)&ss[0], ss.size()).Finalize(hash.begin());
+    shorttxidk0 = hash.Get64(0);
+    shorttxidk1 = hash.Get64(1);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffULL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > MAX_BLOCK_TXN)
+        return READ_STATUS_INVALID;
+    // Positions in the block are 16 bits, both here and in getblocktxn
+    if (cmpctblock.BlockTxCount() > std::numeric_limits<uint16_t>::max())
+        return READ_STATUS_INVALID;
+
+    assert(header.IsNull() && txn_available.empty());
+    header = cmpctblock.header;
+    vchBlockSig = cmpctblock.vchBlockSig;
+    txn_available.resize(cmpctblock.BlockTxCount());
+    vAvailable.resize(cmpctblock.BlockTxCount());
+
+    int32_t nLastPrefilled = -1;
+    for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
+        const PrefilledTransaction& prefilled = cmpctblock.prefilledtxn[i];
+        if (prefilled.tx.IsNull())
+            return READ_STATUS_INVALID;
+        nLastPrefilled += prefilled.index + 1;
+        // Every position before this one has to be prefilled or have a short ID
+        if ((uint32_t)nLastPrefilled > cmpctblock.shorttxids.size() + i)
+            return READ_STATUS_INVALID;
+        txn_available[nLastPrefilled] = prefilled.tx;
+        vAvailable[nLastPrefilled] = true;
+    }
+    nPrefilled = cmpctblock.prefilledtxn.size();
+
+    // The short IDs go to the positions left over by the prefilled transactions
+    boost::unordered_map<uint64_t, uint16_t> mapShortIDs(cmpctblock.shorttxids.size());
+    size_t nIndexOffset = 0;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        while (vAvailable[i + nIndexOffset])
+            nIndexOffset++;
+        uint64_t shortid = cmpctblock.shorttxids[i];
+        mapShortIDs[shortid] = i + nIndexOffset;
+        if (mapShortIDs.bucket_size(mapShortIDs.bucket(shortid)) > MAX_SHORTTXID_BUCKET_SIZE)
+            return READ_STATUS_FAILED;
+    }
+    // Two transactions of the block with the same short ID
+    if (mapShortIDs.size() != cmpctblock.shorttxids.size())
+        return READ_STATUS_FAILED;
+
+    // A mempool transaction matching a short ID that another one matched
+    // already is as good as none, the block may have either
+    std::vector<bool> vMatched(txn_available.size());
+    {
+        LOCK(pool->cs);
+        for (CTxMemPool::indexed_transaction_set::const_iterator it = pool->mapTx.begin(); it != pool->mapTx.end(); ++it) {
+            const CTransaction& tx = it->GetTx();
+            boost::unordered_map<uint64_t, uint16_t>::const_iterator itShortID = mapShortIDs.find(cmpctblock.GetShortID(tx.GetHash()));
+            if (itShortID == mapShortIDs.end())
+                continue;
+            uint16_t index = itShortID->second;
+            if (!vMatched[index]) {
+                txn_available[index] = tx;
+                vAvailable[index] = true;
+                vMatched[index] = true;
+                nFromMempool++;
+            } else if (vAvailable[index]) {
+                txn_available[index] = CTransaction();
+                vAvailable[index] = false;
+                nFromMempool--;
+            }
+            if (nFromMempool == mapShortIDs.size())
+                break;
+        }
+    }
+
+    LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n",
+        cmpctblock.header.GetHash().ToString(), ::GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
+    return READ_STATUS_OK;
+}
+
+bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const
+{
+    assert(!header.IsNull());
+    assert(index < vAvailable.size());
+    return vAvailable[index];
+}
+
+void PartiallyDownloadedBlock::GetMissing(std::vector<uint16_t>& vIndexes) const
+{
+    assert(!header.IsNull());
+    vIndexes.clear();
+    for (size_t i = 0; i < vAvailable.size(); i++) {
+        if (!vAvailable[i])
+            vIndexes.push_back(i);
+    }
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing)
+{
+    assert(!header.IsNull());
+    block = CBlock(header);
+    block.vtx.resize(txn_available.size());
+    block.vchBlockSig.swap(vchBlockSig);
+
+    size_t nMissingOffset = 0;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (vAvailable[i]) {
+            block.vtx[i] = txn_available[i];
+        } else {
+            if (vtxMissing.size() <= nMissingOffset)
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtxMissing[nMissingOffset++];
+        }
+    }
+
+    // Make sure it can't be filled twice
+    header.SetNull();
+    txn_available.clear();
+    vAvailable.clear();
+
+    if (vtxMissing.size() != nMissingOffset)
+        return READ_STATUS_INVALID;
+
+    // A mempool transaction that only shares the short ID of the one in the
+    // block gives a different merkle root, which is no fault of the peer
+    bool fMutated;
+    if (block.BuildMerkleTree(&fMutated) != block.hashMerkleRoot || fMutated)
+        return READ_STATUS_FAILED;
+
+    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool and %lu txn requested\n",
+        block.GetHash().ToString(), nPrefilled, nFromMempool, vtxMissing.size());
+    return READ_STATUS_OK;
+}
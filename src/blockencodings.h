@@ -0,0 +1,210 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_BLOCKENCODINGS_H
+#define SNODECOIN_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <ios>
+#include <limits>
+#include <vector>
+
+#include <stdint.h>
+
+class CTxMemPool;
+
+//! -compactblocks default
+static const bool DEFAULT_COMPACT_BLOCKS = true;
+//! Version of the compact block encoding, sent along with sendcmpct
+static const uint64_t COMPACT_BLOCKS_VERSION = 1;
+
+/**
+ * A getblocktxn message: the positions in a block of the transactions a
+ * peer could not find for a compact block. The positions are sent as the
+ * difference from the previous one, minus one.
+ */
+class BlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        uint64_t nCount = indexes.size();
+        READWRITE(COMPACTSIZE(nCount));
+        if (ser_action.ForRead()) {
+            indexes.clear();
+            uint64_t nOffset = 0;
+            while (indexes.size() < nCount) {
+                uint64_t nIndex = 0;
+                READWRITE(COMPACTSIZE(nIndex));
+                nIndex += nOffset;
+                if (nIndex > std::numeric_limits<uint16_t>::max())
+                    throw std::ios_base::failure("getblocktxn index overflowed 16 bits");
+                indexes.push_back(nIndex);
+                nOffset = nIndex + 1;
+            }
+        } else {
+            for (unsigned int i = 0; i < indexes.size(); i++) {
+                uint64_t nIndex = indexes[i] - (i == 0 ? 0 : indexes[i - 1] + 1);
+                READWRITE(COMPACTSIZE(nIndex));
+            }
+        }
+    }
+};
+
+/** A blocktxn message: the transactions asked for by a getblocktxn, in the same order */
+class BlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    BlockTransactions() {}
+    BlockTransactions(const BlockTransactionsRequest& req) : blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+/** A transaction sent in full with a compact block, at index positions after the previous one */
+struct PrefilledTransaction {
+    uint16_t index;
+    CTransaction tx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        uint64_t nIndex = index;
+        READWRITE(COMPACTSIZE(nIndex));
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("prefilled transaction index overflowed 16 bits");
+        index = nIndex;
+        READWRITE(tx);
+    }
+};
+
+/**
+ * A cmpctblock message: a block header with a 6-byte short ID in place of
+ * each transaction the receiver likely has in its mempool. The coinbase
+ * and, for proof-of-stake blocks, the coinstake can't be in anyone's
+ * mempool, so they are sent in full. The short IDs are SipHash-2-4 of the
+ * txid, keyed by the header and a random nonce so that nobody can grind
+ * transactions to collide with them for every peer at once.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    mutable uint64_t shorttxidk0, shorttxidk1;
+    uint64_t nonce;
+
+    void FillShortTxIDSelector() const;
+
+public:
+    CBlockHeader header;
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+    //! Signature of a proof-of-stake block, which the header doesn't cover
+    std::vector<unsigned char> vchBlockSig;
+
+    CBlockHeaderAndShortTxIDs() : shorttxidk0(0), shorttxidk1(0), nonce(0) {}
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    //! Whether the second transaction of the block is a coinstake, which comes prefilled
+    bool IsProofOfStake() const
+    {
+        return prefilledtxn.size() > 1 && prefilledtxn[0].index == 0 && prefilledtxn[1].index == 0 && prefilledtxn[1].tx.IsCoinStake();
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nonce);
+        uint64_t nCount = shorttxids.size();
+        READWRITE(COMPACTSIZE(nCount));
+        if (ser_action.ForRead()) {
+            shorttxids.clear();
+            while (shorttxids.size() < nCount) {
+                uint32_t lsb = 0;
+                uint16_t msb = 0;
+                READWRITE(lsb);
+                READWRITE(msb);
+                shorttxids.push_back((uint64_t(msb) << 32) | uint64_t(lsb));
+            }
+        } else {
+            for (unsigned int i = 0; i < shorttxids.size(); i++) {
+                uint32_t lsb = shorttxids[i] & 0xffffffff;
+                uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+                READWRITE(lsb);
+                READWRITE(msb);
+            }
+        }
+        READWRITE(prefilledtxn);
+        READWRITE(vchBlockSig);
+
+        if (ser_action.ForRead())
+            FillShortTxIDSelector();
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //! Invalid object, peer is sending bogus data
+    READ_STATUS_FAILED,  //! Failed to process object, e.g. a short ID collision; fall back to the full block
+};
+
+/**
+ * A block being rebuilt from a compact block: the prefilled transactions
+ * and those found in the mempool, waiting for the rest to arrive in a
+ * blocktxn message.
+ */
+class PartiallyDownloadedBlock
+{
+private:
+    std::vector<CTransaction> txn_available;
+    std::vector<bool> vAvailable;
+    std::vector<unsigned char> vchBlockSig;
+    CTxMemPool* pool;
+
+public:
+    CBlockHeader header;
+    size_t nPrefilled;
+    size_t nFromMempool;
+
+    PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn), nPrefilled(0), nFromMempool(0) {}
+
+    /** Fill in what the compact block and the mempool have. Requires that it wasn't called before. */
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
+    bool IsTxAvailable(size_t index) const;
+    /** The positions of the transactions to ask the peer for */
+    void GetMissing(std::vector<uint16_t>& vIndexes) const;
+    /** Assemble the block with the missing transactions, in the order GetMissing() returned them */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing);
+};
+
+#endif // SNODECOIN_BLOCKENCODINGS_H
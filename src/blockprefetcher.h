@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_BLOCKPREFETCHER_H
+#define SNODECOIN_BLOCKPREFETCHER_H
+
+#include "main.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/** Default number of blocks the prefetch workers may run ahead of the consumer */
+static const unsigned int DEFAULT_BLOCK_PREFETCH_WINDOW = 256;
+
+/**
+ * Reads a fixed sequence of blocks from disk on a pool of worker threads and
+ * runs a per-block function on each of them there, so that a single consumer
+ * can fold the results in sequence order without waiting on I/O or parsing.
+ *
+ * The consumer must call Get() with increasing positions; workers never run
+ * more than nWindow blocks ahead of it. The process function runs without
+ * any locks held and must not touch chainActive or other cs_main state.
+ */
+template <typename T>
+class CBlockPrefetcher
+{
+public:
+    typedef boost::function<bool(const CBlock&, size_t nPos, T&)> ProcessFn;
+
+private:
+    struct Item {
+        bool fDone;
+        bool fOk;
+        T result;
+
+        Item() : fDone(false), fOk(false) {}
+    };
+
+    const std::vector<const CBlockIndex*> vIndex;
+    const ProcessFn process;
+    const size_t nWindow;
+
+    boost::mutex mutex;
+    //! Workers wait on this for the consumer to advance
+    boost::condition_variable condWorker;
+    //! The consumer waits on this for its next block
+    boost::condition_variable condConsumer;
+
+    std::vector<Item> vItems;
+    //! Next position to hand to a worker
+    size_t nNext;
+    //! Next position the consumer will ask for
+    size_t nConsumed;
+    bool fInterrupt;
+
+    boost::thread_group threadGroup;
+
+    void ThreadWorker()
+    {
+        while (true) {
+            size_t nPos;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fInterrupt && nNext < vIndex.size() && nNext >= nConsumed + nWindow)
+                    condWorker.wait(lock);
+                if (fInterrupt || nNext >= vIndex.size())
+                    return;
+                nPos = nNext++;
+            }
+
+            T result;
+            CBlock block;
+            bool fOk = ReadBlockFromDisk(block, vIndex[nPos]) && process(block, nPos, result);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            Item& item = vItems[nPos];
+            std::swap(item.result, result);
+            item.fOk = fOk;
+            item.fDone = true;
+            if (nPos == nConsumed)
+                condConsumer.notify_one();
+        }
+    }
+
+public:
+    CBlockPrefetcher(const std::vector<const CBlockIndex*>& vIndexIn, const ProcessFn& processIn, int nThreads, size_t nWindowIn = DEFAULT_BLOCK_PREFETCH_WINDOW)
+        : vIndex(vIndexIn), process(processIn), nWindow(std::max(nWindowIn, (size_t)1)), vItems(vIndexIn.size()), nNext(0), nConsumed(0), fInterrupt(false)
+    {
+        for (int i = 0; i < std::max(nThreads, 1); i++)
+            threadGroup.create_thread(boost::bind(&CBlockPrefetcher::ThreadWorker, this));
+    }
+
+    ~CBlockPrefetcher()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fInterrupt = true;
+        }
+        condWorker.notify_all();
+        threadGroup.join_all();
+    }
+
+    size_t size() const { return vIndex.size(); }
+    const CBlockIndex* GetIndex(size_t nPos) const { return vIndex[nPos]; }
+
+    /** Wait for the block at nPos, and move its result out. Returns false if it could not be read or processed. */
+    bool Get(size_t nPos, T& result)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        assert(nPos >= nConsumed && nPos < vIndex.size());
+        if (nPos > nConsumed) {
+            // Skipping ahead releases the window for the skipped blocks
+            nConsumed = nPos;
+            nNext = std::max(nNext, nPos);
+            condWorker.notify_all();
+        }
+        Item& item = vItems[nPos];
+        while (!item.fDone)
+            condConsumer.wait(lock);
+        std::swap(result, item.result);
+        nConsumed = nPos + 1;
+        condWorker.notify_all();
+        return item.fOk;
+    }
+};
+
+#endif // SNODECOIN_BLOCKPREFETCHER_H
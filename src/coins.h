@@ -7,6 +7,8 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "core_memusage.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -15,6 +17,9 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
+#include <limits>
+
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 
@@ -283,6 +288,70 @@ public:
                 return false;
         return true;
     }
+
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH (const CTxOut& out, vout)
+            ret += RecursiveDynamicUsage(out.scriptPubKey);
+        return ret;
+    }
+};
+
+/**
+ * A single unspent output of a CCoins, as the coin database stores it: under
+ * its own outpoint, so that spending one output of a transaction does not
+ * rewrite all the others.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nHeight * 4 + fCoinStake * 2 + fCoinBase)
+ * - the CTxOut (via CTxOutCompressor)
+ */
+class CCoinsOutput
+{
+public:
+    //! the output itself
+    CTxOut out;
+
+    //! the transaction's metadata, as in CCoins
+    bool fCoinBase;
+    bool fCoinStake;
+    int nHeight;
+    int nVersion;
+
+    CCoinsOutput() : fCoinBase(false), fCoinStake(false), nHeight(0), nVersion(0) {}
+
+    CCoinsOutput(const CCoins& coins, unsigned int nPos) : out(coins.vout[nPos]), fCoinBase(coins.fCoinBase), fCoinStake(coins.fCoinStake),
+                                                           nHeight(coins.nHeight), nVersion(coins.nVersion) {}
+
+    //! put the output back at position nPos of coins, which holds the other outputs of its transaction
+    void ApplyTo(CCoins& coins, unsigned int nPos) const
+    {
+        coins.fCoinBase = fCoinBase;
+        coins.fCoinStake = fCoinStake;
+        coins.nHeight = nHeight;
+        coins.nVersion = nVersion;
+        if (coins.vout.size() <= nPos)
+            coins.vout.resize(nPos + 1);
+        coins.vout[nPos] = out;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(VARINT(this->nVersion));
+        unsigned int nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 4;
+            fCoinStake = (nCode & 2) != 0;
+            fCoinBase = (nCode & 1) != 0;
+        }
+        READWRITE(REF(CTxOutCompressor(out)));
+    }
 };
 
 class CCoinsKeyHasher
@@ -316,7 +385,16 @@ struct CCoinsCacheEntry {
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * The coins cache holds millions of small entries, so its nodes come out of a
+ * pool instead of one malloc each. The blocks leave room for the pointers and
+ * hash boost::unordered adds to every node.
+ */
+typedef PoolAllocator<std::pair<const uint256, CCoinsCacheEntry>,
+    sizeof(std::pair<const uint256, CCoinsCacheEntry>) + sizeof(void*) * 4,
+    alignof(void*)>
+    CCoinsMapAllocator;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
 
 struct CCoinsStats {
     int nHeight;
@@ -346,8 +424,8 @@ public:
     virtual uint256 GetBestBlock() const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    //! The passed mapCoins can be modified, and is emptied if fErase is set.
+    virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats& stats) const;
@@ -369,7 +447,7 @@ public:
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView& viewIn);
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase);
     bool GetStats(CCoinsStats& stats) const;
 };
 
@@ -398,7 +476,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -419,8 +498,12 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    CCoinsMapAllocator::ResourceType cacheCoinsResource;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -430,7 +513,7 @@ public:
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256& hashBlock);
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase);
 
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
@@ -453,9 +536,22 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, but keep the
+     * entries, as the next blocks are likely to spend what the last ones
+     * created. Entries that were only read since the last write are dropped
+     * first while the cache uses more than nTargetUsage bytes, so a full
+     * cache does not have to be wiped. Drop the rest by calling it again.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync(size_t nTargetUsage = std::numeric_limits<size_t>::max());
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of snodecoin coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -479,6 +575,9 @@ public:
 private:
     CCoinsMap::iterator FetchCoins(const uint256& txid);
     CCoinsMap::const_iterator FetchCoins(const uint256& txid) const;
+
+    //! Give the memory of an empty cache back, which clearing it does not do
+    void ReallocateCache();
 };
 
 #endif // BITCOIN_COINS_H
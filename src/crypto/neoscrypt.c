@@ -3253,6 +3253,96 @@ void neoscrypt_fastkdf_4way(const uchar *password, const uchar *salt,
 
 #endif /* (ASM) && (MINER_4WAY) */
 
+
+/* Batch hashing for block header verification: the default profile is run
+ * 8 (AVX2) or 4 (SSE2) lanes wide when the CPU supports it */
+
+#if !defined(ASM) && !defined(OPT) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+
+#define NEOSCRYPT_NWAY
+
+typedef uint neoscrypt_v4 __attribute__((vector_size(16)));
+typedef uint neoscrypt_v8 __attribute__((vector_size(32)));
+
+#define NWAY_V neoscrypt_v4
+#define NWAY_LANES 4
+#define NWAY_SUFFIX 4way_sse2
+#define NWAY_ATTR __attribute__((target("sse2")))
+#include "neoscrypt_nway.h"
+#undef NWAY_V
+#undef NWAY_LANES
+#undef NWAY_SUFFIX
+#undef NWAY_ATTR
+
+#define NWAY_V neoscrypt_v8
+#define NWAY_LANES 8
+#define NWAY_SUFFIX 8way_avx2
+#define NWAY_ATTR __attribute__((target("avx2")))
+#include "neoscrypt_nway.h"
+#undef NWAY_V
+#undef NWAY_LANES
+#undef NWAY_SUFFIX
+#undef NWAY_ATTR
+
+#endif /* NEOSCRYPT_NWAY */
+
+uint neoscrypt_batch_lanes() {
+
+#ifdef NEOSCRYPT_NWAY
+    if(__builtin_cpu_supports("avx2"))
+      return(8);
+    if(__builtin_cpu_supports("sse2"))
+      return(4);
+#endif
+
+    return(1);
+}
+
+void neoscrypt_batch(const uchar * const *password, uchar * const *output,
+  uint count, uint profile) {
+    uint i = 0;
+
+#ifdef NEOSCRYPT_NWAY
+    const size_t align = 0x40;
+    const uint lanes = profile ? 1 : neoscrypt_batch_lanes();
+    const uchar *lane_password[8];
+    uchar *lane_output[8];
+    uchar unused_output[8][32];
+    uchar *mem;
+    void *scratch;
+    uint n, width, l;
+
+    /* A single hash is cheaper on the scalar path */
+    if((lanes > 1) && (count > 1)) {
+        mem = (uchar *) malloc((2 + 128) * 64 * lanes * sizeof(uint) + align);
+        if(mem) {
+            scratch = (void *) (((size_t)mem & ~(align - 1)) + align);
+            while(i + 1 < count) {
+                n = MIN(count - i, lanes);
+                width = ((lanes == 8) && (n <= 4)) ? 4 : lanes;
+                /* Idle lanes repeat the last password into scrap space */
+                for(l = 0; l < width; l++) {
+                    lane_password[l] = password[i + MIN(l, n - 1)];
+                    lane_output[l] = (l < n) ? output[i + l] : unused_output[l];
+                }
+                if(width == 8)
+                  neoscrypt_nway_8way_avx2(lane_password, lane_output,
+                    (neoscrypt_v8 *) scratch);
+                else
+                  neoscrypt_nway_4way_sse2(lane_password, lane_output,
+                    (neoscrypt_v4 *) scratch);
+                i += n;
+            }
+            free(mem);
+        }
+    }
+#endif
+
+    for(; i < count; i++)
+      neoscrypt(password[i], output[i], profile);
+}
+
 #ifndef ASM
 uint cpu_vec_exts() {
 
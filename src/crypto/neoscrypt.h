@@ -32,6 +32,14 @@ void neoscrypt_fastkdf_4way(const unsigned char *password,
 
 unsigned int cpu_vec_exts(void);
 
+/* Hashes count passwords, with the same results as calling neoscrypt() on
+ * each; profile 0 is computed several at a time with SIMD if available */
+void neoscrypt_batch(const unsigned char * const *password,
+  unsigned char * const *output, unsigned int count, unsigned int profile);
+
+/* Number of hashes neoscrypt_batch() computes at a time on this CPU */
+unsigned int neoscrypt_batch_lanes(void);
+
 #if (__cplusplus)
 }
 #else
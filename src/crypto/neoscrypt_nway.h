@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2018 The Snodecoin developers
+ * Distributed under the MIT software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+/* Multi-lane NeoScrypt(128, 2, 1) engine, included by neoscrypt.c once per
+ * vector width with these defined:
+ *   NWAY_V      vector of NWAY_LANES 32-bit words;
+ *   NWAY_LANES  number of hashes computed together;
+ *   NWAY_SUFFIX appended to the function names;
+ *   NWAY_ATTR   function attributes, e.g. the target instruction set.
+ *
+ * Word w of lane l lives in X[w][l], so each Salsa20 and ChaCha20 operation
+ * works on all lanes at once. FastKDF and the data dependent scratchpad
+ * reads of the second SMix loop are done per lane. */
+
+#define NWAY_FN(name) NWAY_FN2(name, NWAY_SUFFIX)
+#define NWAY_FN2(name, suffix) NWAY_FN3(name, suffix)
+#define NWAY_FN3(name, suffix) name ## suffix
+
+#define NWAY_ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+/* Salsa20/20 of one 16 word block in every lane */
+static NWAY_ATTR void NWAY_FN(neoscrypt_salsa_)(NWAY_V *X) {
+    NWAY_V x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, t;
+    uint rounds;
+
+    x0 = X[0];   x1 = X[1];   x2 = X[2];   x3 = X[3];
+    x4 = X[4];   x5 = X[5];   x6 = X[6];   x7 = X[7];
+    x8 = X[8];   x9 = X[9];  x10 = X[10]; x11 = X[11];
+   x12 = X[12]; x13 = X[13]; x14 = X[14]; x15 = X[15];
+
+#define quarter(a, b, c, d) \
+    t = a + d; t = NWAY_ROTL(t,  7); b ^= t; \
+    t = b + a; t = NWAY_ROTL(t,  9); c ^= t; \
+    t = c + b; t = NWAY_ROTL(t, 13); d ^= t; \
+    t = d + c; t = NWAY_ROTL(t, 18); a ^= t;
+
+    for(rounds = 20; rounds; rounds -= 2) {
+        quarter( x0,  x4,  x8, x12);
+        quarter( x5,  x9, x13,  x1);
+        quarter(x10, x14,  x2,  x6);
+        quarter(x15,  x3,  x7, x11);
+        quarter( x0,  x1,  x2,  x3);
+        quarter( x5,  x6,  x7,  x4);
+        quarter(x10, x11,  x8,  x9);
+        quarter(x15, x12, x13, x14);
+    }
+
+    X[0] += x0;   X[1] += x1;   X[2] += x2;   X[3] += x3;
+    X[4] += x4;   X[5] += x5;   X[6] += x6;   X[7] += x7;
+    X[8] += x8;   X[9] += x9;  X[10] += x10; X[11] += x11;
+   X[12] += x12; X[13] += x13; X[14] += x14; X[15] += x15;
+
+#undef quarter
+}
+
+/* ChaCha20/20 of one 16 word block in every lane */
+static NWAY_ATTR void NWAY_FN(neoscrypt_chacha_)(NWAY_V *X) {
+    NWAY_V x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, t;
+    uint rounds;
+
+    x0 = X[0];   x1 = X[1];   x2 = X[2];   x3 = X[3];
+    x4 = X[4];   x5 = X[5];   x6 = X[6];   x7 = X[7];
+    x8 = X[8];   x9 = X[9];  x10 = X[10]; x11 = X[11];
+   x12 = X[12]; x13 = X[13]; x14 = X[14]; x15 = X[15];
+
+#define quarter(a,b,c,d) \
+    a += b; t = d ^ a; d = NWAY_ROTL(t, 16); \
+    c += d; t = b ^ c; b = NWAY_ROTL(t, 12); \
+    a += b; t = d ^ a; d = NWAY_ROTL(t,  8); \
+    c += d; t = b ^ c; b = NWAY_ROTL(t,  7);
+
+    for(rounds = 20; rounds; rounds -= 2) {
+        quarter( x0,  x4,  x8, x12);
+        quarter( x1,  x5,  x9, x13);
+        quarter( x2,  x6, x10, x14);
+        quarter( x3,  x7, x11, x15);
+        quarter( x0,  x5, x10, x15);
+        quarter( x1,  x6, x11, x12);
+        quarter( x2,  x7,  x8, x13);
+        quarter( x3,  x4,  x9, x14);
+    }
+
+    X[0] += x0;   X[1] += x1;   X[2] += x2;   X[3] += x3;
+    X[4] += x4;   X[5] += x5;   X[6] += x6;   X[7] += x7;
+    X[8] += x8;   X[9] += x9;  X[10] += x10; X[11] += x11;
+   X[12] += x12; X[13] += x13; X[14] += x14; X[15] += x15;
+
+#undef quarter
+}
+
+static NWAY_ATTR void NWAY_FN(neoscrypt_blkxor_)(NWAY_V *dst, const NWAY_V *src) {
+    uint i;
+
+    for(i = 0; i < 16; i++)
+      dst[i] ^= src[i];
+}
+
+/* The r = 2 block mixer of neoscrypt_blkmix() */
+static NWAY_ATTR void NWAY_FN(neoscrypt_blkmix_)(NWAY_V *X, uint mixer) {
+    NWAY_V t;
+    uint i;
+
+    if(mixer) {
+        NWAY_FN(neoscrypt_blkxor_)(&X[0], &X[48]);
+        NWAY_FN(neoscrypt_chacha_)(&X[0]);
+        NWAY_FN(neoscrypt_blkxor_)(&X[16], &X[0]);
+        NWAY_FN(neoscrypt_chacha_)(&X[16]);
+        NWAY_FN(neoscrypt_blkxor_)(&X[32], &X[16]);
+        NWAY_FN(neoscrypt_chacha_)(&X[32]);
+        NWAY_FN(neoscrypt_blkxor_)(&X[48], &X[32]);
+        NWAY_FN(neoscrypt_chacha_)(&X[48]);
+    } else {
+        NWAY_FN(neoscrypt_blkxor_)(&X[0], &X[48]);
+        NWAY_FN(neoscrypt_salsa_)(&X[0]);
+        NWAY_FN(neoscrypt_blkxor_)(&X[16], &X[0]);
+        NWAY_FN(neoscrypt_salsa_)(&X[16]);
+        NWAY_FN(neoscrypt_blkxor_)(&X[32], &X[16]);
+        NWAY_FN(neoscrypt_salsa_)(&X[32]);
+        NWAY_FN(neoscrypt_blkxor_)(&X[48], &X[32]);
+        NWAY_FN(neoscrypt_salsa_)(&X[48]);
+    }
+
+    for(i = 16; i < 32; i++) {
+        t = X[i];
+        X[i] = X[i + 16];
+        X[i + 16] = t;
+    }
+}
+
+/* SMix(X) with N = 128 and r = 2 in every lane; V holds 128 * 64 words */
+static NWAY_ATTR void NWAY_FN(neoscrypt_smix_)(NWAY_V *X, NWAY_V *V, uint mixer) {
+    NWAY_V t;
+    uint i, j, l, w;
+    uint idx[NWAY_LANES];
+
+    for(i = 0; i < 128; i++) {
+        for(w = 0; w < 64; w++)
+          V[i * 64 + w] = X[w];
+        NWAY_FN(neoscrypt_blkmix_)(X, mixer);
+    }
+
+    for(i = 0; i < 128; i++) {
+        /* integerify(X) mod N, per lane */
+        for(l = 0; l < NWAY_LANES; l++)
+          idx[l] = 64 * (X[48][l] & 127);
+        for(w = 0; w < 64; w++) {
+            for(l = 0; l < NWAY_LANES; l++)
+              t[l] = V[idx[l] + w][l];
+            X[w] ^= t;
+        }
+        NWAY_FN(neoscrypt_blkmix_)(X, mixer);
+    }
+}
+
+/* NeoScrypt(128, 2, 1) with FastKDF-BLAKE2s (profile 0) of NWAY_LANES
+ * passwords; scratch holds (2 + 128) * 64 aligned vectors */
+static NWAY_ATTR void NWAY_FN(neoscrypt_nway_)(const uchar * const *password,
+  uchar * const *output, NWAY_V *scratch) {
+    NWAY_V *X = &scratch[0], *Z = &scratch[64], *V = &scratch[128];
+    uint buf[64];
+    uint l, w;
+
+    /* X = KDF(password, salt), Z = X */
+    for(l = 0; l < NWAY_LANES; l++) {
+        neoscrypt_fastkdf(password[l], 80, password[l], 80, 32,
+          (uchar *) buf, 2 * 2 * BLOCK_SIZE);
+        for(w = 0; w < 64; w++)
+          X[w][l] = buf[w];
+    }
+    for(w = 0; w < 64; w++)
+      Z[w] = X[w];
+
+    /* Z = SMix(Z) with ChaCha, X = SMix(X) with Salsa */
+    NWAY_FN(neoscrypt_smix_)(Z, V, 1);
+    NWAY_FN(neoscrypt_smix_)(X, V, 0);
+
+    /* output = KDF(password, X ^ Z) */
+    for(l = 0; l < NWAY_LANES; l++) {
+        for(w = 0; w < 64; w++)
+          buf[w] = X[w][l] ^ Z[w][l];
+        neoscrypt_fastkdf(password[l], 80, (uchar *) buf,
+          2 * 2 * BLOCK_SIZE, 32, output[l], 32);
+    }
+}
+
+#undef NWAY_ROTL
+#undef NWAY_FN3
+#undef NWAY_FN2
+#undef NWAY_FN
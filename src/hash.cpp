@@ -79,6 +79,57 @@ void BIP32Hash(const unsigned char chainCode[32], unsigned int nChild, unsigned
     CHMAC_SHA512(chainCode, 32).Write(&header, 1).Write(data, 32).Write(num, 4).Finalize(output);
 }
 
+#define SIPROUND                          \
+    do {                                  \
+        v0 += v1;                         \
+        v1 = (v1 << 13) | (v1 >> 51);     \
+        v1 ^= v0;                         \
+        v0 = (v0 << 32) | (v0 >> 32);     \
+        v2 += v3;                         \
+        v3 = (v3 << 16) | (v3 >> 48);     \
+        v3 ^= v2;                         \
+        v0 += v3;                         \
+        v3 = (v3 << 21) | (v3 >> 43);     \
+        v3 ^= v0;                         \
+        v2 += v1;                         \
+        v1 = (v1 << 17) | (v1 >> 47);     \
+        v1 ^= v2;                         \
+        v2 = (v2 << 32) | (v2 >> 32);     \
+    } while (0)
+
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    // The value is four little endian 64-bit words
+    for (int i = 0; i < 4; i++) {
+        uint64_t d = val.Get64(i);
+        v3 ^= d;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= d;
+    }
+
+    // Final block: just the message length of 32 bytes in the top byte
+    uint64_t b = ((uint64_t)32) << 56;
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+
 void scrypt_hash(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char* output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen)
 {
     scrypt(pass, pLen, salt, sLen, output, N, r, p, dkLen);
@@ -7,13 +7,17 @@
 
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
 #include "timedata.h"
 #include "util.h"
 
+#include <atomic>
+
 using namespace std;
 
 bool fTestNet = false; //Params().NetworkID() == CBaseChainParams::TESTNET; //not allow to run PoS in TestNet
@@ -245,12 +249,8 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
-bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernelStakeModifierIndex(const CBlockIndex* pindexFrom, const CBlockIndex*& pindexModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime)
 {
-    nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
-        return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
@@ -271,7 +271,19 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
             nStakeModifierTime = pindex->GetBlockTime();
         }
     }
-    nStakeModifier = pindex->nStakeModifier;
+    pindexModifier = pindex;
+    return true;
+}
+
+bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+{
+    nStakeModifier = 0;
+    if (!mapBlockIndex.count(hashBlockFrom))
+        return error("GetKernelStakeModifier() : block not indexed");
+    const CBlockIndex* pindexModifier;
+    if (!GetKernelStakeModifierIndex(mapBlockIndex[hashBlockFrom], pindexModifier, nStakeModifierHeight, nStakeModifierTime))
+        return false;
+    nStakeModifier = pindexModifier->nStakeModifier;
     return true;
 }
 
@@ -293,7 +305,7 @@ bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTarget
 }
 
 //instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, const CTransaction& txPrev, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
     //assign new variables to make it easier to read
     int64_t nValueIn = txPrev.vout[prevout.n].nValue;
@@ -369,6 +381,134 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     return fSuccess;
 }
 
+bool GetStakeKernelCandidate(const CBlockIndex* pindexFrom, const COutPoint& prevout, CAmount nValue, CStakeKernelCandidate& candidate)
+{
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+    if (!GetKernelStakeModifierIndex(pindexFrom, candidate.pindexModifier, nStakeModifierHeight, nStakeModifierTime))
+        return false;
+
+    candidate.prevout = prevout;
+    candidate.nValue = nValue;
+    candidate.nTimeBlockFrom = pindexFrom->GetBlockTime();
+    candidate.nStakeModifier = candidate.pindexModifier->nStakeModifier;
+    return true;
+}
+
+bool IsStakeKernelCandidateStale(const CStakeKernelCandidate& candidate)
+{
+    return !chainActive.Contains(candidate.pindexModifier);
+}
+
+namespace {
+
+/** One hash drift search over a table of kernel candidates, shared by the threads doing it */
+class CStakeKernelSearch
+{
+private:
+    const std::vector<CStakeKernelCandidate>& vCandidates;
+    const unsigned int nTimeTx;
+    const unsigned int nHashDrift;
+    const int nHeightStart;
+    uint256 bnTargetPerCoinDay;
+
+    boost::mutex mutex;
+    //! Lowest candidate found so far; candidates after it need not be hashed
+    std::atomic<size_t> nFound;
+    unsigned int nTimeTxFound;
+    uint256 hashProofOfStake;
+
+    bool HashCandidate(const CStakeKernelCandidate& candidate, unsigned int& nTimeTxRet, uint256& hashRet) const
+    {
+        if (nTimeTx < candidate.nTimeBlockFrom || candidate.nTimeBlockFrom + nStakeMinAge > nTimeTx)
+            return false;
+
+        // Same target as stakeTargetHit()
+        uint256 bnTarget = uint256(candidate.nValue) / 100 * bnTargetPerCoinDay;
+
+        // Serialize the stakeHash() input once, only the time at the end changes
+        CDataStream ss(SER_GETHASH, 0);
+        ss << candidate.nStakeModifier << candidate.nTimeBlockFrom << candidate.prevout.n << candidate.prevout.hash << nTimeTx;
+        std::vector<unsigned char> vch(ss.begin(), ss.end());
+        unsigned char* pchTime = &vch[vch.size() - sizeof(nTimeTx)];
+
+        for (unsigned int i = 0; i < nHashDrift; i++) {
+            unsigned int nTryTime = nTimeTx + nHashDrift - i;
+            WriteLE32(pchTime, nTryTime);
+            uint256 hash = Hash(vch.begin(), vch.end());
+            if (hash < bnTarget) {
+                nTimeTxRet = nTryTime;
+                hashRet = hash;
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    CStakeKernelSearch(const std::vector<CStakeKernelCandidate>& vCandidatesIn, unsigned int nBits, unsigned int nTimeTxIn, unsigned int nHashDriftIn)
+        : vCandidates(vCandidatesIn), nTimeTx(nTimeTxIn), nHashDrift(nHashDriftIn), nHeightStart(chainActive.Height()), nFound(vCandidatesIn.size()), nTimeTxFound(0)
+    {
+        bnTargetPerCoinDay.SetCompact(nBits);
+    }
+
+    /** Search every nStep-th candidate from nFirst on */
+    void Search(size_t nFirst, size_t nStep)
+    {
+        for (size_t n = nFirst; n < nFound.load(); n += nStep) {
+            //new block came in, move on
+            if (chainActive.Height() != nHeightStart)
+                break;
+
+            unsigned int nTryTime;
+            uint256 hash;
+            if (HashCandidate(vCandidates[n], nTryTime, hash)) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (n < nFound.load()) {
+                    nFound = n;
+                    nTimeTxFound = nTryTime;
+                    hashProofOfStake = hash;
+                }
+                break;
+            }
+        }
+    }
+
+    bool GetResult(size_t& nFoundRet, unsigned int& nTimeTxFoundRet, uint256& hashProofOfStakeRet)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nFound.load() >= vCandidates.size())
+            return false;
+        nFoundRet = nFound.load();
+        nTimeTxFoundRet = nTimeTxFound;
+        hashProofOfStakeRet = hashProofOfStake;
+        return true;
+    }
+};
+
+}
+
+bool FindStakeKernel(unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, size_t nStart, unsigned int nTimeTx, unsigned int nHashDrift, size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake, int nThreads)
+{
+    CStakeKernelSearch search(vCandidates, nBits, nTimeTx, nHashDrift);
+
+    // Threads take the candidates in turn, so that whichever finds a kernel
+    // first only has the others finish the candidate they are on. The result
+    // is the first candidate with a kernel, as if searched in order.
+    size_t nRemaining = nStart < vCandidates.size() ? vCandidates.size() - nStart : 0;
+    int nThreadsUsed = std::max(1, std::min(nThreads, MAX_STAKE_THREADS));
+    size_t nStep = std::max<size_t>(std::min<size_t>(nThreadsUsed, nRemaining), 1);
+    boost::thread_group threadGroup;
+    for (size_t i = 1; i < nStep; i++)
+        threadGroup.create_thread(boost::bind(&CStakeKernelSearch::Search, &search, nStart + i, nStep));
+    search.Search(nStart, nStep);
+    threadGroup.join_all();
+
+    mapHashedBlocks.clear();
+    mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+    return search.GetResult(nFound, nTimeTxFound, hashProofOfStake);
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
 {
@@ -26,7 +26,37 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 // Sets hashProofOfStake on success return
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, const CTransaction& txPrev, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+
+// Everything the kernel search needs to know about one stakeable output, so
+// that it can be hashed without going back to the block index
+struct CStakeKernelCandidate
+{
+    COutPoint prevout;
+    CAmount nValue;
+    unsigned int nTimeBlockFrom;
+    uint64_t nStakeModifier;
+    // Block the stake modifier was taken from; as long as it is in the active
+    // chain, so is the path to it from the block of the output
+    const CBlockIndex* pindexModifier;
+
+    CStakeKernelCandidate() : nValue(0), nTimeBlockFrom(0), nStakeModifier(0), pindexModifier(NULL) {}
+};
+
+// Fill in the kernel candidate of an output from the block that contains it
+bool GetStakeKernelCandidate(const CBlockIndex* pindexFrom, const COutPoint& prevout, CAmount nValue, CStakeKernelCandidate& candidate);
+
+// Whether a reorganisation changed the stake modifier of a kernel candidate
+bool IsStakeKernelCandidateStale(const CStakeKernelCandidate& candidate);
+
+// -stakethreads default, and the most threads the kernel search will use
+static const int DEFAULT_STAKE_THREADS = 1;
+static const int MAX_STAKE_THREADS = 16;
+
+// Search vCandidates from nStart on for the first one whose stake hash meets the
+// target at one of the nHashDrift times before nTimeTx + nHashDrift, on up to
+// nThreads threads. Gives up when a new block comes in.
+bool FindStakeKernel(unsigned int nBits, const std::vector<CStakeKernelCandidate>& vCandidates, size_t nStart, unsigned int nTimeTx, unsigned int nHashDrift, size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake, int nThreads = DEFAULT_STAKE_THREADS);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
@@ -164,10 +164,16 @@ public:
     }
 
     // not exactly clean encapsulation, but it's easiest for now
-    leveldb::Iterator* NewIterator()
+    leveldb::Iterator* NewIterator() const
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator for short seeks that stand in for point reads, which fill the block cache like Read() does
+    leveldb::Iterator* NewCachedIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -104,7 +104,7 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 
 /** Verifies that a commitment c is accumulated in accumulator a
  */
-bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& valueOfCommitmentToCoin) const {
+bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& valueOfCommitmentToCoin, const AccumulatorProofBatch* batch) const {
 	CBigNum sg = params->accumulatorPoKCommitmentGroup.g;
 	CBigNum sh = params->accumulatorPoKCommitmentGroup.h;
 
@@ -117,14 +117,33 @@ bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& v
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	const CBigNumFixedBase& sgTable = params->accumulatorPoKCommitmentGroup.gTable;
+	const CBigNumFixedBase& shTable = params->accumulatorPoKCommitmentGroup.hTable;
+	CBigNum sg_c = sgTable.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus);
+
+	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sgTable.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * shTable.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	CBigNum st_2_prime = (sg_c * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * shTable.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	CBigNum st_3_prime = (sg_c * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * shTable.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+
+	CBigNum t_1_prime, t_2_prime, t_3_prime, t_4_prime;
+	if (batch) {
+		// g_n and h_n come from the batch tables, the powers of their inverses
+		// are the inverses of their powers
+		const CBigNumFixedBase& g_nTable = batch->g_nTable;
+		const CBigNumFixedBase& h_nTable = batch->h_nTable;
+		t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_nTable.pow_mod(s_zeta, params->accumulatorModulus) * g_nTable.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
+		t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_nTable.pow_mod(s_eta, params->accumulatorModulus) * g_nTable.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
+		t_3_prime = (CBigNum::pow_mod_multi({a.getValue(), C_u}, {c, s_alpha}, params->accumulatorModulus) * h_nTable.pow_mod(-s_beta, params->accumulatorModulus)) % params->accumulatorModulus;
+		t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * h_nTable.pow_mod(-s_delta, params->accumulatorModulus) * g_nTable.pow_mod(-s_beta, params->accumulatorModulus)) % params->accumulatorModulus;
+	} else {
+		// Each t' is a product of three powers mod the accumulator modulus, so compute them together
+		CBigNum h_n_inv = h_n.inverse(params->accumulatorModulus);
+		CBigNum g_n_inv = g_n.inverse(params->accumulatorModulus);
+		t_1_prime = CBigNum::pow_mod_multi({C_r, h_n, g_n}, {c, s_zeta, s_epsilon}, params->accumulatorModulus);
+		t_2_prime = CBigNum::pow_mod_multi({C_e, h_n, g_n}, {c, s_eta, s_alpha}, params->accumulatorModulus);
+		t_3_prime = CBigNum::pow_mod_multi({a.getValue(), C_u, h_n_inv}, {c, s_alpha, s_beta}, params->accumulatorModulus);
+		t_4_prime = CBigNum::pow_mod_multi({C_r, h_n_inv, g_n_inv}, {s_alpha, s_delta, s_beta}, params->accumulatorModulus);
+	}
 
 	bool result = false;
 
@@ -35,8 +35,9 @@ public:
 	 */
 	AccumulatorProofOfKnowledge(const AccumulatorAndProofParams* p, const Commitment& commitmentToCoin, const AccumulatorWitness& witness, Accumulator& a);
 	/** Verifies that  a commitment c is accumulated in accumulated a
+	 * @param batch optional tables shared with other proofs being verified
 	 */
-	bool Verify(const Accumulator& a,const CBigNum& valueOfCommitmentToCoin) const;
+	bool Verify(const Accumulator& a,const CBigNum& valueOfCommitmentToCoin, const AccumulatorProofBatch* batch = NULL) const;
 	
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
@@ -91,7 +91,7 @@ public:
     CBigNum getAccCommitment() const { return accCommitmentToCoinValue; }
     CBigNum getSerialComm() const { return serialCommitmentToCoinValue; }
 
-    bool Verify(const Accumulator& a) const;
+    bool Verify(const Accumulator& a, const AccumulatorProofBatch* batch = NULL) const;
     bool HasValidSerial(ZerocoinParams* params) const;
     CBigNum CalculateValidSerial(ZerocoinParams* params);
 
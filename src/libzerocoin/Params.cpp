@@ -14,6 +14,8 @@
 #include "Params.h"
 #include "ParamGeneration.h"
 
+#include <algorithm>
+
 namespace libzerocoin {
 
 ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
@@ -26,6 +28,12 @@ ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	// Generate the parameters
 	CalculateParams(*this, N, ZEROCOIN_PROTOCOL_VERSION, securityLevel);
 
+	// Precompute the generator tables used by the proof verifiers
+	this->coinCommitmentGroup.Precompute();
+	this->serialNumberSoKCommitmentGroup.Precompute();
+	this->accumulatorParams.accumulatorPoKCommitmentGroup.Precompute();
+	this->accumulatorParams.Precompute();
+
 	this->accumulatorParams.initialized = true;
 	this->initialized = true;
 }
@@ -34,10 +42,36 @@ AccumulatorAndProofParams::AccumulatorAndProofParams() {
 	this->initialized = false;
 }
 
+void AccumulatorAndProofParams::Precompute() {
+	this->proofBatch.Init(this);
+}
+
+AccumulatorProofBatch::AccumulatorProofBatch(const AccumulatorAndProofParams* p) {
+	Init(p);
+}
+
+void AccumulatorProofBatch::Init(const AccumulatorAndProofParams* p) {
+	// The largest responses are s_beta and s_delta: r_beta - c*r_2*e, where r_beta is
+	// below aM_4 * the PoK modulus * 2^(k'+k''), c is a 256 bit hash, r_2 is below
+	// aM_4 and e is below maxCoinValue
+	uint32_t aM_4Bits = (p->accumulatorModulus / CBigNum((long)4)).bitSize();
+	uint32_t nRandBits = aM_4Bits + p->accumulatorPoKCommitmentGroup.modulus.bitSize() + p->k_prime + p->k_dprime;
+	uint32_t nChallengeBits = 256 + aM_4Bits + p->maxCoinValue.bitSize();
+	uint32_t nMaxBits = std::max(nRandBits, nChallengeBits) + 1;
+
+	this->g_nTable.InitBits(p->accumulatorQRNCommitmentGroup.g, p->accumulatorModulus, nMaxBits);
+	this->h_nTable.InitBits(p->accumulatorQRNCommitmentGroup.h, p->accumulatorModulus, nMaxBits);
+}
+
 IntegerGroupParams::IntegerGroupParams() {
 	this->initialized = false;
 }
 
+void IntegerGroupParams::Precompute() {
+	this->gTable.Init(this->g, this->modulus, this->groupOrder);
+	this->hTable.Init(this->h, this->modulus, this->groupOrder);
+}
+
 CBigNum IntegerGroupParams::randomElement() const {
 	// The generator of the group raised
 	// to a random number less than the order of the group
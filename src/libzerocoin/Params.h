@@ -56,6 +56,19 @@ public:
 	 */
 	CBigNum groupOrder;
 
+	/**
+	 * Fixed-base tables for g and h. These are not serialized
+	 * and are only populated by Precompute().
+	 */
+	CBigNumFixedBase gTable;
+	CBigNumFixedBase hTable;
+
+	/**
+	 * Builds gTable and hTable from the current g, h, modulus
+	 * and groupOrder.
+	 */
+	void Precompute();
+
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
 		    READWRITE(initialized);
@@ -66,6 +79,28 @@ public:
 	}	
 };
 
+class AccumulatorAndProofParams;
+
+/**Precomputation shared by accumulator proofs, such as all the spends in a
+ * block. Holds fixed-base tables for the generators of the accumulator QRN
+ * commitment group, sized for honestly generated responses.
+ */
+class AccumulatorProofBatch {
+public:
+	AccumulatorProofBatch() {}
+	AccumulatorProofBatch(const AccumulatorAndProofParams* p);
+
+	/**
+	 * Builds the tables for the accumulator QRN commitment group of p.
+	 */
+	void Init(const AccumulatorAndProofParams* p);
+
+	bool IsNull() const { return g_nTable.IsNull() || h_nTable.IsNull(); }
+
+	CBigNumFixedBase g_nTable;
+	CBigNumFixedBase h_nTable;
+};
+
 class AccumulatorAndProofParams {
 public:
 	/** @brief Construct a set of Zerocoin parameters from a modulus "N".
@@ -139,6 +174,19 @@ public:
 	 * The statistical zero-knowledgeness of the accumulator proof.
 	 */
 	uint32_t k_dprime;
+
+	/**
+	 * Tables for the accumulator QRN commitment group, shared read-only
+	 * by every accumulator proof verification. These are not serialized
+	 * and are only populated by Precompute().
+	 */
+	AccumulatorProofBatch proofBatch;
+
+	/**
+	 * Builds proofBatch from the current parameters.
+	 */
+	void Precompute();
+
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
 	    READWRITE(initialized);
@@ -111,10 +111,11 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 inline CBigNum SerialNumberSignatureOfKnowledge::challengeCalculation(const CBigNum& a_exp,const CBigNum& b_exp,
         const CBigNum& h_exp) const {
 
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
+	// a, b, g and h are fixed, so use their precomputed tables
+	const CBigNumFixedBase& a = params->coinCommitmentGroup.gTable;
+	const CBigNumFixedBase& b = params->coinCommitmentGroup.hTable;
+	const CBigNumFixedBase& g = params->serialNumberSoKCommitmentGroup.gTable;
+	const CBigNumFixedBase& h = params->serialNumberSoKCommitmentGroup.hTable;
 
 	CBigNum exponent = (a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder)
 	                   * b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
@@ -124,10 +125,14 @@ inline CBigNum SerialNumberSignatureOfKnowledge::challengeCalculation(const CBig
 
 bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, const CBigNum& valueOfCommitmentToCoin,
         const uint256 msghash) const {
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
+	const CBigNumFixedBase& b = params->coinCommitmentGroup.hTable;
+	const CBigNumFixedBase& h = params->serialNumberSoKCommitmentGroup.hTable;
+
+	// Roughly half of the iterations raise the commitment to an exponent
+	// below the group order, so build a table for it once and share it
+	CBigNumFixedBase commitmentTable;
+	commitmentTable.InitBits(valueOfCommitmentToCoin, params->serialNumberSoKCommitmentGroup.modulus,
+	                         params->serialNumberSoKCommitmentGroup.groupOrder.bitSize());
 	CHashWriter hasher(0,0);
 	hasher << *params << valueOfCommitmentToCoin << coinSerialNumber << msghash;
 
@@ -142,7 +147,7 @@ bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, c
 			tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], SeedTo1024(sprime[i].getuint256()));
 		} else {
 			CBigNum exp = b.pow_mod(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
-			tprime[i] = ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
+			tprime[i] = ((commitmentTable.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
 			             (h.pow_mod(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus)) %
 			            params->serialNumberSoKCommitmentGroup.modulus;
 		}
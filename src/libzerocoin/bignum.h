@@ -7,6 +7,7 @@
 #ifndef BITCOIN_BIGNUM_H
 #define BITCOIN_BIGNUM_H
 
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 #include <openssl/bn.h>
@@ -49,6 +50,29 @@ public:
     bool operator!() { return (pctx == NULL); }
 };
 
+/** RAII encapsulated BN_MONT_CTX (OpenSSL Montgomery multiplication context) */
+class CAutoBN_MONT_CTX
+{
+protected:
+    BN_MONT_CTX* pmont;
+
+public:
+    CAutoBN_MONT_CTX()
+    {
+        pmont = BN_MONT_CTX_new();
+        if (pmont == NULL)
+            throw bignum_error("CAutoBN_MONT_CTX : BN_MONT_CTX_new() returned NULL");
+    }
+
+    ~CAutoBN_MONT_CTX()
+    {
+        if (pmont != NULL)
+            BN_MONT_CTX_free(pmont);
+    }
+
+    operator BN_MONT_CTX*() { return pmont; }
+};
+
 
 /** C++ wrapper for BIGNUM (OpenSSL bignum) */
 class CBigNum
@@ -545,6 +569,88 @@ public:
         return ret;
     }
 
+    /**
+     * simultaneous modular exponentiation: bases[0]^exps[0] * bases[1]^exps[1] * ... mod m
+     * The exponentiations are interleaved (Straus' method) so all bases share
+     * one chain of squarings. The result is the same as multiplying the
+     * individual pow_mod results together mod m, including for negative exponents.
+     * @param bases the bases
+     * @param exps the exponents, one per base
+     * @param m modulus
+     */
+    static CBigNum pow_mod_multi(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps, const CBigNum& m) {
+        if (bases.size() != exps.size())
+            throw bignum_error("CBigNum::pow_mod_multi : bases and exponents differ in size");
+
+        CBigNum ret = CBigNum(1) % m;
+        if (m <= 1 || !BN_is_odd(m.bn)) {
+            // Montgomery multiplication needs an odd modulus
+            for (unsigned int i = 0; i < bases.size(); i++)
+                ret = ret.mul_mod(bases[i].pow_mod(exps[i], m), m);
+            return ret;
+        }
+
+        const unsigned int WINDOW_BITS = 4;
+        const unsigned int WINDOW_ENTRIES = (1 << WINDOW_BITS) - 1;
+
+        CAutoBN_CTX pctx;
+        CAutoBN_MONT_CTX mont;
+        if (!BN_MONT_CTX_set(mont, m.bn, pctx))
+            throw bignum_error("CBigNum::pow_mod_multi : BN_MONT_CTX_set failed");
+
+        // table[i * WINDOW_ENTRIES + d - 1] = bases[i]^d in Montgomery form
+        std::vector<CBigNum> absExps(exps);
+        std::vector<CBigNum> table(bases.size() * WINDOW_ENTRIES);
+        int nBits = 0;
+        for (unsigned int i = 0; i < bases.size(); i++) {
+            CBigNum base = bases[i];
+            if (absExps[i] < 0) {
+                // g^-x = (g^-1)^x
+                base = base.inverse(m);
+                BN_set_negative(absExps[i].bn, 0);
+            }
+            base = base % m;
+            CBigNum* row = &table[i * WINDOW_ENTRIES];
+            if (!BN_to_montgomery(row[0].bn, base.bn, mont, pctx))
+                throw bignum_error("CBigNum::pow_mod_multi : BN_to_montgomery failed");
+            for (unsigned int d = 1; d < WINDOW_ENTRIES; d++) {
+                if (!BN_mod_mul_montgomery(row[d].bn, row[d - 1].bn, row[0].bn, mont, pctx))
+                    throw bignum_error("CBigNum::pow_mod_multi : BN_mod_mul_montgomery failed");
+            }
+            nBits = std::max(nBits, absExps[i].bitSize());
+        }
+
+        CBigNum acc;
+        bool fEmpty = true;
+        for (int w = (nBits + WINDOW_BITS - 1) / WINDOW_BITS - 1; w >= 0; w--) {
+            for (unsigned int j = 0; j < WINDOW_BITS && !fEmpty; j++) {
+                if (!BN_mod_mul_montgomery(acc.bn, acc.bn, acc.bn, mont, pctx))
+                    throw bignum_error("CBigNum::pow_mod_multi : BN_mod_mul_montgomery failed");
+            }
+            for (unsigned int i = 0; i < absExps.size(); i++) {
+                unsigned int digit = 0;
+                for (unsigned int j = 0; j < WINDOW_BITS; j++)
+                    if (BN_is_bit_set(absExps[i].bn, w * WINDOW_BITS + j))
+                        digit |= 1 << j;
+                if (digit == 0)
+                    continue;
+                const CBigNum& entry = table[i * WINDOW_ENTRIES + digit - 1];
+                if (fEmpty) {
+                    acc = entry;
+                    fEmpty = false;
+                } else if (!BN_mod_mul_montgomery(acc.bn, acc.bn, entry.bn, mont, pctx)) {
+                    throw bignum_error("CBigNum::pow_mod_multi : BN_mod_mul_montgomery failed");
+                }
+            }
+        }
+        if (fEmpty)
+            return ret;
+
+        if (!BN_from_montgomery(ret.bn, acc.bn, mont, pctx))
+            throw bignum_error("CBigNum::pow_mod_multi : BN_from_montgomery failed");
+        return ret;
+    }
+
    /**
     * Calculates the inverse of this element mod m.
     * i.e. i such this*i = 1 mod m
@@ -721,6 +827,7 @@ public:
     friend inline bool operator>=(const CBigNum& a, const CBigNum& b);
     friend inline bool operator<(const CBigNum& a, const CBigNum& b);
     friend inline bool operator>(const CBigNum& a, const CBigNum& b);
+    friend class CBigNumFixedBase;
 };
 
 
@@ -798,6 +905,191 @@ inline bool operator<(const CBigNum& a, const CBigNum& b)  { return (BN_cmp(a.bn
 inline bool operator>(const CBigNum& a, const CBigNum& b)  { return (BN_cmp(a.bn, b.bn) > 0); }
 inline std::ostream& operator<<(std::ostream &strm, const CBigNum &b) { return strm << b.ToString(10); }
 
+/**
+ * Precomputed table for raising one fixed base to many exponents modulo a
+ * fixed modulus, such as the generators of a commitment group.
+ *
+ * For every WINDOW_BITS-wide window i of the exponent and every digit d the
+ * table stores base^(d * 2^(WINDOW_BITS * i)) in Montgomery form, so an
+ * exponentiation costs one modular multiplication per non-zero window and
+ * no squarings. When the order of the base is known exponents are first
+ * reduced modulo it, which also covers negative exponents; otherwise the
+ * table covers exponents up to a given size. The result is identical to
+ * CBigNum::pow_mod. Like BN_mod_exp on unflagged BIGNUMs this is not
+ * constant time.
+ */
+class CBigNumFixedBase
+{
+    static const unsigned int WINDOW_BITS = 4;
+    static const unsigned int WINDOW_ENTRIES = (1 << WINDOW_BITS) - 1;
+
+    CBigNum base;
+    CBigNum modulus;
+    CBigNum order;
+    unsigned int nWindows;
+    BN_MONT_CTX* mont;
+    std::vector<CBigNum> table;
+
+    void Build(unsigned int nMaxBits)
+    {
+        CAutoBN_CTX pctx;
+        mont = BN_MONT_CTX_new();
+        if (mont == NULL || !BN_MONT_CTX_set(mont, modulus.bn, pctx)) {
+            SetNull();
+            throw bignum_error("CBigNumFixedBase::Build : BN_MONT_CTX_set failed");
+        }
+
+        nWindows = (nMaxBits + WINDOW_BITS - 1) / WINDOW_BITS;
+        table.resize(nWindows * WINDOW_ENTRIES);
+
+        // cur = base^(2^(WINDOW_BITS * i)) in Montgomery form
+        CBigNum cur = base % modulus;
+        if (!BN_to_montgomery(cur.bn, cur.bn, mont, pctx))
+            throw bignum_error("CBigNumFixedBase::Build : BN_to_montgomery failed");
+        for (unsigned int i = 0; i < nWindows; i++) {
+            CBigNum* row = &table[i * WINDOW_ENTRIES];
+            row[0] = cur;
+            for (unsigned int d = 1; d < WINDOW_ENTRIES; d++) {
+                if (!BN_mod_mul_montgomery(row[d].bn, row[d - 1].bn, cur.bn, mont, pctx))
+                    throw bignum_error("CBigNumFixedBase::Build : BN_mod_mul_montgomery failed");
+            }
+            if (!BN_mod_mul_montgomery(cur.bn, row[WINDOW_ENTRIES - 1].bn, cur.bn, mont, pctx))
+                throw bignum_error("CBigNumFixedBase::Build : BN_mod_mul_montgomery failed");
+        }
+    }
+
+public:
+    CBigNumFixedBase() : nWindows(0), mont(NULL) {}
+
+    CBigNumFixedBase(const CBigNumFixedBase& b) : nWindows(0), mont(NULL)
+    {
+        *this = b;
+    }
+
+    CBigNumFixedBase& operator=(const CBigNumFixedBase& b)
+    {
+        if (this == &b)
+            return *this;
+        SetNull();
+        base = b.base;
+        modulus = b.modulus;
+        order = b.order;
+        if (b.mont != NULL) {
+            mont = BN_MONT_CTX_new();
+            if (mont == NULL || !BN_MONT_CTX_copy(mont, b.mont)) {
+                SetNull();
+                throw bignum_error("CBigNumFixedBase::operator= : BN_MONT_CTX_copy failed");
+            }
+            nWindows = b.nWindows;
+            table = b.table;
+        }
+        return *this;
+    }
+
+    ~CBigNumFixedBase()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        if (mont != NULL)
+            BN_MONT_CTX_free(mont);
+        mont = NULL;
+        nWindows = 0;
+        table.clear();
+    }
+
+    bool IsNull() const { return mont == NULL; }
+
+    /**
+     * Builds the table for baseIn modulo modulusIn.
+     * The table is only built if modulusIn is odd and baseIn^orderIn == 1,
+     * otherwise pow_mod() keeps falling back to CBigNum::pow_mod.
+     * @param baseIn the fixed base
+     * @param modulusIn the modulus
+     * @param orderIn the order of baseIn modulo modulusIn
+     */
+    void Init(const CBigNum& baseIn, const CBigNum& modulusIn, const CBigNum& orderIn)
+    {
+        SetNull();
+        base = baseIn;
+        modulus = modulusIn;
+        order = orderIn;
+        if (modulus <= 1 || !BN_is_odd(modulus.bn) || order <= 0 || !base.pow_mod(order, modulus).isOne())
+            return;
+        Build(order.bitSize());
+    }
+
+    /**
+     * Builds the table for a base of unknown order modulo modulusIn.
+     * Exponents are not reduced, so only exponents of up to nMaxBits bits
+     * (in absolute value) use the table.
+     * @param baseIn the fixed base
+     * @param modulusIn the modulus
+     * @param nMaxBits the largest exponent size the table covers
+     */
+    void InitBits(const CBigNum& baseIn, const CBigNum& modulusIn, unsigned int nMaxBits)
+    {
+        SetNull();
+        base = baseIn;
+        modulus = modulusIn;
+        order = 0;
+        if (modulus <= 1 || !BN_is_odd(modulus.bn) || nMaxBits == 0)
+            return;
+        Build(nMaxBits);
+    }
+
+    /**
+     * modular exponentiation: base^e mod m
+     * Uses the table when m is the modulus it was built for.
+     * @param e exponent
+     * @param m modulus
+     */
+    CBigNum pow_mod(const CBigNum& e, const CBigNum& m) const
+    {
+        if (IsNull() || m != modulus)
+            return base.pow_mod(e, m);
+
+        CBigNum exp = e;
+        if (order > 0) {
+            if (e < 0 || e >= order)
+                exp = e % order;
+        } else if (e < 0) {
+            // g^-x = (g^x)^-1
+            return pow_mod(-e, m).inverse(m);
+        } else if ((unsigned int)e.bitSize() > nWindows * WINDOW_BITS) {
+            return base.pow_mod(e, m);
+        }
+
+        CAutoBN_CTX pctx;
+        CBigNum acc;
+        bool fEmpty = true;
+        for (unsigned int i = 0; i < nWindows; i++) {
+            unsigned int digit = 0;
+            for (unsigned int j = 0; j < WINDOW_BITS; j++)
+                if (BN_is_bit_set(exp.bn, i * WINDOW_BITS + j))
+                    digit |= 1 << j;
+            if (digit == 0)
+                continue;
+            const CBigNum& entry = table[i * WINDOW_ENTRIES + digit - 1];
+            if (fEmpty) {
+                acc = entry;
+                fEmpty = false;
+            } else if (!BN_mod_mul_montgomery(acc.bn, acc.bn, entry.bn, mont, pctx)) {
+                throw bignum_error("CBigNumFixedBase::pow_mod : BN_mod_mul_montgomery failed");
+            }
+        }
+        if (fEmpty)
+            return CBigNum(1);
+
+        CBigNum ret;
+        if (!BN_from_montgomery(ret.bn, acc.bn, mont, pctx))
+            throw bignum_error("CBigNumFixedBase::pow_mod : BN_from_montgomery failed");
+        return ret;
+    }
+};
+
 typedef CBigNum Bignum;
 
 #endif
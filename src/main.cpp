@@ -11,6 +11,9 @@
 #include "accumulators.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockcache.h"
+#include "blockencodings.h"
+#include "blockprefetcher.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -20,6 +23,7 @@
 #include "masternode-payments.h"
 #include "masternodeman.h"
 #include "merkleblock.h"
+#include "messageworkers.h"
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
@@ -32,6 +36,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "validationinterface.h"
+#include "zerocoinspendcache.h"
 
 #include "primitives/zerocoin.h"
 #include "libzerocoin/Denominations.h"
@@ -81,7 +86,7 @@ bool fTxIndex = true;
 //bool fIsBareMultisigStd = true; defined = false in script.cpp
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 unsigned int nStakeMinAge = 12 * 60 * 60; //Min Stake Age = 12 hours
@@ -238,6 +243,8 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! The compact block from this peer that waits for the transactions we asked for with getblocktxn.
+    boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;
 
     CNodeState()
     {
@@ -257,6 +264,13 @@ struct CNodeState {
 /** Map maintaining per-node state. Requires cs_main. */
 map<NodeId, CNodeState> mapNodeState;
 
+/**
+ * Guards nMisbehavior and fShouldBan, which the message workers update
+ * without cs_main. Inserting into or erasing from mapNodeState takes it
+ * too, so that Misbehaving() can look a node up with only this lock.
+ */
+CCriticalSection cs_nodeMisbehavior;
+
 // Requires cs_main.
 CNodeState* State(NodeId pnode)
 {
@@ -290,7 +304,7 @@ void UpdatePreferredDownload(CNode* node, CNodeState* state)
 
 void InitializeNode(NodeId nodeid, const CNode* pnode)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_nodeMisbehavior);
     CNodeState& state = mapNodeState.insert(std::make_pair(nodeid, CNodeState())).first->second;
     state.name = pnode->addrName;
     state.address = pnode->addr;
@@ -298,7 +312,7 @@ void InitializeNode(NodeId nodeid, const CNode* pnode)
 
 void FinalizeNode(NodeId nodeid)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_nodeMisbehavior);
     CNodeState* state = State(nodeid);
 
     if (state->fSyncStarted)
@@ -493,7 +507,10 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
     CNodeState* state = State(nodeid);
     if (state == NULL)
         return false;
-    stats.nMisbehavior = state->nMisbehavior;
+    {
+        LOCK(cs_nodeMisbehavior);
+        stats.nMisbehavior = state->nMisbehavior;
+    }
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
     BOOST_FOREACH (const QueuedBlock& queue, state->vBlocksInFlight) {
@@ -1300,7 +1317,7 @@ bool ContextualCheckCoinSpend(const CoinSpend& spend, CBlockIndex* pindex, const
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state)
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1325,7 +1342,8 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
     set<CBigNum> serials;
     list<CoinSpend> vSpends;
     CAmount nTotalRedeemed = 0;
-    for (const CTxIn& txin : tx.vin) {
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const CTxIn& txin = tx.vin[i];
 
         //only check txin that is a zcspend
         if (!txin.scriptSig.IsZerocoinSpend())
@@ -1353,11 +1371,20 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
             if(!zerocoinDB->ReadAccumulatorValue(newSpend.getAccumulatorChecksum(), bnAccumulatorValue))
                 return state.DoS(100, error("Zerocoinspend could not find accumulator associated with checksum"));
 
-            Accumulator accumulator(Params().Zerocoin_Params(), newSpend.getDenomination(), bnAccumulatorValue);
+            //Skip the proofs if this spend already verified, typically when it was accepted to the mempool
+            if (IsZerocoinSpendVerified(GetZerocoinSpendHash(txin), newSpend.getAccumulatorChecksum())) {
+                LogPrint("zero", "%s : spend %d of tx %s found in verified spend cache\n", __func__, i, tx.GetHash().GetHex());
+            } else if (pvChecks) {
+                //Defer the proofs to the verification queue if the caller collects them
+                pvChecks->push_back(CZerocoinSpendCheck(tx, i, bnAccumulatorValue));
+            } else {
+                Accumulator accumulator(Params().Zerocoin_Params(), newSpend.getDenomination(), bnAccumulatorValue);
 
-            //Check that the coin is on the accumulator
-            if(!newSpend.Verify(accumulator))
-                return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+                //Check that the coin is on the accumulator
+                if(!newSpend.Verify(accumulator))
+                    return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+                SetZerocoinSpendVerified(GetZerocoinSpendHash(txin), newSpend.getAccumulatorChecksum());
+            }
         }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1390,7 +1417,13 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+// Zerocoin spend signatures of old blocks are not verified during the initial sync
+static bool VerifyZerocoinSpendSignatures()
+{
+    return !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
+}
+
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks, const bool* pfVerifyZerocoinSignature)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1445,8 +1478,8 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
             }
 
             // Do not require signature verification if this is initial sync and a block over 24 hours old
-            bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            bool fVerifySignature = pfVerifyZerocoinSignature ? *pfVerifyZerocoinSignature : VerifyZerocoinSpendSignatures();
+            if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1539,6 +1572,14 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
 {
@@ -1716,7 +1757,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = 0;
         if (!tx.IsZerocoinSpend())
-            view.GetPriority(tx, chainActive.Height());
+            dPriority = view.GetPriority(tx, chainActive.Height());
 
         CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
@@ -1732,6 +1773,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // Raised above the relay fee while the pool is full
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee && !tx.IsZerocoinSpend())
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (tx.IsZerocoinMint()) {
                 if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
@@ -1790,6 +1838,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Trim the pool to size, which can evict this transaction again
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -2000,6 +2053,30 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
+/** Look a transaction up in the transaction index and read it from disk. Does not need cs_main. */
+static bool ReadTransactionFromTxIndex(const uint256& hash, CTransaction& txOut, uint256& hashBlock)
+{
+    CDiskTxPos postx;
+    if (!pblocktree->ReadTxIndex(hash, postx))
+        return false;
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+    CBlockHeader header;
+    try {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> txOut;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    hashBlock = header.GetHash();
+    if (txOut.GetHash() != hash)
+        return error("%s : txid mismatch", __func__);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
@@ -2012,31 +2089,7 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
             }
         }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s : txid mismatch", __func__);
-                return true;
-            }
-
-            // transaction not found in the index, nothing more can be done
-            return false;
-        }
-
-        if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        if (fAllowSlow && !fTxIndex) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
                 CCoinsViewCache& view = *pcoinsTip;
@@ -2049,6 +2102,14 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         }
     }
 
+    if (fTxIndex) {
+        if (ReadTransactionFromTxIndex(hash, txOut, hashBlock))
+            return true;
+
+        // transaction not found in the index, nothing more can be done
+        return false;
+    }
+
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
@@ -2281,12 +2342,13 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
-// Requires cs_main.
+// Safe without cs_main, which the message workers don't hold.
 void Misbehaving(NodeId pnode, int howmuch)
 {
     if (howmuch == 0)
         return;
 
+    LOCK(cs_nodeMisbehavior);
     CNodeState* state = State(pnode);
     if (state == NULL)
         return;
@@ -2360,6 +2422,18 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    CoinSpend spend = TxInToZerocoinSpend(ptxTo->vin[nIn]);
+    Accumulator accumulator(Params().Zerocoin_Params(), spend.getDenomination(), bnAccumulatorValue);
+
+    //Check that the coin is on the accumulator
+    if (!spend.Verify(accumulator, pBatch))
+        return ::error("CZerocoinSpendCheck(): %s:%d zerocoin spend did not verify", ptxTo->GetHash().ToString(), nIn);
+    SetZerocoinSpendVerified(GetZerocoinSpendHash(ptxTo->vin[nIn]), spend.getAccumulatorChecksum());
+    return true;
+}
+
 CBitcoinAddress addressExp1("DQZzqnSR6PXxagep1byLiRg9ZurCZ5KieQ");
 CBitcoinAddress addressExp2("DTQYdnNqKuEHXyNeeYhPQGGGdqHbXYwjpj");
 
@@ -2755,6 +2829,10 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             if(!EraseAccumulatorValues(nCheckpoint, pindex->pprev->nAccumulatorCheckpoint))
                 return error("DisconnectBlock(): failed to erase checkpoint");
         }
+
+        //remove this block's mints from the pubcoin index
+        if (!EraseBlockPubcoins(pindex))
+            return error("DisconnectBlock(): failed to erase pubcoin index");
     }
 
     if (pfClean) {
@@ -2798,6 +2876,104 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+//zerocoin spend proofs are expensive, so hand them out to workers one at a time
+static CCheckQueue<CZerocoinSpendCheck> zerocoincheckqueue(1);
+//guards zerocoincheckqueue, which CheckBlock can use from several threads
+static CCriticalSection cs_zerocoincheckqueue;
+
+void ThreadZerocoinSpendCheck()
+{
+    RenameThread("snodecoin-zerocoinch");
+    zerocoincheckqueue.Thread();
+}
+
+//most transaction checks are cheap, so hand them out in larger batches
+static CCheckQueue<CBlockPreCheck> blockprecheckqueue(16);
+//guards blockprecheckqueue
+static CCriticalSection cs_blockprecheckqueue;
+
+void ThreadBlockPreCheck()
+{
+    RenameThread("snodecoin-blockprech");
+    blockprecheckqueue.Thread();
+}
+
+bool CBlockPreCheck::operator()()
+{
+    const CBlock& block = *pblock;
+    CValidationState state;
+
+    switch (nKind) {
+    case HEADER:
+        // Computes and remembers the neoscrypt hash of the header
+        return CheckBlockHeader(block, state, block.IsProofOfWork());
+    case MERKLE_ROOT: {
+        bool mutated;
+        if (block.BuildMerkleTree(&mutated) != block.hashMerkleRoot || mutated)
+            return false;
+        block.fMerkleRootChecked = true;
+        return true;
+    }
+    case SIGNATURE:
+        if (!block.CheckBlockSignature())
+            return false;
+        block.fSignatureChecked = true;
+        return true;
+    case TRANSACTION: {
+        // Same arguments as CheckBlock; the spend proofs are verified right
+        // here, which also records them in the verified spend cache
+        bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
+        std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+        if (!CheckTransaction(block.vtx[nTx], fZerocoinActive, fEnforceSerialRange, state, &vZerocoinChecks, &fVerifyZerocoinSignature))
+            return false;
+        for (CZerocoinSpendCheck& check : vZerocoinChecks) {
+            if (!check())
+                return false;
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+void PreCheckBlock(const CBlock& block)
+{
+    if (!nScriptCheckThreads || block.vtx.empty())
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    bool fEnforceSerialRange;
+    bool fVerifyZerocoinSignature;
+    {
+        LOCK(cs_main);
+        fEnforceSerialRange = chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange();
+        fVerifyZerocoinSignature = VerifyZerocoinSpendSignatures();
+    }
+
+    std::vector<CBlockPreCheck> vChecks;
+    vChecks.reserve(block.vtx.size() + 3);
+    vChecks.push_back(CBlockPreCheck(block, CBlockPreCheck::HEADER));
+    vChecks.push_back(CBlockPreCheck(block, CBlockPreCheck::MERKLE_ROOT));
+    vChecks.push_back(CBlockPreCheck(block, CBlockPreCheck::SIGNATURE));
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        vChecks.push_back(CBlockPreCheck(block, CBlockPreCheck::TRANSACTION, i, fEnforceSerialRange, fVerifyZerocoinSignature));
+
+    bool fValid;
+    {
+        LOCK(cs_blockprecheckqueue);
+        CCheckQueueControl<CBlockPreCheck> control(&blockprecheckqueue);
+        control.Add(vChecks);
+        fValid = control.Wait();
+    }
+    // The merkle root and signature checks mark themselves as they pass, the
+    // transactions only count as checked once every one of them has
+    if (fValid)
+        block.fTransactionsChecked = true;
+
+    LogPrint("bench", "    - Pre-check %s: %u txs, %s [%.2fms]\n", block.GetHash().ToString(), block.vtx.size(),
+        fValid ? "passed" : "failed", 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
 void RecalculateZSNDMinted()
 {
     CBlockIndex *pindex = chainActive[Params().Zerocoin_StartHeight()];
@@ -2861,6 +3037,53 @@ void RecalculateZSNDSpent()
     }
 }
 
+/** Number of threads reading and decoding blocks ahead of a sequential chain walk */
+static int GetPrefetchThreads()
+{
+    return std::max((int)boost::thread::hardware_concurrency(), 1);
+}
+
+/** Value moved by the transactions of a block, totalled off the main thread by RecalculateSNDSupply */
+struct CBlockValueFlow {
+    CAmount nValueIn;
+    CAmount nValueOut;
+    //! Prevouts that could not be looked up in the transaction index
+    std::vector<COutPoint> vUnresolved;
+
+    CBlockValueFlow() : nValueIn(0), nValueOut(0) {}
+};
+
+static bool GetBlockValueFlow(const CBlock& block, size_t nPos, CBlockValueFlow& flow)
+{
+    for (const CTransaction& tx : block.vtx) {
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            if (tx.IsCoinBase())
+                break;
+
+            if (tx.vin[i].scriptSig.IsZerocoinSpend()) {
+                flow.nValueIn += tx.vin[i].nSequence * COIN;
+                continue;
+            }
+
+            const COutPoint& prevout = tx.vin[i].prevout;
+            CTransaction txPrev;
+            uint256 hashBlock;
+            if (fTxIndex && ReadTransactionFromTxIndex(prevout.hash, txPrev, hashBlock))
+                flow.nValueIn += txPrev.vout[prevout.n].nValue;
+            else
+                flow.vUnresolved.push_back(prevout);
+        }
+
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            if (i == 0 && tx.IsCoinStake())
+                continue;
+
+            flow.nValueOut += tx.vout[i].nValue;
+        }
+    }
+    return true;
+}
+
 bool RecalculateSNDSupply(int nHeightStart)
 {
     if (nHeightStart > chainActive.Height())
@@ -2871,42 +3094,35 @@ bool RecalculateSNDSupply(int nHeightStart)
     if (nHeightStart == Params().Zerocoin_StartHeight())
         nSupplyPrev = CAmount(5449796547496199);
 
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
-
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (const CTransaction tx : block.vtx) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                if (tx.IsCoinBase())
-                    break;
+    // Blocks are read and totalled ahead of the walk; only the running supply is sequential
+    std::vector<const CBlockIndex*> vIndex;
+    for (int nHeight = nHeightStart; nHeight <= chainActive.Height(); nHeight++)
+        vIndex.push_back(chainActive[nHeight]);
+    CBlockPrefetcher<CBlockValueFlow> prefetcher(vIndex, GetBlockValueFlow, GetPrefetchThreads());
 
-                if (tx.vin[i].scriptSig.IsZerocoinSpend()) {
-                    nValueIn += tx.vin[i].nSequence * COIN;
-                    continue;
-                }
+    const std::string strProgress = _("Recalculating money supply...");
+    uiInterface.ShowProgress(strProgress, 0);
+    int64_t nTimeStart = GetTimeMillis();
 
-                COutPoint prevout = tx.vin[i].prevout;
-                CTransaction txPrev;
-                uint256 hashBlock;
-                assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
-                nValueIn += txPrev.vout[prevout.n].nValue;
-            }
+    for (size_t nPos = 0; nPos < vIndex.size(); nPos++) {
+        pindex = chainActive[nHeightStart + nPos];
+        if (pindex->nHeight % 1000 == 0) {
+            LogPrintf("%s : block %d... (%.1f blocks/s)\n", __func__, pindex->nHeight, nPos * 1000.0 / std::max(GetTimeMillis() - nTimeStart, (int64_t)1));
+            uiInterface.ShowProgress(strProgress, std::max(1, std::min(99, (int)(nPos * 100 / vIndex.size()))));
+        }
 
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                if (i == 0 && tx.IsCoinStake())
-                    continue;
+        CBlockValueFlow flow;
+        assert(prefetcher.Get(nPos, flow));
 
-                nValueOut += tx.vout[i].nValue;
-            }
+        for (const COutPoint& prevout : flow.vUnresolved) {
+            CTransaction txPrev;
+            uint256 hashBlock;
+            assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
+            flow.nValueIn += txPrev.vout[prevout.n].nValue;
         }
 
         // Rewrite money supply
-        pindex->nMoneySupply = nSupplyPrev + nValueOut - nValueIn;
+        pindex->nMoneySupply = nSupplyPrev + flow.nValueOut - flow.nValueIn;
         nSupplyPrev = pindex->nMoneySupply;
 
         // Add fraudulent funds to the supply and remove any recovered funds.
@@ -2923,12 +3139,10 @@ bool RecalculateSNDSupply(int nHeightStart)
         }
 
         assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
-
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
-            break;
     }
+
+    uiInterface.ShowProgress(strProgress, 100);
+    LogPrintf("%s : recalculated %u blocks in %dms\n", __func__, vIndex.size(), GetTimeMillis() - nTimeStart);
     return true;
 }
 
@@ -2936,53 +3150,94 @@ bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError
 {
     // Snodecoin: recalculate Accumulator Checkpoints that failed to database properly
     if (!listMissingCheckpoints.empty() && chainActive.Height() >= Params().Zerocoin_StartHeight()) {
-        //uiInterface.InitMessage(_("Calculating missing accumulators..."));
         LogPrintf("%s : finding missing checkpoints\n", __func__);
 
         //search the chain to see when zerocoin started
         int nZerocoinStart = Params().Zerocoin_StartHeight();
 
-        // find each checkpoint that is missing
-        CBlockIndex* pindex = chainActive[nZerocoinStart];
-        while (!listMissingCheckpoints.empty()) {
-            if (ShutdownRequested())
-                return false;
+        // find each checkpoint that is missing by iterating through the blockchain beginning with the first zerocoin block
+        std::vector<int> vHeights;
+        std::list<uint256> listToFind = listMissingCheckpoints;
+        for (CBlockIndex* pindex = chainActive[nZerocoinStart]; pindex && !listToFind.empty(); pindex = chainActive.Next(pindex)) {
+            if (pindex->nAccumulatorCheckpoint == pindex->pprev->nAccumulatorCheckpoint)
+                continue;
 
-            // find checkpoints by iterating through the blockchain beginning with the first zerocoin block
-            if (pindex->nAccumulatorCheckpoint != pindex->pprev->nAccumulatorCheckpoint) {
-
-                //double dPercent = (pindex->nHeight - nZerocoinStart) / (double) (chainActive.Height() - nZerocoinStart);
-                //uiInterface.ShowProgress(_("Calculating missing accumulators..."), (int) (dPercent * 100));
-                if (find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint) != listMissingCheckpoints.end()) {
-                    uint256 nCheckpointCalculated = 0;
-                    AccumulatorMap mapAccumulators;
-                    if (!CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated, mapAccumulators)) {
-                        // GetCheckpoint could have terminated due to a shutdown request. Check this here.
-                        if (ShutdownRequested())
-                            break;
-                        strError = _("Failed to calculate accumulator checkpoint");
-                        return false;
-                    }
+            auto it = find(listToFind.begin(), listToFind.end(), pindex->nAccumulatorCheckpoint);
+            if (it != listToFind.end()) {
+                vHeights.push_back(pindex->nHeight);
+                listToFind.erase(it);
+            }
+        }
 
-                    //check that the calculated checkpoint is what is in the index.
-                    if (nCheckpointCalculated != pindex->nAccumulatorCheckpoint) {
-                        LogPrintf("%s : height=%d calculated_checkpoint=%s actual=%s\n", __func__, pindex->nHeight, nCheckpointCalculated.GetHex(), pindex->nAccumulatorCheckpoint.GetHex());
-                        strError = _("Calculated accumulator checkpoint is not what is recorded by block index");
-                        return false;
-                    }
+        // Read and decode the blocks each checkpoint accumulates ahead of the accumulator math, which stays in chain order
+        std::vector<const CBlockIndex*> vIndex;
+        std::vector<bool> vFilterInvalid;
+        for (int nHeight : vHeights) {
+            std::vector<const CBlockIndex*> vBlocks;
+            GetAccumulationBlocks(nHeight, vBlocks);
+            vIndex.insert(vIndex.end(), vBlocks.begin(), vBlocks.end());
+            vFilterInvalid.insert(vFilterInvalid.end(), vBlocks.size(), nHeight >= Params().Zerocoin_Block_RecalculateAccumulators());
+        }
+        CBlockPrefetcher<std::list<PublicCoin> > prefetcher(vIndex,
+            [&vFilterInvalid](const CBlock& block, size_t nPos, std::list<PublicCoin>& listPubcoins) {
+                return BlockToPubcoinList(block, listPubcoins, vFilterInvalid[nPos]);
+            },
+            GetPrefetchThreads());
+
+        size_t nNext = 0;
+        PubcoinListFn getPubcoins = [&](const CBlockIndex* pindex, bool fFilterInvalid, std::list<PublicCoin>& listPubcoins) {
+            // Anything other than the next prefetched block is read directly
+            if (nNext < prefetcher.size() && prefetcher.GetIndex(nNext) == pindex && vFilterInvalid[nNext] == fFilterInvalid)
+                return prefetcher.Get(nNext++, listPubcoins);
+            return ReadBlockPubcoinList(pindex, fFilterInvalid, listPubcoins);
+        };
+
+        const std::string strProgress = _("Calculating missing accumulators...");
+        uiInterface.ShowProgress(strProgress, 0);
+        int64_t nTimeStart = GetTimeMillis();
+
+        bool fSuccess = true;
+        size_t nCalculated = 0;
+        for (size_t i = 0; i < vHeights.size(); i++) {
+            if (ShutdownRequested()) {
+                fSuccess = false;
+                break;
+            }
 
-                    DatabaseChecksums(mapAccumulators);
-                    auto it = find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint);
-                    listMissingCheckpoints.erase(it);
-                }
+            CBlockIndex* pindex = chainActive[vHeights[i]];
+            uint256 nCheckpointCalculated = 0;
+            AccumulatorMap mapAccumulators;
+            if (!CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated, mapAccumulators, getPubcoins)) {
+                // GetCheckpoint could have terminated due to a shutdown request. Check this here.
+                if (ShutdownRequested())
+                    break;
+                strError = _("Failed to calculate accumulator checkpoint");
+                fSuccess = false;
+                break;
             }
 
-            // if we have iterated to the end of the blockchain, then checkpoints should be in sync
-            if (pindex->nHeight + 1 <= chainActive.Height())
-                pindex = chainActive.Next(pindex);
-            else
+            //check that the calculated checkpoint is what is in the index.
+            if (nCheckpointCalculated != pindex->nAccumulatorCheckpoint) {
+                LogPrintf("%s : height=%d calculated_checkpoint=%s actual=%s\n", __func__, pindex->nHeight, nCheckpointCalculated.GetHex(), pindex->nAccumulatorCheckpoint.GetHex());
+                strError = _("Calculated accumulator checkpoint is not what is recorded by block index");
+                fSuccess = false;
                 break;
+            }
+
+            DatabaseChecksums(mapAccumulators);
+            auto it = find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint);
+            listMissingCheckpoints.erase(it);
+            nCalculated++;
+
+            if ((i + 1) % 100 == 0) {
+                LogPrintf("%s : checkpoint %u of %u at height %d (%.1f blocks/s)\n", __func__, i + 1, vHeights.size(), pindex->nHeight, nNext * 1000.0 / std::max(GetTimeMillis() - nTimeStart, (int64_t)1));
+                uiInterface.ShowProgress(strProgress, std::max(1, std::min(99, (int)((i + 1) * 100 / vHeights.size()))));
+            }
         }
+
+        uiInterface.ShowProgress(strProgress, 100);
+        LogPrintf("%s : calculated %u checkpoints from %u blocks in %dms\n", __func__, nCalculated, nNext, GetTimeMillis() - nTimeStart);
+        return fSuccess;
     }
     return true;
 }
@@ -3262,6 +3517,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return state.Abort(("Failed to record coin serial to database"));
     }
 
+    //The serials are now spent, so these spends will not need verifying again
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.IsZerocoinSpend())
+            continue;
+        for (const CTxIn& txin : tx.vin) {
+            if (txin.scriptSig.IsZerocoinSpend())
+                EraseZerocoinSpendVerified(GetZerocoinSpendHash(txin), TxInToZerocoinSpend(txin).getAccumulatorChecksum());
+        }
+    }
+
+    //Record pubcoins by denomination and height so that witnesses can be generated without reading blocks
+    if (!IndexBlockPubcoins(block, pindex))
+        return state.Abort(("Failed to record zerocoin pubcoin index"));
+
     //Record accumulator checksums
     DatabaseChecksums(mapAccumulators);
 
@@ -3337,9 +3606,11 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-            (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+        // The cache is over the limit, we have to write now.
+        bool fCacheLarge = (mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage;
+        // It's been a while since we wrote to disk.
+        bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000;
+        if (mode == FLUSH_STATE_ALWAYS || fCacheLarge || fPeriodicWrite) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
@@ -3368,9 +3639,21 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 setDirtyBlockIndex.erase(it++);
             }
             pblocktree->Sync();
-            // Finally flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
-                return state.Abort("Failed to write to coin database");
+            // Finally write the chainstate (which may refer to block index entries).
+            if (mode == FLUSH_STATE_ALWAYS) {
+                if (!pcoinsTip->Flush())
+                    return state.Abort("Failed to write to coin database");
+            } else {
+                // Keep what the last blocks created and spent, as the next ones
+                // are the most likely to touch it. A full cache first drops
+                // what was only read, and the rest only when that is not
+                // enough, leaving room for a few more blocks.
+                size_t nTargetUsage = fCacheLarge ? nCoinCacheUsage / 4 * 3 : std::numeric_limits<size_t>::max();
+                if (!pcoinsTip->Sync(nTargetUsage))
+                    return state.Abort("Failed to write to coin database");
+                if (pcoinsTip->DynamicMemoryUsage() > nTargetUsage && !pcoinsTip->Sync(nTargetUsage))
+                    return state.Abort("Failed to write to coin database");
+            }
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
                 GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -3402,10 +3685,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s timestamp=%d progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s timestamp=%d progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()), chainActive.Tip()->GetBlockTime(),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -3784,6 +4067,14 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     return true;
 }
 
+/** The cmpctblock message announcing block, which all the peers asking for compact blocks share */
+CSerializeDataRef static MakeCompactBlockMessage(const CBlock& block)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CBlockHeaderAndShortTxIDs(block);
+    return MakeNetMessage("cmpctblock", ss);
+}
+
 /**
  * Make the best chain active, in multiple steps. The result is either failure
  * or an activated best chain. pblock is either NULL or a pointer to a block
@@ -3823,12 +4114,26 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
         if (!fInitialDownload) {
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
             // Relay inventory, but don't relay old inventory during initial block download.
+            // Peers that asked for compact blocks are sent the new block right away
+            // instead of an inv they would have to answer with getdata.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
+            CInv inv(MSG_BLOCK, hashNewTip);
+            bool fCompact = pblock && pblock->GetHash() == hashNewTip;
+            CSerializeDataRef msgCompact;
             {
                 LOCK(cs_vNodes);
-                BOOST_FOREACH (CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH (CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (fCompact && pnode->fPreferCompactBlocks) {
+                        if (!msgCompact)
+                            msgCompact = MakeCompactBlockMessage(*pblock);
+                        if (pnode->AddInventoryKnown(inv))
+                            pnode->PushMessage(msgCompact);
+                    } else {
+                        pnode->PushInventory(inv);
+                    }
+                }
             }
             // Notify external listeners about the new tip.
             // Note: uiInterface, should switch main signals.
@@ -4154,8 +4459,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.Invalid(error("CheckBlock() : block timestamp too far in the future"),
             REJECT_INVALID, "time-too-new");
 
-    // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    // Check the merkle root, unless PreCheckBlock already has.
+    if (fCheckMerkleRoot && !block.fMerkleRootChecked) {
         bool mutated;
         uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -4256,8 +4561,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // Check transactions
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
     vector<CBigNum> vBlockSerials;
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
     for (const CTransaction& tx : block.vtx) {
-        if (fCheckPOW && !CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state))
+        if (fCheckPOW && !block.fTransactionsChecked && !CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state, &vZerocoinChecks))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zSno spends in this block
@@ -4274,6 +4580,32 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
+    // Verify the zerocoin spend proofs collected above, across the script check threads if there are any
+    if (!vZerocoinChecks.empty()) {
+        // The accumulator generator tables are built once with the zerocoin parameters
+        const libzerocoin::AccumulatorProofBatch* pbatch = &Params().Zerocoin_Params()->accumulatorParams.proofBatch;
+        for (CZerocoinSpendCheck& check : vZerocoinChecks)
+            check.SetBatch(pbatch);
+
+        bool fSpendsValid = true;
+        if (nScriptCheckThreads) {
+            LOCK(cs_zerocoincheckqueue);
+            CCheckQueueControl<CZerocoinSpendCheck> control(&zerocoincheckqueue);
+            control.Add(vZerocoinChecks);
+            fSpendsValid = control.Wait();
+        } else {
+            for (CZerocoinSpendCheck& check : vZerocoinChecks) {
+                if (!check()) {
+                    fSpendsValid = false;
+                    break;
+                }
+            }
+        }
+        if (!fSpendsValid)
+            return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"),
+                REJECT_INVALID, "bad-txns-invalid-zsno");
+    }
+
     unsigned int nSigOps = 0;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         nSigOps += GetLegacySigOpCount(tx);
@@ -4688,7 +5020,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     //    return error("ProcessNewBlock() : duplicate proof-of-stake (%s, %d) for block %s", pblock->GetProofOfStake().first.ToString().c_str(), pblock->GetProofOfStake().second, pblock->GetHash().ToString().c_str());
 
     // NovaCoin: check proof-of-stake block signature
-    if (!pblock->CheckBlockSignature())
+    if (!pblock->fSignatureChecked && !pblock->CheckBlockSignature())
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     if (pblock->GetHash() != Params().HashGenesisBlock() && pfrom != NULL) {
@@ -5012,7 +5344,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -5117,85 +5449,107 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
-            blkdat.SetPos(nRewind);
-            nRewind++;         // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                        block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+        bool fEnd = false;
+        while (!fEnd && !blkdat.eof()) {
+            // Read a few blocks ahead so their headers can be hashed together
+            std::vector<std::pair<CBlock, CDiskBlockPos> > vBlocks;
+            vBlocks.reserve(LOAD_BLOCK_BATCH_SIZE);
+            while (vBlocks.size() < LOAD_BLOCK_BATCH_SIZE && !blkdat.eof()) {
+                boost::this_thread::interruption_point();
+
+                blkdat.SetPos(nRewind);
+                nRewind++;         // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(Params().MessageStart()[0]);
+                    nRewind = blkdat.GetPos() + 1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    fEnd = true;
+                    break;
                 }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                try {
+                    // read block
+                    uint64_t nBlockPos = blkdat.GetPos();
+                    vBlocks.push_back(std::make_pair(CBlock(), dbp ? *dbp : CDiskBlockPos()));
+                    vBlocks.back().second.nPos = nBlockPos;
+                    blkdat.SetLimit(nBlockPos + nSize);
+                    blkdat.SetPos(nBlockPos);
+                    blkdat >> vBlocks.back().first;
+                    nRewind = blkdat.GetPos();
+                } catch (std::exception& e) {
+                    vBlocks.pop_back();
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
+            }
+
+            std::vector<const CBlockHeader*> vHeaders;
+            for (const std::pair<CBlock, CDiskBlockPos>& item : vBlocks)
+                vHeaders.push_back(&item.first);
+            CBlockHeader::CacheHashes(vHeaders);
+
+            for (std::pair<CBlock, CDiskBlockPos>& item : vBlocks) {
+                CBlock& block = item.first;
+                CDiskBlockPos* pblockpos = dbp ? &item.second : NULL;
+                try {
+                    // detect out of order blocks, and store them for later
+                    uint256 hash = block.GetHash();
+                    if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                            block.hashPrevBlock.ToString());
+                        if (pblockpos)
+                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *pblockpos));
+                        continue;
+                    }
+
+                    // process in case the block isn't known yet
+                    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        CValidationState state;
+                        if (ProcessNewBlock(state, NULL, &block, pblockpos))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fEnd = true;
+                            break;
+                        }
+                    } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
+                    // Recursively process earlier encountered successors of this block
+                    deque<uint256> queue;
+                    queue.push_back(hash);
+                    while (!queue.empty()) {
+                        uint256 head = queue.front();
+                        queue.pop_front();
+                        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                        while (range.first != range.second) {
+                            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                            if (ReadBlockFromDisk(block, it->second)) {
+                                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                                    head.ToString());
+                                CValidationState dummy;
+                                if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
+                                    nLoaded++;
+                                    queue.push_back(block.GetHash());
+                                }
                             }
+                            range.first++;
+                            mapBlocksUnknownParent.erase(it);
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
                     }
+                } catch (std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
-            } catch (std::exception& e) {
-                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
         }
     } catch (std::runtime_error& e) {
@@ -5406,27 +5760,13 @@ string GetWarnings(string strFor)
 // Messages
 //
 
+/** Message workers, when started with -parallelmessages */
+static CMessageWorkers* pmessageWorkers = NULL;
 
-bool static AlreadyHave(const CInv& inv)
+// Requires the message shard lock of the inventory type.
+bool static AlreadyHaveShardItem(const CInv& inv)
 {
     switch (inv.type) {
-    case MSG_TX: {
-        bool txInMap = false;
-        txInMap = mempool.exists(inv.hash);
-        return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
-    }
-    case MSG_DSTX:
-        return mapObfuscationBroadcastTxes.count(inv.hash);
-    case MSG_BLOCK:
-        return mapBlockIndex.count(inv.hash);
-    case MSG_TXLOCK_REQUEST:
-        return mapTxLockReq.count(inv.hash) ||
-               mapTxLockReqRejected.count(inv.hash);
-    case MSG_TXLOCK_VOTE:
-        return mapTxLockVote.count(inv.hash);
-    case MSG_SPORK:
-        return mapSporks.count(inv.hash);
     case MSG_MASTERNODE_WINNER:
         if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
             masternodeSync.AddedMasternodeWinner(inv.hash);
@@ -5466,18 +5806,134 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_MASTERNODE_PING:
         return mnodeman.mapSeenMasternodePing.count(inv.hash);
     }
-    // Don't know what it is, just say we already got one
     return true;
 }
 
-
-void static ProcessGetData(CNode* pfrom)
+bool static AlreadyHave(const CInv& inv)
 {
-    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+    // The masternode and budget relay maps belong to their message workers.
+    // Asking for an item again is harmless, so don't wait for a busy one.
+    MessageShard shard;
+    if (GetInventoryShard(inv.type, shard)) {
+        TRY_LOCK(cs_messageShard[shard], lockShard);
+        return lockShard && AlreadyHaveShardItem(inv);
+    }
 
-    vector<CInv> vNotFound;
+    switch (inv.type) {
+    case MSG_TX: {
+        bool txInMap = false;
+        txInMap = mempool.exists(inv.hash);
+        return txInMap || mapOrphanTransactions.count(inv.hash) ||
+               pcoinsTip->HaveCoins(inv.hash);
+    }
+    case MSG_DSTX:
+        return mapObfuscationBroadcastTxes.count(inv.hash);
+    case MSG_BLOCK:
+        return mapBlockIndex.count(inv.hash);
+    case MSG_TXLOCK_REQUEST:
+        return mapTxLockReq.count(inv.hash) ||
+               mapTxLockReqRejected.count(inv.hash);
+    case MSG_TXLOCK_VOTE:
+        return mapTxLockVote.count(inv.hash);
+    case MSG_SPORK: {
+        LOCK(cs_mapSporks);
+        return mapSporks.count(inv.hash);
+    }
+    }
+    // Don't know what it is, just say we already got one
+    return true;
+}
 
-    LOCK(cs_main);
+
+/**
+ * Push a masternode or budget item from its relay map. Returns false,
+ * without touching the map, while the shard's message worker holds it.
+ */
+bool static PushShardItem(CNode* pfrom, const CInv& inv, MessageShard shard, bool& pushed)
+{
+    TRY_LOCK(cs_messageShard[shard], lockShard);
+    if (!lockShard)
+        return false;
+
+    if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
+        if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
+            pfrom->PushMessage("mnw", ss);
+            pushed = true;
+        }
+    }
+    if (!pushed && inv.type == MSG_BUDGET_VOTE) {
+        if (budget.mapSeenMasternodeBudgetVotes.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << budget.mapSeenMasternodeBudgetVotes[inv.hash];
+            pfrom->PushMessage("mvote", ss);
+            pushed = true;
+        }
+    }
+
+    if (!pushed && inv.type == MSG_BUDGET_PROPOSAL) {
+        if (budget.mapSeenMasternodeBudgetProposals.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << budget.mapSeenMasternodeBudgetProposals[inv.hash];
+            pfrom->PushMessage("mprop", ss);
+            pushed = true;
+        }
+    }
+
+    if (!pushed && inv.type == MSG_BUDGET_FINALIZED_VOTE) {
+        if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << budget.mapSeenFinalizedBudgetVotes[inv.hash];
+            pfrom->PushMessage("fbvote", ss);
+            pushed = true;
+        }
+    }
+
+    if (!pushed && inv.type == MSG_BUDGET_FINALIZED) {
+        if (budget.mapSeenFinalizedBudgets.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << budget.mapSeenFinalizedBudgets[inv.hash];
+            pfrom->PushMessage("fbs", ss);
+            pushed = true;
+        }
+    }
+
+    if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
+        if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash];
+            pfrom->PushMessage("mnb", ss);
+            pushed = true;
+        }
+    }
+
+    if (!pushed && inv.type == MSG_MASTERNODE_PING) {
+        if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << mnodeman.mapSeenMasternodePing[inv.hash];
+            pfrom->PushMessage("mnp", ss);
+            pushed = true;
+        }
+    }
+    return true;
+}
+
+
+void static ProcessGetData(CNode* pfrom)
+{
+    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+
+    vector<CInv> vNotFound;
+
+    LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -5487,7 +5943,18 @@ void static ProcessGetData(CNode* pfrom)
         const CInv& inv = *it;
         {
             boost::this_thread::interruption_point();
+
+            // If the message worker of a masternode or budget item is busy,
+            // the item is answered with notfound for the peer to ask again.
+            // Waiting for the worker would hold up the rest of the request
+            // and keep the message handler spinning on this peer meanwhile.
+            bool fShardPushed = false;
+            MessageShard shard;
             it++;
+            if (GetInventoryShard(inv.type, shard) && !PushShardItem(pfrom, inv, shard, fShardPushed)) {
+                vNotFound.push_back(inv);
+                continue;
+            }
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
                 bool send = false;
@@ -5508,14 +5975,14 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
+                    // Send block from the cache of recently served blocks, or from disk
+                    CSerializeDataRef msgBlock = GetBlockMessage((*mi).second);
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                        pfrom->PushMessage(msgBlock);
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        ReadBlockFromMessage(*msgBlock, block);
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5548,12 +6015,12 @@ void static ProcessGetData(CNode* pfrom)
                 }
             } else if (inv.IsKnownType()) {
                 // Send stream from relay memory
-                bool pushed = false;
-                {
+                bool pushed = fShardPushed;
+                if (!pushed) {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSerializeDataRef>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -5587,6 +6054,7 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
+                    LOCK(cs_mapSporks);
                     if (mapSporks.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -5595,75 +6063,6 @@ void static ProcessGetData(CNode* pfrom)
                         pushed = true;
                     }
                 }
-                if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
-                    if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
-                        pfrom->PushMessage("mnw", ss);
-                        pushed = true;
-                    }
-                }
-                if (!pushed && inv.type == MSG_BUDGET_VOTE) {
-                    if (budget.mapSeenMasternodeBudgetVotes.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << budget.mapSeenMasternodeBudgetVotes[inv.hash];
-                        pfrom->PushMessage("mvote", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_BUDGET_PROPOSAL) {
-                    if (budget.mapSeenMasternodeBudgetProposals.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << budget.mapSeenMasternodeBudgetProposals[inv.hash];
-                        pfrom->PushMessage("mprop", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_BUDGET_FINALIZED_VOTE) {
-                    if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << budget.mapSeenFinalizedBudgetVotes[inv.hash];
-                        pfrom->PushMessage("fbvote", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_BUDGET_FINALIZED) {
-                    if (budget.mapSeenFinalizedBudgets.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << budget.mapSeenFinalizedBudgets[inv.hash];
-                        pfrom->PushMessage("fbs", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
-                    if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash];
-                        pfrom->PushMessage("mnb", ss);
-                        pushed = true;
-                    }
-                }
-
-                if (!pushed && inv.type == MSG_MASTERNODE_PING) {
-                    if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodePing[inv.hash];
-                        pfrom->PushMessage("mnp", ss);
-                        pushed = true;
-                    }
-                }
-
                 if (!pushed && inv.type == MSG_DSTX) {
                     if (mapObfuscationBroadcastTxes.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -5703,6 +6102,133 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+// Handles "addr" and "getaddr", on the addr message worker if there is one.
+bool static ProcessAddrMessage(CNode* pfrom, const string& strCommand, CDataStream& vRecv)
+{
+    if (strCommand == "addr") {
+        vector<CAddress> vAddr;
+        vRecv >> vAddr;
+
+        // Don't want addr from older versions unless seeding
+        if (pfrom->nVersion < CADDR_TIME_VERSION && addrman.size() > 1000)
+            return true;
+        if (vAddr.size() > 1000) {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("message addr size() = %u", vAddr.size());
+        }
+
+        // Store the new addresses
+        vector<CAddress> vAddrOk;
+        int64_t nNow = GetAdjustedTime();
+        int64_t nSince = nNow - 10 * 60;
+        BOOST_FOREACH (CAddress& addr, vAddr) {
+            boost::this_thread::interruption_point();
+
+            if (addr.nTime <= 100000000 || addr.nTime > nNow + 10 * 60)
+                addr.nTime = nNow - 5 * 24 * 60 * 60;
+            pfrom->AddAddressKnown(addr);
+            bool fReachable = IsReachable(addr);
+            if (addr.nTime > nSince && !pfrom->fGetAddr && vAddr.size() <= 10 && addr.IsRoutable()) {
+                // Relay to a limited number of other nodes
+                {
+                    LOCK(cs_vNodes);
+                    // Use deterministic randomness to send to the same nodes for 24 hours
+                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    static uint256 hashSalt;
+                    if (hashSalt == 0)
+                        hashSalt = GetRandHash();
+                    uint64_t hashAddr = addr.GetHash();
+                    uint256 hashRand = hashSalt ^ (hashAddr << 32) ^ ((GetTime() + hashAddr) / (24 * 60 * 60));
+                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
+                    multimap<uint256, CNode*> mapMix;
+                    BOOST_FOREACH (CNode* pnode, vNodes) {
+                        if (pnode->nVersion < CADDR_TIME_VERSION)
+                            continue;
+                        unsigned int nPointer;
+                        memcpy(&nPointer, &pnode, sizeof(nPointer));
+                        uint256 hashKey = hashRand ^ nPointer;
+                        hashKey = Hash(BEGIN(hashKey), END(hashKey));
+                        mapMix.insert(make_pair(hashKey, pnode));
+                    }
+                    int nRelayNodes = fReachable ? 2 : 1; // limited relaying of addresses outside our network(s)
+                    for (multimap<uint256, CNode*>::iterator mi = mapMix.begin(); mi != mapMix.end() && nRelayNodes-- > 0; ++mi)
+                        ((*mi).second)->PushAddress(addr);
+                }
+            }
+            // Do not store addresses outside our network
+            if (fReachable)
+                vAddrOk.push_back(addr);
+        }
+        addrman.Add(vAddrOk, pfrom->addr, 2 * 60 * 60);
+        if (vAddr.size() < 1000)
+            pfrom->fGetAddr = false;
+        if (pfrom->fOneShot)
+            pfrom->fDisconnect = true;
+    }
+
+    // This asymmetric behavior for inbound and outbound connections was introduced
+    // to prevent a fingerprinting attack: an attacker can send specific fake addresses
+    // to users' AddrMan and later request them by sending getaddr messages.
+    // Making users (which are behind NAT and can only make outgoing connections) ignore
+    // getaddr message mitigates the attack.
+    else if ((strCommand == "getaddr") && (pfrom->fInbound)) {
+        {
+            LOCK(pfrom->cs_addrKnown);
+            pfrom->vAddrToSend.clear();
+        }
+        vector<CAddress> vAddr = addrman.GetAddr();
+        BOOST_FOREACH (const CAddress& addr, vAddr)
+            pfrom->PushAddress(addr);
+    }
+
+    return true;
+}
+
+// Validates a block from a "block" message, or rebuilt from a compact block, whose parent we have.
+/**
+ * Check the proof of a compact block with what it carries in full: the
+ * coinbase and, for proof-of-stake, the coinstake and block signature.
+ */
+bool static CheckCompactBlockProof(const CBlockHeaderAndShortTxIDs& cmpctblock, CBlockIndex* const pindexPrev)
+{
+    AssertLockHeld(cs_main);
+
+    CBlock block(cmpctblock.header);
+    size_t nPrefill = cmpctblock.IsProofOfStake() ? 2 : 1;
+    for (size_t i = 0; i < nPrefill && i < cmpctblock.prefilledtxn.size(); i++)
+        block.vtx.push_back(cmpctblock.prefilledtxn[i].tx);
+    block.vchBlockSig = cmpctblock.vchBlockSig;
+
+    if (!block.CheckBlockSignature())
+        return error("%s : bad block signature", __func__);
+    return CheckWork(block, pindexPrev);
+}
+
+void static ProcessReceivedBlock(CNode* pfrom, CBlock& block, const string& strCommand)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    pfrom->AddInventoryKnown(inv);
+
+    CValidationState state;
+    if (!mapBlockIndex.count(block.GetHash())) {
+        PreCheckBlock(block);
+        ProcessNewBlock(state, pfrom, &block);
+        int nDoS;
+        if(state.IsInvalid(nDoS)) {
+            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+            if(nDoS > 0) {
+                TRY_LOCK(cs_main, lockMain);
+                if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
+            }
+        }
+        //disconnect this node if its old protocol version
+        pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
+    } else {
+        LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+    }
+}
+
 bool fRequestedSporksIDB = false;
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
@@ -5849,68 +6375,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
-    }
-
 
-    else if (strCommand == "addr") {
-        vector<CAddress> vAddr;
-        vRecv >> vAddr;
-
-        // Don't want addr from older versions unless seeding
-        if (pfrom->nVersion < CADDR_TIME_VERSION && addrman.size() > 1000)
-            return true;
-        if (vAddr.size() > 1000) {
-            Misbehaving(pfrom->GetId(), 20);
-            return error("message addr size() = %u", vAddr.size());
-        }
+        // Ask to be sent new blocks as compact blocks. Peers that don't know
+        // the message ignore it and keep announcing blocks with inv.
+        if (GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS))
+            pfrom->PushMessage("sendcmpct", true, COMPACT_BLOCKS_VERSION);
+    }
 
-        // Store the new addresses
-        vector<CAddress> vAddrOk;
-        int64_t nNow = GetAdjustedTime();
-        int64_t nSince = nNow - 10 * 60;
-        BOOST_FOREACH (CAddress& addr, vAddr) {
-            boost::this_thread::interruption_point();
 
-            if (addr.nTime <= 100000000 || addr.nTime > nNow + 10 * 60)
-                addr.nTime = nNow - 5 * 24 * 60 * 60;
-            pfrom->AddAddressKnown(addr);
-            bool fReachable = IsReachable(addr);
-            if (addr.nTime > nSince && !pfrom->fGetAddr && vAddr.size() <= 10 && addr.IsRoutable()) {
-                // Relay to a limited number of other nodes
-                {
-                    LOCK(cs_vNodes);
-                    // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint64_t hashAddr = addr.GetHash();
-                    uint256 hashRand = hashSalt ^ (hashAddr << 32) ^ ((GetTime() + hashAddr) / (24 * 60 * 60));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    multimap<uint256, CNode*> mapMix;
-                    BOOST_FOREACH (CNode* pnode, vNodes) {
-                        if (pnode->nVersion < CADDR_TIME_VERSION)
-                            continue;
-                        unsigned int nPointer;
-                        memcpy(&nPointer, &pnode, sizeof(nPointer));
-                        uint256 hashKey = hashRand ^ nPointer;
-                        hashKey = Hash(BEGIN(hashKey), END(hashKey));
-                        mapMix.insert(make_pair(hashKey, pnode));
-                    }
-                    int nRelayNodes = fReachable ? 2 : 1; // limited relaying of addresses outside our network(s)
-                    for (multimap<uint256, CNode*>::iterator mi = mapMix.begin(); mi != mapMix.end() && nRelayNodes-- > 0; ++mi)
-                        ((*mi).second)->PushAddress(addr);
-                }
-            }
-            // Do not store addresses outside our network
-            if (fReachable)
-                vAddrOk.push_back(addr);
-        }
-        addrman.Add(vAddrOk, pfrom->addr, 2 * 60 * 60);
-        if (vAddr.size() < 1000)
-            pfrom->fGetAddr = false;
-        if (pfrom->fOneShot)
-            pfrom->fDisconnect = true;
+    else if (strCommand == "addr" || strCommand == "getaddr") {
+        return ProcessAddrMessage(pfrom, strCommand, vRecv);
     }
 
 
@@ -6225,6 +6699,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the whole message at once, before taking cs_main
+        std::vector<const CBlockHeader*> vHeaderPtrs;
+        for (const CBlockHeader& header : headers)
+            vHeaderPtrs.push_back(&header);
+        CBlockHeader::CacheHashes(vHeaderPtrs);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -6275,6 +6755,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        {
+            // A compact block still waiting for transactions is of no more use once the block is here
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            if (state->partialBlock && state->partialBlock->header.GetHash() == hashBlock)
+                state->partialBlock.reset();
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
             if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
@@ -6287,39 +6775,184 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 pfrom->vBlockRequested.push_back(hashBlock);
             }
         } else {
-            pfrom->AddInventoryKnown(inv);
+            ProcessReceivedBlock(pfrom, block, strCommand);
+        }
+    }
 
-            CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block);
+
+    else if (strCommand == "sendcmpct") {
+        bool fAnnounce;
+        uint64_t nCmpctVersion;
+        vRecv >> fAnnounce >> nCmpctVersion;
+        // Keep announcing with inv to peers that want an encoding we don't know
+        if (nCmpctVersion == COMPACT_BLOCKS_VERSION)
+            pfrom->fPreferCompactBlocks = fAnnounce;
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hashBlock);
+        pfrom->AddInventoryKnown(inv);
+        LogPrint("net", "received compact block %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        // The proof of work is checked before anything is looked up for the block
+        CValidationState state;
+        if (!CheckBlockHeader(cmpctblock.header, state, !cmpctblock.IsProofOfStake())) {
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0)
+                Misbehaving(pfrom->GetId(), nDoS);
+            return error("invalid compact block header %s from peer=%d", hashBlock.ToString(), pfrom->id);
+        }
+
+        // Whenever the block can't be rebuilt here, ask for it in full; the
+        // "block" handler also takes care of a block we can't connect yet.
+        // Asking for a full block drops the compact block this peer may have
+        // had waiting for transactions, along with its mempool copies.
+        vector<CInv> vGetData(1, inv);
+        {
+            LOCK(cs_main);
+            if (mapBlockIndex.count(hashBlock))
+                return true;
+
+            BlockMap::iterator mi = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+            if (mi == mapBlockIndex.end()) {
+                State(pfrom->GetId())->partialBlock.reset();
+                pfrom->PushMessage("getdata", vGetData);
+                return true;
+            }
+            CBlockIndex* pindexPrev = (*mi).second;
+            if (pindexPrev->nStatus & BLOCK_FAILED_MASK) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("compact block %s from peer=%d builds on invalid block %s", hashBlock.ToString(), pfrom->id, pindexPrev->GetBlockHash().ToString());
+            }
+            if (!ContextualCheckBlockHeader(cmpctblock.header, state, pindexPrev)) {
                 int nDoS;
-                if(state.IsInvalid(nDoS)) {
-                    pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                    if(nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
-                }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
-            } else {
-                LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("invalid compact block header %s from peer=%d", hashBlock.ToString(), pfrom->id);
+            }
+
+            // The mempool won't have the transactions of a block on an old fork
+            if (pindexPrev->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+                State(pfrom->GetId())->partialBlock.reset();
+                pfrom->PushMessage("getdata", vGetData);
+                return true;
+            }
+
+            // Matching the mempool costs a full scan of it, so the block has to
+            // prove itself first: the work it claims and, for proof-of-stake,
+            // the stake and block signature of the prefilled coinstake
+            if (!CheckCompactBlockProof(cmpctblock, pindexPrev))
+                return error("compact block %s from peer=%d failed its proof check", hashBlock.ToString(), pfrom->id);
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+        }
+
+        // Matching the short IDs only needs the mempool lock
+        boost::shared_ptr<PartiallyDownloadedBlock> partialBlock(new PartiallyDownloadedBlock(&mempool));
+        ReadStatus status = partialBlock->InitData(cmpctblock);
+        if (status == READ_STATUS_INVALID) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid compact block %s from peer=%d", hashBlock.ToString(), pfrom->id);
+        }
+        if (status == READ_STATUS_FAILED) {
+            {
+                LOCK(cs_main);
+                State(pfrom->GetId())->partialBlock.reset();
+            }
+            pfrom->PushMessage("getdata", vGetData);
+            return true;
+        }
+
+        BlockTransactionsRequest req;
+        partialBlock->GetMissing(req.indexes);
+        if (!req.indexes.empty()) {
+            LogPrint("net", "requesting %u transactions of compact block %s from peer=%d\n", req.indexes.size(), hashBlock.ToString(), pfrom->id);
+            {
+                LOCK(cs_main);
+                State(pfrom->GetId())->partialBlock = partialBlock;
+            }
+            req.blockhash = hashBlock;
+            pfrom->PushMessage("getblocktxn", req);
+            return true;
+        }
+
+        CBlock block;
+        if (partialBlock->FillBlock(block, vector<CTransaction>()) != READ_STATUS_OK) {
+            {
+                LOCK(cs_main);
+                State(pfrom->GetId())->partialBlock.reset();
             }
+            pfrom->PushMessage("getdata", vGetData);
+            return true;
         }
+        ProcessReceivedBlock(pfrom, block, strCommand);
     }
 
 
-    // This asymmetric behavior for inbound and outbound connections was introduced
-    // to prevent a fingerprinting attack: an attacker can send specific fake addresses
-    // to users' AddrMan and later request them by sending getaddr messages.
-    // Making users (which are behind NAT and can only make outgoing connections) ignore
-    // getaddr message mitigates the attack.
-    else if ((strCommand == "getaddr") && (pfrom->fInbound)) {
-        pfrom->vAddrToSend.clear();
-        vector<CAddress> vAddr = addrman.GetAddr();
-        BOOST_FOREACH (const CAddress& addr, vAddr)
-            pfrom->PushAddress(addr);
+    else if (strCommand == "getblocktxn") {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "peer=%d asked for transactions of block %s that we don't have\n", pfrom->id, req.blockhash.ToString());
+            return true;
+        }
+
+        // Only new blocks go out as compact blocks, so an older one is sent in full
+        CSerializeDataRef msgBlock = GetBlockMessage((*mi).second);
+        if ((*mi).second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            pfrom->PushMessage(msgBlock);
+            return true;
+        }
+
+        CBlock block;
+        ReadBlockFromMessage(*msgBlock, block);
+        BlockTransactions resp(req);
+        for (unsigned int i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("getblocktxn index %u out of range for block %s from peer=%d", req.indexes[i], req.blockhash.ToString(), pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            if (!state->partialBlock || state->partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint("net", "peer=%d sent transactions of block %s that we didn't ask for\n", pfrom->id, resp.blockhash.ToString());
+                return true;
+            }
+            boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+            partialBlock.swap(state->partialBlock);
+
+            ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid transactions of compact block %s from peer=%d", resp.blockhash.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_FAILED) {
+                // Most likely a mempool transaction that shares a short ID with one of the block's
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+                return true;
+            }
+        }
+        ProcessReceivedBlock(pfrom, block, strCommand);
     }
 
 
@@ -6537,6 +7170,69 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     return true;
 }
 
+// Runs the handler of a message that GetMessageShard() assigned to shard.
+bool static ProcessShardMessage(MessageShard shard, CNode* pfrom, const string& strCommandIn, CDataStream& vRecv)
+{
+    // The extension handlers take a non-const command
+    string strCommand = strCommandIn;
+
+    LOCK(cs_messageShard[shard]);
+    switch (shard) {
+    case SHARD_MASTERNODE:
+        obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
+        mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
+        masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
+        masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        break;
+    case SHARD_BUDGET:
+        budget.ProcessMessage(pfrom, strCommand, vRecv);
+        break;
+    case SHARD_SPORK:
+        ProcessSpork(pfrom, strCommand, vRecv);
+        break;
+    case SHARD_SWIFTTX: {
+        // Block and transaction validation read the SwiftTX maps under cs_main
+        LOCK(cs_main);
+        ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
+        break;
+    }
+    case SHARD_ADDR:
+        return ProcessAddrMessage(pfrom, strCommand, vRecv);
+    default:
+        assert(!"unknown message shard");
+    }
+    return true;
+}
+
+// Message worker entry point, which handles errors like ProcessMessages() does.
+void static ProcessWorkerMessage(MessageShard shard, CNode* pfrom, const string& strCommand, CDataStream& vRecv)
+{
+    unsigned int nMessageSize = vRecv.size();
+    bool fRet = false;
+    try {
+        fRet = ProcessShardMessage(shard, pfrom, strCommand, vRecv);
+    } catch (std::ios_base::failure& e) {
+        pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
+        LogPrintf("ProcessWorkerMessage(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
+    } catch (boost::thread_interrupted) {
+        throw;
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessWorkerMessage()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ProcessWorkerMessage()");
+    }
+
+    if (!fRet)
+        LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+}
+
+void StartMessageWorkers(boost::thread_group& threadGroup)
+{
+    assert(pmessageWorkers == NULL);
+    pmessageWorkers = new CMessageWorkers(&ProcessWorkerMessage);
+    pmessageWorkers->Start(threadGroup);
+}
+
 // Note: whenever a protocol update is needed toggle between both implementations (comment out the formerly active one)
 //       so we can leave the existing clients untouched (old SPORK will stay on so they don't see even older clients).
 //       Those old clients won't react to the changes of the other (new) SPORK because at the time of their implementation
@@ -6578,6 +7274,10 @@ bool ProcessMessages(CNode* pfrom)
         if (pfrom->nSendSize >= SendBufferSize())
             break;
 
+        // Let the message workers catch up with this peer
+        if (pfrom->nWorkerQueueSize >= ReceiveFloodSize())
+            break;
+
         // get next message
         CNetMessage& msg = *it;
 
@@ -6622,6 +7322,15 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
+        // Hand the message to its worker and move on to the next one
+        MessageShard shard;
+        if (pmessageWorkers && pfrom->nVersion != 0 && GetMessageShard(strCommand, shard)) {
+            if (fDebug)
+                LogPrintf("received: %s (%u bytes) peer=%d, queued\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
+            pmessageWorkers->Push(shard, pfrom, strCommand, vRecv);
+            continue;
+        }
+
         // Process message
         bool fRet = false;
         try {
@@ -6706,8 +7415,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
                 // Periodically clear setAddrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_addrKnown);
                     pnode->setAddrKnown.clear();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -6720,6 +7431,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: addr
         //
         if (fSendTrickle) {
+            LOCK(pto->cs_addrKnown);
             vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
@@ -6739,7 +7451,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         }
 
         CNodeState& state = *State(pto->GetId());
-        if (state.fShouldBan) {
+        bool fShouldBan;
+        {
+            LOCK(cs_nodeMisbehavior);
+            fShouldBan = state.fShouldBan;
+            state.fShouldBan = false;
+        }
+        if (fShouldBan) {
             if (pto->fWhitelisted)
                 LogPrintf("Warning: not punishing whitelisted peer %s!\n", pto->addr.ToString());
             else {
@@ -6750,7 +7468,6 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     CNode::Ban(pto->addr, BanReasonNodeMisbehaving);
                 }
             }
-            state.fShouldBan = false;
         }
 
         BOOST_FOREACH (const CBlockReject& reject, state.rejects)
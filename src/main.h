@@ -51,17 +51,27 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
 struct CBlockTemplate;
 struct CNodeStateStats;
 
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/** Default for -maxmempool, maximum megabytes of memory the mempool uses, indexes included */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -98,6 +108,10 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Depth up to which getblocktxn requests are answered with the transactions instead of the whole block */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Number of blocks read ahead when importing a block file, so their headers can be hashed as a batch */
+static const unsigned int LOAD_BLOCK_BATCH_SIZE = 8;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -142,7 +156,7 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 //extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fVerifyingBlocks;
@@ -221,8 +235,14 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
  */
 bool SendMessages(CNode* pto, bool fSendTrickle);
+/** Start the threads that process masternode, budget, spork, SwiftTX and addr messages */
+void StartMessageWorkers(boost::thread_group& threadGroup);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend verification thread */
+void ThreadZerocoinSpendCheck();
+/** Run an instance of the block pre-validation thread */
+void ThreadBlockPreCheck();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -354,9 +374,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+/** pfVerifyZerocoinSignature, when given, says whether zerocoin spend signatures are verified; without it that is worked out from the chain, which needs cs_main */
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL, const bool* pfVerifyZerocoinSignature = NULL);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks = NULL);
 bool ContextualCheckCoinSpend(const libzerocoin::CoinSpend& spend, CBlockIndex* pindex, const uint256& txid);
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
 bool TxOutToPublicCoin(const CTxOut txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state);
@@ -449,6 +470,84 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one zerocoin spend proof verification
+ * Note that this stores a reference to the spending transaction
+ */
+class CZerocoinSpendCheck
+{
+private:
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    CBigNum bnAccumulatorValue;
+    const libzerocoin::AccumulatorProofBatch* pBatch;
+
+public:
+    CZerocoinSpendCheck() : ptxTo(0), nIn(0), bnAccumulatorValue(0), pBatch(NULL) {}
+    CZerocoinSpendCheck(const CTransaction& txToIn, unsigned int nInIn, const CBigNum& bnAccumulatorValueIn) : ptxTo(&txToIn), nIn(nInIn), bnAccumulatorValue(bnAccumulatorValueIn), pBatch(NULL) {}
+
+    bool operator()();
+
+    /** Share precomputed tables with the other spends of the batch, which must outlive this check */
+    void SetBatch(const libzerocoin::AccumulatorProofBatch* pBatchIn) { pBatch = pBatchIn; }
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+        std::swap(pBatch, check.pBatch);
+    }
+};
+
+/**
+ * Closure representing one context free check of a block received from the
+ * network: its header, merkle root, signature or one of its transactions
+ * Note that this stores a reference to the block
+ */
+class CBlockPreCheck
+{
+public:
+    enum Kind {
+        HEADER,
+        MERKLE_ROOT,
+        SIGNATURE,
+        TRANSACTION
+    };
+
+private:
+    const CBlock* pblock;
+    int nKind;
+    unsigned int nTx;
+    // The chain dependent arguments of CheckTransaction, worked out under cs_main by the caller
+    bool fEnforceSerialRange;
+    bool fVerifyZerocoinSignature;
+
+public:
+    CBlockPreCheck() : pblock(NULL), nKind(HEADER), nTx(0), fEnforceSerialRange(false), fVerifyZerocoinSignature(false) {}
+    CBlockPreCheck(const CBlock& blockIn, int nKindIn, unsigned int nTxIn = 0, bool fEnforceSerialRangeIn = false, bool fVerifyZerocoinSignatureIn = false) : pblock(&blockIn), nKind(nKindIn), nTx(nTxIn), fEnforceSerialRange(fEnforceSerialRangeIn), fVerifyZerocoinSignature(fVerifyZerocoinSignatureIn) {}
+
+    bool operator()();
+
+    void swap(CBlockPreCheck& check)
+    {
+        std::swap(pblock, check.pblock);
+        std::swap(nKind, check.nKind);
+        std::swap(nTx, check.nTx);
+        std::swap(fEnforceSerialRange, check.fEnforceSerialRange);
+        std::swap(fVerifyZerocoinSignature, check.fVerifyZerocoinSignature);
+    }
+};
+
+/**
+ * Run the context free checks of a block received from the network on the
+ * block pre-validation threads, without cs_main. The merkle root, signature
+ * and transaction checks that pass are remembered on the block and skipped by
+ * CheckBlock and ProcessNewBlock; anything that fails is left for those to
+ * reject with the usual error and DoS score.
+ */
+void PreCheckBlock(const CBlock& block);
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
@@ -0,0 +1,206 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messageworkers.h"
+
+#include "net.h"
+#include "protocol.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+CCriticalSection cs_messageShard[MAX_MESSAGE_SHARDS];
+
+namespace {
+
+//! Thread names, which TraceThread wants as string literals
+const char* const SHARD_THREAD_NAMES[MAX_MESSAGE_SHARDS] = {
+    "msg-masternode",
+    "msg-budget",
+    "msg-spork",
+    "msg-swifttx",
+    "msg-addr",
+};
+
+struct ShardCommand {
+    const char* pszCommand;
+    MessageShard shard;
+};
+
+const ShardCommand SHARD_COMMANDS[] = {
+    {"mnb", SHARD_MASTERNODE},
+    {"mnp", SHARD_MASTERNODE},
+    {"dseg", SHARD_MASTERNODE},
+    {"dsee", SHARD_MASTERNODE},
+    {"dseep", SHARD_MASTERNODE},
+    {"mnget", SHARD_MASTERNODE},
+    {"mnw", SHARD_MASTERNODE},
+    {"ssc", SHARD_MASTERNODE},
+    {"dsa", SHARD_MASTERNODE},
+    {"dsq", SHARD_MASTERNODE},
+    {"dsi", SHARD_MASTERNODE},
+    {"dssu", SHARD_MASTERNODE},
+    {"dss", SHARD_MASTERNODE},
+    {"dsf", SHARD_MASTERNODE},
+    {"dsc", SHARD_MASTERNODE},
+    {"mnvs", SHARD_BUDGET},
+    {"mprop", SHARD_BUDGET},
+    {"mvote", SHARD_BUDGET},
+    {"fbs", SHARD_BUDGET},
+    {"fbvote", SHARD_BUDGET},
+    {"spork", SHARD_SPORK},
+    {"getsporks", SHARD_SPORK},
+    {"ix", SHARD_SWIFTTX},
+    {"txlvote", SHARD_SWIFTTX},
+    {"addr", SHARD_ADDR},
+    {"getaddr", SHARD_ADDR},
+};
+} // anon namespace
+
+bool GetMessageShard(const std::string& strCommand, MessageShard& shard)
+{
+    for (unsigned int i = 0; i < ARRAYLEN(SHARD_COMMANDS); i++) {
+        if (strCommand == SHARD_COMMANDS[i].pszCommand) {
+            shard = SHARD_COMMANDS[i].shard;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GetInventoryShard(int nInvType, MessageShard& shard)
+{
+    switch (nInvType) {
+    case MSG_MASTERNODE_WINNER:
+    case MSG_MASTERNODE_ANNOUNCE:
+    case MSG_MASTERNODE_PING:
+        shard = SHARD_MASTERNODE;
+        return true;
+    case MSG_BUDGET_VOTE:
+    case MSG_BUDGET_PROPOSAL:
+    case MSG_BUDGET_FINALIZED:
+    case MSG_BUDGET_FINALIZED_VOTE:
+        shard = SHARD_BUDGET;
+        return true;
+    }
+    return false;
+}
+
+CMessageWorkers::Message::Message(CNode* pnodeIn, const std::string& strCommandIn, CDataStream& vRecvIn) : pnode(pnodeIn), strCommand(strCommandIn), vRecv(std::move(vRecvIn))
+{
+}
+
+CMessageWorkers::CMessageWorkers(const ProcessFunction& processIn) : process(processIn)
+{
+    for (int i = 0; i < MAX_MESSAGE_SHARDS; i++)
+        shards[i].nSize = 0;
+}
+
+CMessageWorkers::~CMessageWorkers()
+{
+    // The nodes are deleted at shutdown regardless of their references, so
+    // there is nothing to release here
+}
+
+void CMessageWorkers::Start(boost::thread_group& threadGroup)
+{
+    for (int i = 0; i < MAX_MESSAGE_SHARDS; i++) {
+        boost::function<void()> func = boost::bind(&CMessageWorkers::ThreadShard, this, (MessageShard)i);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, SHARD_THREAD_NAMES[i], func));
+    }
+}
+
+void CMessageWorkers::Push(MessageShard shard, CNode* pnode, const std::string& strCommand, CDataStream& vRecv)
+{
+    {
+        LOCK(cs_vNodes);
+        pnode->AddRef();
+    }
+    pnode->nWorkerQueueSize += vRecv.size();
+
+    Shard& s = shards[shard];
+    {
+        boost::unique_lock<boost::mutex> lock(s.mutex);
+        std::deque<Message>& queue = s.mapQueues[pnode];
+        if (queue.empty())
+            s.vPeers.push_back(pnode);
+        queue.push_back(Message(pnode, strCommand, vRecv));
+        s.nSize++;
+    }
+    s.cond.notify_one();
+}
+
+bool CMessageWorkers::Pop(MessageShard shard, bool fWait, CNode*& pnode, std::string& strCommand, CDataStream& vRecv)
+{
+    Shard& s = shards[shard];
+    boost::unique_lock<boost::mutex> lock(s.mutex);
+    while (s.vPeers.empty()) {
+        if (!fWait)
+            return false;
+        s.cond.wait(lock);
+    }
+
+    pnode = s.vPeers.front();
+    s.vPeers.pop_front();
+    std::map<CNode*, std::deque<Message> >::iterator it = s.mapQueues.find(pnode);
+    Message& msg = it->second.front();
+    strCommand.swap(msg.strCommand);
+    vRecv = std::move(msg.vRecv);
+    it->second.pop_front();
+    s.nSize--;
+
+    // Back of the line for the peer's next message
+    if (it->second.empty())
+        s.mapQueues.erase(it);
+    else
+        s.vPeers.push_back(pnode);
+    return true;
+}
+
+void CMessageWorkers::Process(MessageShard shard, CNode* pnode, const std::string& strCommand, CDataStream& vRecv)
+{
+    size_t nSize = vRecv.size();
+    if (!pnode->fDisconnect)
+        process(shard, pnode, strCommand, vRecv);
+
+    // The message handler holds back peers that are too far behind
+    bool fWasFull = pnode->nWorkerQueueSize >= ReceiveFloodSize();
+    pnode->nWorkerQueueSize -= nSize;
+    if (fWasFull && pnode->nWorkerQueueSize < ReceiveFloodSize())
+        messageHandlerCondition.notify_one();
+
+    LOCK(cs_vNodes);
+    pnode->Release();
+}
+
+bool CMessageWorkers::ProcessNext(MessageShard shard)
+{
+    CNode* pnode;
+    std::string strCommand;
+    CDataStream vRecv(SER_NETWORK, PROTOCOL_VERSION);
+    if (!Pop(shard, false, pnode, strCommand, vRecv))
+        return false;
+    Process(shard, pnode, strCommand, vRecv);
+    return true;
+}
+
+size_t CMessageWorkers::GetQueueSize(MessageShard shard)
+{
+    Shard& s = shards[shard];
+    boost::unique_lock<boost::mutex> lock(s.mutex);
+    return s.nSize;
+}
+
+void CMessageWorkers::ThreadShard(MessageShard shard)
+{
+    while (true) {
+        CNode* pnode;
+        std::string strCommand;
+        CDataStream vRecv(SER_NETWORK, PROTOCOL_VERSION);
+        Pop(shard, true, pnode, strCommand, vRecv);
+        Process(shard, pnode, strCommand, vRecv);
+        boost::this_thread::interruption_point();
+    }
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_MESSAGEWORKERS_H
+#define SNODECOIN_MESSAGEWORKERS_H
+
+#include "streams.h"
+#include "sync.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CNode;
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** -parallelmessages default */
+static const bool DEFAULT_PARALLEL_MESSAGES = true;
+
+/**
+ * Subsystems whose messages don't have to wait behind block and
+ * transaction validation. Each one gets its own message worker.
+ */
+enum MessageShard {
+    SHARD_MASTERNODE, //! Masternode list, payments, sync status and obfuscation
+    SHARD_BUDGET,
+    SHARD_SPORK,
+    SHARD_SWIFTTX,
+    SHARD_ADDR,
+    MAX_MESSAGE_SHARDS
+};
+
+/**
+ * Held while a shard processes a message. Code elsewhere that reads the
+ * relay maps of the masternode and budget shards takes it as well.
+ */
+extern CCriticalSection cs_messageShard[MAX_MESSAGE_SHARDS];
+
+/** Find the shard that processes strCommand. Returns false for messages that stay on the message handler. */
+bool GetMessageShard(const std::string& strCommand, MessageShard& shard);
+
+/** Find the shard whose lock guards the relay map of an inventory type */
+bool GetInventoryShard(int nInvType, MessageShard& shard);
+
+/**
+ * Threads that process the messages of one shard each, so that masternode
+ * pings, budget votes, sporks, SwiftTX votes and addr floods don't queue
+ * up behind validation on the message handler.
+ *
+ * A shard serves the peers with waiting messages in turn, one message
+ * each, and so takes one peer's messages in the order they came in. The
+ * bytes queued for a peer are counted in CNode::nWorkerQueueSize, for the
+ * message handler to stop taking more when it is too far behind.
+ */
+class CMessageWorkers : private boost::noncopyable
+{
+public:
+    typedef boost::function<void(MessageShard, CNode*, const std::string&, CDataStream&)> ProcessFunction;
+
+    explicit CMessageWorkers(const ProcessFunction& processIn);
+    ~CMessageWorkers();
+
+    /** Start one thread per shard */
+    void Start(boost::thread_group& threadGroup);
+
+    /** Queue a message for its shard, taking the contents of vRecv */
+    void Push(MessageShard shard, CNode* pnode, const std::string& strCommand, CDataStream& vRecv);
+
+    /** Process the next message of a shard on this thread. Returns false if there was none. */
+    bool ProcessNext(MessageShard shard);
+
+    /** Number of messages waiting in a shard */
+    size_t GetQueueSize(MessageShard shard);
+
+private:
+    struct Message {
+        CNode* pnode;
+        std::string strCommand;
+        CDataStream vRecv;
+
+        Message(CNode* pnodeIn, const std::string& strCommandIn, CDataStream& vRecvIn);
+    };
+
+    struct Shard {
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        std::map<CNode*, std::deque<Message> > mapQueues;
+        std::deque<CNode*> vPeers; //! Peers with waiting messages, in the order they are served
+        size_t nSize;
+    };
+
+    ProcessFunction process;
+    Shard shards[MAX_MESSAGE_SHARDS];
+
+    /** Take the next message from a shard, waiting for one if fWait is set */
+    bool Pop(MessageShard shard, bool fWait, CNode*& pnode, std::string& strCommand, CDataStream& vRecv);
+    void Process(MessageShard shard, CNode* pnode, const std::string& strCommand, CDataStream& vRecv);
+    void ThreadShard(MessageShard shard);
+};
+
+#endif // SNODECOIN_MESSAGEWORKERS_H
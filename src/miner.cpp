@@ -28,7 +28,8 @@
 #include "spork.h"
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 
 using namespace std;
 
@@ -37,54 +38,10 @@ using namespace std;
 // SnodecoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
-
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
-
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
-    }
-};
-
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -94,7 +51,27 @@ void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock);
 }
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake)
+/** Search the wallet for a stake kernel on top of pindexPrev. This needs neither
+ *  a block template nor cs_main, so that nothing is built until a kernel is found. */
+static bool SearchStakeKernelForTip(CWallet* pwallet, const CBlockIndex* pindexPrev, CStakeKernel& kernel)
+{
+    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
+
+    boost::this_thread::interruption_point();
+    CBlockHeader header;
+    header.nTime = GetAdjustedTime();
+    unsigned int nBits = GetNextWorkRequired(pindexPrev, &header);
+    int64_t nSearchTime = header.nTime; // search to current time
+    if (nSearchTime < nLastCoinStakeSearchTime)
+        return false;
+
+    bool fFound = pwallet->SearchStakeKernel(nBits, kernel);
+    nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+    nLastCoinStakeSearchTime = nSearchTime;
+    return fFound;
+}
+
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake, const CStakeKernel* pStakeKernel)
 {
 //    LogPrintf("CreateNewBlock(): fProofOfStake=%d\n", fProofOfStake);
 
@@ -141,30 +118,19 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
     // ppcoin: if coinstake available add coinstake tx
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
-
     if (fProofOfStake) {
-        boost::this_thread::interruption_point();
-        pblock->nTime = GetAdjustedTime();
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock);
-        CMutableTransaction txCoinStake;
-        int64_t nSearchTime = pblock->nTime; // search to current time
-        bool fStakeFound = false;
-        if (nSearchTime >= nLastCoinStakeSearchTime) {
-            unsigned int nTxNewTime = 0;
-            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime - nLastCoinStakeSearchTime, txCoinStake, nTxNewTime)) {
-                pblock->nTime = nTxNewTime;
-                pblock->vtx[0].vout[0].SetEmpty();
-                pblock->vtx.push_back(CTransaction(txCoinStake));
-                fStakeFound = true;
-            }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
-        }
+        CStakeKernel kernel;
+        if (pStakeKernel)
+            kernel = *pStakeKernel;
+        else if (!SearchStakeKernelForTip(pwallet, chainActive.Tip(), kernel))
+            return NULL;
 
-        if (!fStakeFound)
+        CMutableTransaction txCoinStake;
+        if (!pwallet->CreateCoinStake(*pwallet, kernel, txCoinStake))
             return NULL;
+        pblock->nTime = kernel.nTime;
+        pblock->vtx[0].vout[0].SetEmpty();
+        pblock->vtx.push_back(CTransaction(txCoinStake));
     }
 
     // Largest block you're willing to create:
@@ -193,240 +159,214 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            uint256 txid = tx.GetHash();
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (tx.IsZerocoinSpend()) {
-                    nTotalIn = tx.GetZerocoinSpent();
-
-                    //Give a high priority to zerocoinspends to get into the next block
-                    //Priority = (age^6+100000)*amount - gives higher priority to zsnos that have been in mempool long
-                    //and higher priority to zsnos that are large in value
-                    int64_t nTimeSeen = GetAdjustedTime();
-                    double nConfs = 100000;
-
-                    auto it = mapZerocoinspends.find(txid);
-                    if (it != mapZerocoinspends.end()) {
-                        nTimeSeen = it->second;
-                    } else {
-                        //for some reason not in map, add it
-                        mapZerocoinspends[txid] = nTimeSeen;
-                    }
-
-                    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
-
-                    // zSND spends can have very large priority, use non-overflowing safe functions
-                    dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
-                    dPriority = double_safe_multiplication(dPriority, nTotalIn);
-
-                    continue;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (mapInvalidOutPoints.count(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
-                    break;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zSND spends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
+        // The mempool keeps its entries ordered by priority and by fee rate, so
+        // transactions are taken walking down the priority index until the
+        // priority part of the block is full, then down the fee rate index.
+        // A transaction with in-pool parents that are not in the block yet
+        // waits in mapDependers until the last of them is added. It is added
+        // right away if the walk has already passed it, and otherwise when the
+        // walk gets to it.
+        mempool.SetPriorityHeight(nHeight);
+        const CTxMemPool::priorityindex_type& priorityIndex = mempool.mapTx.get<selection_priority>();
+        const CTxMemPool::feerateindex_type& feeRateIndex = mempool.mapTx.get<fee_rate>();
+        CTxMemPool::priorityindex_type::const_reverse_iterator itPriority = priorityIndex.rbegin();
+        CTxMemPool::feerateindex_type::const_reverse_iterator itFeeRate = feeRateIndex.rbegin();
+        std::pair<double, uint256> posPriority;
+        std::pair<CFeeRate, uint256> posFeeRate;
+        boost::unordered_set<uint256, CCoinsKeyHasher> setInBlock;
+        boost::unordered_set<uint256, CCoinsKeyHasher> setRejected;
+        boost::unordered_map<uint256, vector<uint256>, CCoinsKeyHasher> mapDependers;
+        vector<uint256> vToAdd;
 
         // Collect transactions into block
         uint64_t nBlockSize = 1000;
         uint64_t nBlockTx = 0;
         int nBlockSigOps = 100;
         bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        bool fBlockFull = false;
+        int nConsecutiveTooLarge = 0;
 
         vector<CBigNum> vBlockSerials;
         vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+        while (!fBlockFull) {
+            if (!fSortedByFee) {
+                if (itPriority == priorityIndex.rend()) {
+                    fSortedByFee = true;
+                    continue;
+                }
+                // Prioritise by fee once past the priority size or we run out of high-priority
+                // transactions:
+                if ((nBlockSize + itPriority->GetTxSize() >= nBlockPrioritySize) || !AllowFree(itPriority->GetSelectionPriority())) {
+                    fSortedByFee = true;
+                    continue;
+                }
+                posPriority = std::make_pair(itPriority->GetSelectionPriority(), itPriority->GetTx().GetHash());
+                itPriority++;
+            } else {
+                if (itFeeRate == feeRateIndex.rend())
+                    break;
+                posFeeRate = std::make_pair(itFeeRate->GetModFeeRate(), itFeeRate->GetTx().GetHash());
+                itFeeRate++;
+            }
 
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
+            vToAdd.assign(1, fSortedByFee ? posFeeRate.second : posPriority.second);
+            while (!vToAdd.empty() && !fBlockFull) {
+                const uint256 hash = vToAdd.back();
+                vToAdd.pop_back();
+                if (setInBlock.count(hash) || setRejected.count(hash))
+                    continue;
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.IsZerocoinSpend() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+                const CTxMemPool::TxLinks& links = mempool.mapLinks[hash];
+                const CTxMemPoolEntry& entry = *mempool.mapTx.find(hash);
+                const CTransaction& tx = entry.GetTx();
+                double dPriority = entry.GetSelectionPriority();
+                CFeeRate feeRate = entry.GetModFeeRate();
+                unsigned int nTxSize = entry.GetTxSize();
+
+                // A released depender that does not belong in the priority part
+                // is left for the fee rate walk
+                if (!fSortedByFee &&
+                    ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
+                    continue;
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+                // Size limits. Give up once the block is full, or the last
+                // few transactions in a row did not fit.
+                if (nBlockSize + nTxSize >= nBlockMaxSize) {
+                    setRejected.insert(hash);
+                    if (nBlockSize > nBlockMaxSize - 100 || ++nConsecutiveTooLarge > 50)
+                        fBlockFull = true;
+                    continue;
+                }
 
-            if (!view.HaveInputs(tx))
-                continue;
+                // Has to wait for dependencies
+                bool fWaiting = false;
+                BOOST_FOREACH (const uint256& hashParent, links.setParents) {
+                    if (setInBlock.count(hashParent))
+                        continue;
+                    if (setRejected.count(hashParent))
+                        setRejected.insert(hash);
+                    else
+                        mapDependers[hashParent].push_back(hash);
+                    fWaiting = true;
+                    break;
+                }
+                if (fWaiting)
+                    continue;
+
+                // From here on a transaction that does not make it into the block
+                // never will, as the block only grows
+                setRejected.insert(hash);
 
-            // double check that there are no double spent zsno spends in this block or tx
-            if (tx.IsZerocoinSpend()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+                if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+                    continue;
+                if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
                     continue;
 
-                bool fDoubleSerial = false;
-                for (const CTxIn txIn : tx.vin) {
-                    if (txIn.scriptSig.IsZerocoinSpend()) {
-                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
-                        if (!spend.HasValidSerial(Params().Zerocoin_Params()))
-                            fDoubleSerial = true;
-                        if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
+                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+                bool fInvalidInput = false;
+                if (!tx.IsZerocoinSpend()) {
+                    for (const CTxIn& txin : tx.vin) {
+                        if (mapInvalidOutPoints.count(txin.prevout)) {
+                            LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+                            fInvalidInput = true;
                             break;
-                        vTxSerials.emplace_back(spend.getCoinSerialNumber());
+                        }
                     }
                 }
-                //This zsno serial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
+                if (fInvalidInput)
                     continue;
-            }
 
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+                // Legacy limits on sigOps:
+                unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
+                unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+                if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+                    continue;
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
+                // Skip free transactions if we're past the minimum block size:
+                double dPriorityDelta = 0;
+                CAmount nFeeDelta = 0;
+                mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+                if (!tx.IsZerocoinSpend() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+                    continue;
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
+                if (!view.HaveInputs(tx))
+                    continue;
 
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
+                // double check that there are no double spent zsno spends in this block or tx
+                if (tx.IsZerocoinSpend()) {
+                    int nHeightTx = 0;
+                    if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+                        continue;
+
+                    bool fDoubleSerial = false;
+                    for (const CTxIn txIn : tx.vin) {
+                        if (txIn.scriptSig.IsZerocoinSpend()) {
+                            libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+                            if (!spend.HasValidSerial(Params().Zerocoin_Params()))
+                                fDoubleSerial = true;
+                            if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
+                                fDoubleSerial = true;
+                            if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
+                                fDoubleSerial = true;
+                            if (fDoubleSerial)
+                                break;
+                            vTxSerials.emplace_back(spend.getCoinSerialNumber());
+                        }
+                    }
+                    //This zsno serial has already been included in the block, do not add this tx.
+                    if (fDoubleSerial)
+                        continue;
+                }
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+                CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
 
-            for (const CBigNum bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
+                nTxSigOps += GetP2SHSigOpCount(tx, view);
+                if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+                    continue;
 
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
+                // Note that flags: we don't want to set mempool/IsStandard()
+                // policy here, but we still have to ensure that the block we
+                // create only contains transactions that are valid in new blocks.
+                CValidationState state;
+                if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+                    continue;
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
+                CTxUndo txundo;
+                UpdateCoins(tx, state, view, txundo, nHeight);
+
+                // Added
+                nConsecutiveTooLarge = 0;
+                setRejected.erase(hash);
+                setInBlock.insert(hash);
+                pblock->vtx.push_back(tx);
+                pblocktemplate->vTxFees.push_back(nTxFees);
+                pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+                nBlockSize += nTxSize;
+                ++nBlockTx;
+                nBlockSigOps += nTxSigOps;
+                nFees += nTxFees;
+
+                for (const CBigNum bnSerial : vTxSerials)
+                    vBlockSerials.emplace_back(bnSerial);
+
+                if (fPrintPriority) {
+                    LogPrintf("priority %.1f fee %s txid %s\n",
+                        dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                }
+
+                // Release transactions that waited on this one
+                boost::unordered_map<uint256, vector<uint256>, CCoinsKeyHasher>::iterator itDependers = mapDependers.find(hash);
+                if (itDependers != mapDependers.end()) {
+                    BOOST_FOREACH (const uint256& hashDepender, itDependers->second) {
+                        const CTxMemPoolEntry& entryDepender = *mempool.mapTx.find(hashDepender);
+                        bool fPassed = fSortedByFee ? std::make_pair(entryDepender.GetModFeeRate(), hashDepender) > posFeeRate :
+                                                      std::make_pair(entryDepender.GetSelectionPriority(), hashDepender) > posPriority;
+                        if (fPassed)
+                            vToAdd.push_back(hashDepender);
                     }
+                    mapDependers.erase(itDependers);
                 }
             }
         }
@@ -505,14 +445,14 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 double dHashesPerSec = 0.0;
 int64_t nHPSTimerStart = 0;
 
-CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake)
+CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake, const CStakeKernel* pStakeKernel)
 {
     CPubKey pubkey;
     if (!reservekey.GetReservedKey(pubkey))
         return NULL;
 
     CScript scriptPubKey = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
-    return CreateNewBlock(scriptPubKey, pwallet, fProofOfStake);
+    return CreateNewBlock(scriptPubKey, pwallet, fProofOfStake, pStakeKernel);
 }
 
 bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
@@ -630,7 +570,19 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
         if (!pindexPrev)
             continue;
 
-        unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, fProofOfStake));
+        // Proof-of-stake: search for a kernel first, the block template is
+        // only worth building around one that was found
+        CStakeKernel kernel;
+        if (fProofOfStake) {
+            if (!SearchStakeKernelForTip(pwallet, pindexPrev, kernel))
+                continue;
+            if (chainActive.Tip() != pindexPrev) {
+                LogPrintf("BitcoinMiner(): new block during the kernel search, searching again\n");
+                continue;
+            }
+        }
+
+        unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, fProofOfStake, fProofOfStake ? &kernel : NULL));
         if (!pblocktemplate.get())
             continue;
 
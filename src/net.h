@@ -21,6 +21,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -30,7 +31,9 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 class CAddrMan;
 class CBlockIndex;
@@ -82,6 +85,18 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
+/**
+ * A complete network message, header included. Broadcasts serialize their
+ * message once and hand the same buffer to the send queue of every peer.
+ */
+typedef boost::shared_ptr<const CSerializeData> CSerializeDataRef;
+
+/**
+ * Build a shareable network message from a serialized payload. Only for
+ * payloads whose encoding doesn't depend on the receiving peer.
+ */
+CSerializeDataRef MakeNetMessage(const char* pszCommand, const CDataStream& ssPayload);
+
 typedef int NodeId;
 
 // Signals for message handling
@@ -129,10 +144,14 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+/** Use epoll rather than select() in the socket handler where it is available (-socketevents) */
+extern bool fSocketEventsEpoll;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+/** Wakes the message handler when a peer has work again */
+extern boost::condition_variable messageHandlerCondition;
+extern std::map<CInv, CSerializeDataRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -288,12 +307,13 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializeDataRef> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    std::atomic<size_t> nWorkerQueueSize; // bytes of this peer's messages waiting for the message workers
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -322,6 +342,8 @@ public:
     // b) the peer may tell us in their version message that we should not relay tx invs
     //    until they have initialized their bloom filter.
     bool fRelayTxes;
+    // Whether the peer asked with sendcmpct to be sent new blocks as compact blocks instead of an inv
+    std::atomic<bool> fPreferCompactBlocks;
     // Should be 'true' only if we connected to this node to actually mix funds.
     // In this case node will be released automatically via CMasternodeMan::ProcessMasternodeConnections().
     // Connecting to verify connectability/status or connecting for sending/relaying single message
@@ -342,6 +364,7 @@ protected:
     static bool setBannedIsDirty;
 
     std::vector<std::string> vecRequestsFulfilled; //keep track of what client has asked for
+    CCriticalSection cs_vecRequestsFulfilled;
 
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
@@ -358,6 +381,7 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     mruset<CAddress> setAddrKnown;
+    CCriticalSection cs_addrKnown; // guards vAddrToSend and setAddrKnown, which the addr worker shares
     bool fGetAddr;
     std::set<uint256> setKnown;
 
@@ -391,6 +415,9 @@ private:
     CNode(const CNode&);
     void operator=(const CNode&);
 
+    /** Append a finished message to vSendMsg. Requires cs_vSend. */
+    void QueueMessage(const CSerializeDataRef& msg);
+
 public:
     NodeId GetId() const
     {
@@ -437,6 +464,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_addrKnown);
         setAddrKnown.insert(addr);
     }
 
@@ -445,6 +473,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrKnown);
         if (addr.IsValid() && !setAddrKnown.count(addr)) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -455,12 +484,11 @@ public:
     }
 
 
-    void AddInventoryKnown(const CInv& inv)
+    // Returns false if the peer knew inv already
+    bool AddInventoryKnown(const CInv& inv)
     {
-        {
-            LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
-        }
+        LOCK(cs_inventory);
+        return setInventoryKnown.insert(inv).second;
     }
 
     void PushInventory(const CInv& inv)
@@ -485,6 +513,9 @@ public:
 
     void PushVersion();
 
+    /** Queue a message built by MakeNetMessage(), without copying it */
+    void PushMessage(const CSerializeDataRef& msg);
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -655,6 +686,7 @@ public:
 
     bool HasFulfilledRequest(std::string strRequest)
     {
+        LOCK(cs_vecRequestsFulfilled);
         BOOST_FOREACH (std::string& type, vecRequestsFulfilled) {
             if (type == strRequest) return true;
         }
@@ -663,6 +695,7 @@ public:
 
     void ClearFulfilledRequest(std::string strRequest)
     {
+        LOCK(cs_vecRequestsFulfilled);
         std::vector<std::string>::iterator it = vecRequestsFulfilled.begin();
         while (it != vecRequestsFulfilled.end()) {
             if ((*it) == strRequest) {
@@ -675,6 +708,7 @@ public:
 
     void FulfilledRequest(std::string strRequest)
     {
+        LOCK(cs_vecRequestsFulfilled);
         if (HasFulfilledRequest(strRequest)) return;
         vecRequestsFulfilled.push_back(strRequest);
     }
@@ -15,12 +15,117 @@
 #include "util.h"
 #include "crypto/neoscrypt.h"
 
+#include <string.h>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace {
+
+//! Guards the remembered hash of headers, striped by header address
+boost::mutex csHeaderHash[16];
+
+boost::mutex& HeaderHashMutex(const CBlockHeader* pheader)
+{
+    return csHeaderHash[((uintptr_t)pheader / sizeof(void*)) % 16];
+}
+
+}
+
+CBlockHeader::CBlockHeader(const CBlockHeader& other)
+{
+    fHashCached = false;
+    *this = other;
+}
+
+CBlockHeader& CBlockHeader::operator=(const CBlockHeader& other)
+{
+    if (this == &other)
+        return *this;
+
+    nVersion = other.nVersion;
+    hashPrevBlock = other.hashPrevBlock;
+    hashMerkleRoot = other.hashMerkleRoot;
+    nTime = other.nTime;
+    nBits = other.nBits;
+    nNonce = other.nNonce;
+    nAccumulatorCheckpoint = other.nAccumulatorCheckpoint;
+
+    // Take the other header's hash along, locking one header at a time
+    bool fCached;
+    unsigned char vchBytes[HASHED_SIZE];
+    uint256 hash;
+    {
+        boost::lock_guard<boost::mutex> lock(HeaderHashMutex(&other));
+        fCached = other.fHashCached;
+        if (fCached) {
+            memcpy(vchBytes, other.vchHashedBytes, HASHED_SIZE);
+            hash = other.hashCached;
+        }
+    }
+    boost::lock_guard<boost::mutex> lock(HeaderHashMutex(this));
+    fHashCached = fCached;
+    if (fCached) {
+        memcpy(vchHashedBytes, vchBytes, HASHED_SIZE);
+        hashCached = hash;
+    }
+    return *this;
+}
+
 uint256 CBlockHeader::GetHash() const
-{       
-      uint256 thash;
-      unsigned int profile = 0x0;
-      neoscrypt((unsigned char *) &nVersion, (unsigned char *) &thash, profile);
-      return thash;	 
+{
+    {
+        boost::lock_guard<boost::mutex> lock(HeaderHashMutex(this));
+        if (fHashCached && memcmp(vchHashedBytes, &nVersion, HASHED_SIZE) == 0)
+            return hashCached;
+    }
+
+    unsigned char vchBytes[HASHED_SIZE];
+    memcpy(vchBytes, &nVersion, HASHED_SIZE);
+
+    uint256 thash;
+    unsigned int profile = 0x0;
+    neoscrypt(vchBytes, (unsigned char *) &thash, profile);
+
+    boost::lock_guard<boost::mutex> lock(HeaderHashMutex(this));
+    memcpy(vchHashedBytes, vchBytes, HASHED_SIZE);
+    hashCached = thash;
+    fHashCached = true;
+    return thash;
+}
+
+void CBlockHeader::CacheHashes(const std::vector<const CBlockHeader*>& vHeaders)
+{
+    std::vector<const CBlockHeader*> vMissing;
+    std::vector<unsigned char> vchBytes;
+    for (const CBlockHeader* pheader : vHeaders) {
+        boost::lock_guard<boost::mutex> lock(HeaderHashMutex(pheader));
+        if (pheader->fHashCached && memcmp(pheader->vchHashedBytes, &pheader->nVersion, HASHED_SIZE) == 0)
+            continue;
+        vMissing.push_back(pheader);
+    }
+    if (vMissing.empty())
+        return;
+
+    vchBytes.resize(vMissing.size() * HASHED_SIZE);
+    std::vector<uint256> vHashes(vMissing.size());
+    std::vector<const unsigned char*> vInputs(vMissing.size());
+    std::vector<unsigned char*> vOutputs(vMissing.size());
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        memcpy(&vchBytes[i * HASHED_SIZE], &vMissing[i]->nVersion, HASHED_SIZE);
+        vInputs[i] = &vchBytes[i * HASHED_SIZE];
+        vOutputs[i] = (unsigned char*)&vHashes[i];
+    }
+
+    neoscrypt_batch(&vInputs[0], &vOutputs[0], vMissing.size(), 0x0);
+
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        const CBlockHeader* pheader = vMissing[i];
+        boost::lock_guard<boost::mutex> lock(HeaderHashMutex(pheader));
+        memcpy(pheader->vchHashedBytes, &vchBytes[i * HASHED_SIZE], HASHED_SIZE);
+        pheader->hashCached = vHashes[i];
+        pheader->fHashCached = true;
+    }
 }
 
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
@@ -37,11 +37,17 @@ public:
     uint32_t nNonce;
     uint256 nAccumulatorCheckpoint;
 
+    //! Number of header bytes, starting at nVersion, that the proof-of-work hash covers
+    static const size_t HASHED_SIZE = 80;
+
     CBlockHeader()
     {
         SetNull();
     }
 
+    CBlockHeader(const CBlockHeader& other);
+    CBlockHeader& operator=(const CBlockHeader& other);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -68,6 +74,7 @@ public:
         nBits = 0;
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -75,12 +82,26 @@ public:
         return (nBits == 0);
     }
 
+    /**
+     * The neoscrypt hash of the header. It is remembered together with the
+     * bytes it was computed from, so repeated calls on an unchanged header
+     * only cost a comparison and writes to the fields are always picked up.
+     */
     uint256 GetHash() const;
 
+    /** Hash several headers at once with neoscrypt_batch, so later GetHash() calls on them are free */
+    static void CacheHashes(const std::vector<const CBlockHeader*>& vHeaders);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
+
+private:
+    // memory only
+    mutable bool fHashCached;
+    mutable unsigned char vchHashedBytes[HASHED_SIZE];
+    mutable uint256 hashCached;
 };
 
 
@@ -97,6 +118,14 @@ public:
     mutable CScript payee;
     mutable std::vector<uint256> vMerkleTree;
 
+    // memory only, set by PreCheckBlock once these context free checks have
+    // passed so that CheckBlock and ProcessNewBlock do not repeat them. Only
+    // valid as long as the block is not modified afterwards, so copies start
+    // out unchecked.
+    mutable bool fMerkleRootChecked;
+    mutable bool fSignatureChecked;
+    mutable bool fTransactionsChecked;
+
     CBlock()
     {
         SetNull();
@@ -108,6 +137,22 @@ public:
         *((CBlockHeader*)this) = header;
     }
 
+    CBlock(const CBlock& block) : CBlockHeader(block), vtx(block.vtx), vchBlockSig(block.vchBlockSig), payee(block.payee), vMerkleTree(block.vMerkleTree)
+    {
+        ResetChecked();
+    }
+
+    CBlock& operator=(const CBlock& block)
+    {
+        *((CBlockHeader*)this) = block;
+        vtx = block.vtx;
+        vchBlockSig = block.vchBlockSig;
+        payee = block.payee;
+        vMerkleTree = block.vMerkleTree;
+        ResetChecked();
+        return *this;
+    }
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -125,19 +170,20 @@ public:
         vMerkleTree.clear();
         payee = CScript();
         vchBlockSig.clear();
+        ResetChecked();
+    }
+
+    void ResetChecked() const
+    {
+        fMerkleRootChecked = false;
+        fSignatureChecked = false;
+        fTransactionsChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nAccumulatorCheckpoint = nAccumulatorCheckpoint;
-        return block;
+        // Copying the header keeps a hash that has already been computed
+        return *this;
     }
 
     // ppcoin: two types of block: proof-of-work or proof-of-stake
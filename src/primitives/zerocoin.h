@@ -173,6 +173,68 @@ public:
     };
 };
 
+class CZerocoinWitness
+{
+private:
+    CBigNum pubCoin;
+    CBigNum witnessValue;
+    int nHeightAccStart; //first block whose mints are in the witness
+    int nHeightAccEnd; //the witness holds the mints of blocks below this height
+    uint256 hashBlockAccEnd; //hash of the last block added, used to detect reorgs
+    int nMintsAdded;
+
+public:
+    CZerocoinWitness()
+    {
+        SetNull();
+    }
+
+    CZerocoinWitness(CBigNum pubCoin)
+    {
+        SetNull();
+        this->pubCoin = pubCoin;
+    }
+
+    void SetNull()
+    {
+        pubCoin = 0;
+        witnessValue = 0;
+        nHeightAccStart = 0;
+        nHeightAccEnd = 0;
+        hashBlockAccEnd = 0;
+        nMintsAdded = 0;
+    }
+
+    bool IsNull() const { return nHeightAccEnd == 0; }
+    CBigNum GetPubCoin() const { return pubCoin; }
+    CBigNum GetWitnessValue() const { return witnessValue; }
+    int GetHeightAccStart() const { return nHeightAccStart; }
+    int GetHeightAccEnd() const { return nHeightAccEnd; }
+    uint256 GetBlockHashAccEnd() const { return hashBlockAccEnd; }
+    int GetMintsAdded() const { return nMintsAdded; }
+
+    void Update(const CBigNum& witnessValue, int nHeightAccStart, int nHeightAccEnd, const uint256& hashBlockAccEnd, int nMintsAdded)
+    {
+        this->witnessValue = witnessValue;
+        this->nHeightAccStart = nHeightAccStart;
+        this->nHeightAccEnd = nHeightAccEnd;
+        this->hashBlockAccEnd = hashBlockAccEnd;
+        this->nMintsAdded = nMintsAdded;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(pubCoin);
+        READWRITE(witnessValue);
+        READWRITE(nHeightAccStart);
+        READWRITE(nHeightAccEnd);
+        READWRITE(hashBlockAccEnd);
+        READWRITE(nMintsAdded);
+    };
+};
+
 class CZerocoinSpendReceipt
 {
 private:
@@ -7,6 +7,7 @@
 
 #include "rpc/server.h"
 
+#include "blockcache.h"
 #include "clientversion.h"
 #include "main.h"
 #include "net.h"
@@ -342,7 +343,15 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"blockcache\": {        (json object) Cache of blocks served to peers\n"
+            "    \"entries\": n,        (numeric) Blocks in the cache\n"
+            "    \"bytes\": n,          (numeric) Size of the cached blocks\n"
+            "    \"hits\": n,           (numeric) Block requests served from the cache\n"
+            "    \"misses\": n,         (numeric) Block requests read from disk\n"
+            "    \"hitrate\": x.xxx,    (numeric) Fraction of block requests served from the cache\n"
+            "    \"bytesserved\": n     (numeric) Total bytes of blocks served from the cache\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getnettotals", "") + HelpExampleRpc("getnettotals", ""));
@@ -351,6 +360,17 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    CBlockCacheStats stats = GetBlockCacheStats();
+    UniValue blockcache(UniValue::VOBJ);
+    blockcache.push_back(Pair("entries", (uint64_t)stats.nEntries));
+    blockcache.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    blockcache.push_back(Pair("hits", stats.nHits));
+    blockcache.push_back(Pair("misses", stats.nMisses));
+    uint64_t nRequests = stats.nHits + stats.nMisses;
+    blockcache.push_back(Pair("hitrate", nRequests ? (double)stats.nHits / nRequests : 0.0));
+    blockcache.push_back(Pair("bytesserved", stats.nBytesServed));
+    obj.push_back(Pair("blockcache", blockcache));
     return obj;
 }
 
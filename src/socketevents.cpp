@@ -0,0 +1,106 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/snodecoin-config.h"
+#endif
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace {
+//! Most events taken from the kernel in one Wait()
+const int MAX_EPOLL_EVENTS = 256;
+}
+
+CSocketEventsEpoll::CSocketEventsEpoll()
+{
+    hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpoll == -1)
+        LogPrintf("%s : epoll_create1 failed: %s\n", __func__, NetworkErrorString(errno));
+}
+
+CSocketEventsEpoll::~CSocketEventsEpoll()
+{
+    if (hEpoll != -1)
+        close(hEpoll);
+}
+
+bool CSocketEventsEpoll::IsSupported()
+{
+    return true;
+}
+
+bool CSocketEventsEpoll::AddSocket(SOCKET hSocket, void* pData, bool fEdgeTriggered)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    if (fEdgeTriggered)
+        event.events |= EPOLLET;
+    event.data.ptr = pData;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hSocket, &event) == -1) {
+        LogPrintf("%s : epoll_ctl failed: %s\n", __func__, NetworkErrorString(errno));
+        return false;
+    }
+    return true;
+}
+
+bool CSocketEventsEpoll::RemoveSocket(SOCKET hSocket)
+{
+    // Kernels before 2.6.9 want an event even though it is ignored
+    struct epoll_event event;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_DEL, hSocket, &event) == -1) {
+        LogPrintf("%s : epoll_ctl failed: %s\n", __func__, NetworkErrorString(errno));
+        return false;
+    }
+    return true;
+}
+
+bool CSocketEventsEpoll::Wait(int nTimeoutMs, std::vector<Event>& vEvents)
+{
+    vEvents.clear();
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, nTimeoutMs);
+    if (nEvents == -1)
+        return errno == EINTR;
+
+    vEvents.reserve(nEvents);
+    for (int i = 0; i < nEvents; i++) {
+        Event event;
+        event.pData = events[i].data.ptr;
+        event.fRecv = (events[i].events & (EPOLLIN | EPOLLRDHUP)) != 0;
+        event.fSend = (events[i].events & EPOLLOUT) != 0;
+        event.fError = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+        vEvents.push_back(event);
+    }
+    return true;
+}
+
+#else
+
+CSocketEventsEpoll::CSocketEventsEpoll() : hEpoll(-1) {}
+CSocketEventsEpoll::~CSocketEventsEpoll() {}
+bool CSocketEventsEpoll::IsSupported() { return false; }
+bool CSocketEventsEpoll::AddSocket(SOCKET hSocket, void* pData, bool fEdgeTriggered) { return false; }
+bool CSocketEventsEpoll::RemoveSocket(SOCKET hSocket) { return false; }
+bool CSocketEventsEpoll::Wait(int nTimeoutMs, std::vector<Event>& vEvents)
+{
+    vEvents.clear();
+    return false;
+}
+
+#endif // HAVE_SYS_EPOLL_H
+
+bool CSocketEventsEpoll::IsValid() const
+{
+    return hEpoll != -1;
+}
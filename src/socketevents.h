@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_SOCKETEVENTS_H
+#define SNODECOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+/** -socketevents default */
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+
+/**
+ * Readiness notifications for a set of sockets through epoll, so that the
+ * socket handler only hears about peers that can make progress instead of
+ * scanning every connection with select() on each wakeup.
+ *
+ * Sockets are registered once, with an opaque pointer that comes back with
+ * their events, and must be removed before they are closed. Edge-triggered
+ * sockets only report a state change once: the caller has to keep reading
+ * or sending until the call would block before it can expect another event.
+ *
+ * On platforms without epoll the object is never valid and callers keep
+ * using select().
+ */
+class CSocketEventsEpoll : private boost::noncopyable
+{
+public:
+    struct Event {
+        void* pData;
+        bool fRecv;  //! Readable, or the peer closed its end
+        bool fSend;  //! Writable
+        bool fError; //! Error or hang-up; the next recv() reports it
+    };
+
+    CSocketEventsEpoll();
+    ~CSocketEventsEpoll();
+
+    /** Whether this build supports epoll at all */
+    static bool IsSupported();
+
+    /** Whether the epoll instance was created */
+    bool IsValid() const;
+
+    /** Watch hSocket for receive and send readiness */
+    bool AddSocket(SOCKET hSocket, void* pData, bool fEdgeTriggered = true);
+    bool RemoveSocket(SOCKET hSocket);
+
+    /**
+     * Wait up to nTimeoutMs milliseconds for events, replacing the contents
+     * of vEvents. Returns false on error; an interrupted wait is not one.
+     */
+    bool Wait(int nTimeoutMs, std::vector<Event>& vEvents);
+
+private:
+    int hEpoll;
+};
+
+#endif // SNODECOIN_SOCKETEVENTS_H
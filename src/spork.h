@@ -66,6 +66,7 @@ class CSporkManager;
 
 extern std::map<uint256, CSporkMessage> mapSporks;
 extern std::map<int, CSporkMessage> mapSporksActive;
+extern CCriticalSection cs_mapSporks; // guards mapSporks and mapSporksActive, which the spork message worker updates
 extern CSporkManager sporkManager;
 
 void LoadSporksFromDB();
@@ -116,4 +116,40 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+
+    // Small blocks come out of one chunk, and freed ones are handed out again
+    void* a = resource.Allocate(24, 8);
+    void* b = resource.Allocate(20, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 24);
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 24U);
+    BOOST_CHECK(resource.Allocate(24, 8) == a);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 0U);
+
+    // Big blocks bypass the pool
+    void* big = resource.Allocate(65, 8);
+    resource.Deallocate(big, 65, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 0U);
+
+    // A full chunk leaves its rest on a free list
+    for (int i = 0; i < 1024 / 64; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 1024U - 48 - 15 * 64);
+
+    // Containers share the resource through their allocator
+    typedef PoolAllocator<std::pair<const int, int>, 64, 8> MapAllocator;
+    MapAllocator alloc(&resource);
+    std::map<int, int, std::less<int>, MapAllocator> mapPooled(std::less<int>(), alloc);
+    for (int i = 0; i < 100; i++)
+        mapPooled[i] = i * i;
+    BOOST_CHECK(resource.NumAllocatedChunks() > 2U);
+    BOOST_CHECK_EQUAL(mapPooled[9], 81);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -34,6 +34,7 @@ using namespace libzerocoin;
 #define COLOR_STR_RED     "\033[31m"
 
 #define TESTS_COINS_TO_ACCUMULATE   50
+#define TESTS_SPEND_VERIFY_ROUNDS   10
 
 // Global test counters
 uint32_t    ggNumTests        = 0;
@@ -122,6 +123,20 @@ gGetTestModulus()
 	return testModulus;
 }
 
+double
+gSpendVerifyRate(const CoinSpend& spend, const Accumulator& acc)
+{
+	timer.start();
+	for (uint32_t i = 0; i < TESTS_SPEND_VERIFY_ROUNDS; i++) {
+		if (!spend.Verify(acc)) {
+			return 0;
+		}
+	}
+	timer.stop();
+
+	return TESTS_SPEND_VERIFY_ROUNDS * 1000.0 / max(timer.duration(), 1);
+}
+
 //////////
 // Test routines
 //////////
@@ -360,7 +375,25 @@ Testb_MintAndSpend()
 
 		cout << "\tSPEND VERIFY ELAPSED TIME: " << timer.duration() << " ms\t" << timer.duration()*0.001 << " s" << endl;
 
-		return ret;
+		// Compare verification throughput against a copy of the
+		// parameters without the fixed-base generator tables
+		ZerocoinParams plainParams(*gg_Params);
+		plainParams.coinCommitmentGroup.gTable.SetNull();
+		plainParams.coinCommitmentGroup.hTable.SetNull();
+		plainParams.serialNumberSoKCommitmentGroup.gTable.SetNull();
+		plainParams.serialNumberSoKCommitmentGroup.hTable.SetNull();
+		plainParams.accumulatorParams.accumulatorPoKCommitmentGroup.gTable.SetNull();
+		plainParams.accumulatorParams.accumulatorPoKCommitmentGroup.hTable.SetNull();
+
+		ss << spend;
+		CoinSpend plainSpend(&plainParams, ss);
+
+		double plainRate = gSpendVerifyRate(plainSpend, acc);
+		double tableRate = gSpendVerifyRate(newSpend, acc);
+
+		cout << "\tSPEND VERIFY RATE:\n\t\tWithout tables: " << plainRate << " verify/s\n\t\tWith tables: " << tableRate << " verify/s" << endl;
+
+		return ret && plainRate > 0 && tableRate > 0;
 	} catch (runtime_error &e) {
 		cout << e.what() << endl;
 		return false;
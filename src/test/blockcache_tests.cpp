@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "streams.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+namespace {
+CSerializeDataRef MakeMessage(size_t nPayloadSize)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload.write(std::vector<char>(nPayloadSize, 'b').data(), nPayloadSize);
+    return MakeNetMessage("block", ssPayload);
+}
+
+uint256 Hash(int n)
+{
+    uint256 hash;
+    *hash.begin() = n;
+    return hash;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(lru_eviction)
+{
+    CBlockMessageCache cache;
+    CSerializeDataRef msg1 = MakeMessage(1000);
+    CSerializeDataRef msg2 = MakeMessage(1000);
+    CSerializeDataRef msg3 = MakeMessage(1000);
+    const size_t nMaxBytes = msg1->size() * 2;
+
+    cache.Insert(Hash(1), msg1, nMaxBytes);
+    cache.Insert(Hash(2), msg2, nMaxBytes);
+    BOOST_CHECK_EQUAL(cache.GetStats().nBytes, nMaxBytes);
+
+    // Using the first block makes the second the one to go
+    CSerializeDataRef msg;
+    BOOST_CHECK(cache.Get(Hash(1), msg));
+    BOOST_CHECK(msg == msg1);
+    cache.Insert(Hash(3), msg3, nMaxBytes);
+    BOOST_CHECK(!cache.Get(Hash(2), msg));
+    BOOST_CHECK(cache.Get(Hash(1), msg) && msg == msg1);
+    BOOST_CHECK(cache.Get(Hash(3), msg) && msg == msg3);
+
+    CBlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nEntries, 2U);
+    BOOST_CHECK_EQUAL(stats.nBytes, nMaxBytes);
+    BOOST_CHECK_EQUAL(stats.nHits, 3U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 1U);
+    BOOST_CHECK_EQUAL(stats.nBytesServed, 3 * msg1->size());
+}
+
+BOOST_AUTO_TEST_CASE(oversized_message)
+{
+    CBlockMessageCache cache;
+    CSerializeDataRef msgSmall = MakeMessage(100);
+    CSerializeDataRef msgLarge = MakeMessage(10000);
+
+    // A block larger than the whole cache doesn't evict anything
+    cache.Insert(Hash(1), msgSmall, 1000);
+    cache.Insert(Hash(2), msgLarge, 1000);
+    CSerializeDataRef msg;
+    BOOST_CHECK(cache.Get(Hash(1), msg));
+    BOOST_CHECK(!cache.Get(Hash(2), msg));
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 1U);
+    BOOST_CHECK_EQUAL(cache.GetStats().nBytes, msgSmall->size());
+}
+
+BOOST_AUTO_TEST_CASE(read_block_from_message)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1500000000;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = 42;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CSerializeDataRef msg = MakeNetMessage("block", ss);
+
+    CBlock blockRead;
+    ReadBlockFromMessage(*msg, blockRead);
+    BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(blockRead.vtx.size(), 1U);
+    BOOST_CHECK(blockRead.vtx[0].GetHash() == block.vtx[0].GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
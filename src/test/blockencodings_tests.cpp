@@ -0,0 +1,213 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "main.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include <ios>
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+namespace {
+CTransaction MakeTransaction(int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = uint256(n + 1);
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 1000 + n;
+    return tx;
+}
+
+/** A block of a coinbase, optionally a coinstake, and nTx other transactions */
+CBlock BuildBlock(bool fProofOfStake, int nTx)
+{
+    CBlock block;
+    block.nTime = 1500000000;
+    block.nBits = 0x1e0ffff0;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << OP_11 << OP_11;
+    coinbase.vout.resize(1);
+    if (!fProofOfStake)
+        coinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(coinbase);
+
+    if (fProofOfStake) {
+        CMutableTransaction coinstake;
+        coinstake.vin.resize(1);
+        coinstake.vin[0].prevout.hash = uint256(12345);
+        coinstake.vin[0].prevout.n = 1;
+        coinstake.vout.resize(2);
+        coinstake.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        coinstake.vout[1].nValue = 100 * COIN;
+        block.vtx.push_back(coinstake);
+        block.vchBlockSig = std::vector<unsigned char>(72, 0x30);
+    }
+
+    for (int i = 0; i < nTx; i++)
+        block.vtx.push_back(MakeTransaction(i));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+CBlockHeaderAndShortTxIDs SendCompactBlock(const CBlock& block)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CBlockHeaderAndShortTxIDs(block);
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    ss >> cmpctblock;
+    BOOST_CHECK(ss.empty());
+    return cmpctblock;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(missing_transactions)
+{
+    CBlock block = BuildBlock(false, 3);
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1));
+    CTransaction txOther = MakeTransaction(100);
+    pool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs cmpctblock = SendCompactBlock(block);
+    BOOST_CHECK_EQUAL(cmpctblock.prefilledtxn.size(), 1U);
+    BOOST_CHECK_EQUAL(cmpctblock.shorttxids.size(), 3U);
+    BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+    BOOST_CHECK(!cmpctblock.IsProofOfStake());
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_REQUIRE(partialBlock.InitData(cmpctblock) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(partialBlock.IsTxAvailable(2));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(3));
+
+    // The getblocktxn round trip
+    BlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    partialBlock.GetMissing(req.indexes);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << req;
+    BlockTransactionsRequest req2;
+    ss >> req2;
+    BOOST_CHECK(req2.blockhash == req.blockhash);
+    BOOST_REQUIRE_EQUAL(req2.indexes.size(), 2U);
+    BOOST_CHECK_EQUAL(req2.indexes[0], 1);
+    BOOST_CHECK_EQUAL(req2.indexes[1], 3);
+
+    BlockTransactions resp(req2);
+    for (unsigned int i = 0; i < req2.indexes.size(); i++)
+        resp.txn[i] = block.vtx[req2.indexes[i]];
+    ss << resp;
+    BlockTransactions resp2;
+    ss >> resp2;
+
+    CBlock blockRebuilt;
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, resp2.txn) == READ_STATUS_OK);
+    BOOST_CHECK(blockRebuilt.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRebuilt.BuildMerkleTree() == block.hashMerkleRoot);
+}
+
+BOOST_AUTO_TEST_CASE(wrong_transactions)
+{
+    CBlock block = BuildBlock(false, 3);
+    CTxMemPool pool(CFeeRate(0));
+    CBlockHeaderAndShortTxIDs cmpctblock = SendCompactBlock(block);
+
+    // Transactions that don't add up to the merkle root only mean falling back to the full block
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_REQUIRE(partialBlock.InitData(cmpctblock) == READ_STATUS_OK);
+    std::vector<CTransaction> vtx(block.vtx.begin() + 1, block.vtx.end());
+    std::swap(vtx[0], vtx[1]);
+    CBlock blockRebuilt;
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, vtx) == READ_STATUS_FAILED);
+
+    // Too few transactions is bogus
+    PartiallyDownloadedBlock partialBlock2(&pool);
+    BOOST_REQUIRE(partialBlock2.InitData(cmpctblock) == READ_STATUS_OK);
+    vtx.pop_back();
+    BOOST_CHECK(partialBlock2.FillBlock(blockRebuilt, vtx) == READ_STATUS_INVALID);
+
+    // So is a prefilled transaction past the end of the block
+    cmpctblock.prefilledtxn[0].index = 10;
+    PartiallyDownloadedBlock partialBlock3(&pool);
+    BOOST_CHECK(partialBlock3.InitData(cmpctblock) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(too_many_transactions)
+{
+    CBlock block = BuildBlock(false, 0);
+    CTxMemPool pool(CFeeRate(0));
+    CBlockHeaderAndShortTxIDs cmpctblock = SendCompactBlock(block);
+    BOOST_REQUIRE_EQUAL(cmpctblock.prefilledtxn.size(), 1U);
+
+    // The last position that fits in 16 bits
+    for (uint64_t i = 0; i < std::numeric_limits<uint16_t>::max() - 1; i++)
+        cmpctblock.shorttxids.push_back(i);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(cmpctblock) == READ_STATUS_OK);
+    std::vector<uint16_t> vMissing;
+    partialBlock.GetMissing(vMissing);
+    BOOST_REQUIRE_EQUAL(vMissing.size(), cmpctblock.shorttxids.size());
+    BOOST_CHECK_EQUAL(vMissing.back(), std::numeric_limits<uint16_t>::max() - 1);
+
+    // One more would wrap around
+    cmpctblock.shorttxids.push_back(std::numeric_limits<uint16_t>::max());
+    PartiallyDownloadedBlock partialBlock2(&pool);
+    BOOST_CHECK(partialBlock2.InitData(cmpctblock) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(proof_of_stake_block)
+{
+    CBlock block = BuildBlock(true, 2);
+    BOOST_REQUIRE(block.IsProofOfStake());
+    CTxMemPool pool(CFeeRate(0));
+    for (unsigned int i = 2; i < block.vtx.size(); i++)
+        pool.addUnchecked(block.vtx[i].GetHash(), CTxMemPoolEntry(block.vtx[i], 0, 0, 0.0, 1));
+
+    // The coinbase and coinstake are sent along, and everything else is in the mempool
+    CBlockHeaderAndShortTxIDs cmpctblock = SendCompactBlock(block);
+    BOOST_REQUIRE_EQUAL(cmpctblock.prefilledtxn.size(), 2U);
+    BOOST_CHECK(cmpctblock.prefilledtxn[1].tx.IsCoinStake());
+    BOOST_CHECK(cmpctblock.IsProofOfStake());
+    BOOST_CHECK(cmpctblock.vchBlockSig == block.vchBlockSig);
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_REQUIRE(partialBlock.InitData(cmpctblock) == READ_STATUS_OK);
+    std::vector<uint16_t> vMissing;
+    partialBlock.GetMissing(vMissing);
+    BOOST_CHECK(vMissing.empty());
+
+    CBlock blockRebuilt;
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, std::vector<CTransaction>()) == READ_STATUS_OK);
+    BOOST_CHECK(blockRebuilt.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRebuilt.vchBlockSig == block.vchBlockSig);
+    BOOST_CHECK(blockRebuilt.IsProofOfStake());
+}
+
+BOOST_AUTO_TEST_CASE(getblocktxn_index_overflow)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << uint256(1);
+    WriteCompactSize(ss, 2);
+    WriteCompactSize(ss, 65535);
+    WriteCompactSize(ss, 0);
+
+    BlockTransactionsRequest req;
+    BOOST_CHECK_THROW(ss >> req, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
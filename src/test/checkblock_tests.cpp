@@ -66,4 +66,82 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(header_hash_cache)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nTime = 1528000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 12345;
+
+    uint256 hash = header.GetHash();
+    BOOST_CHECK(header.GetHash() == hash);
+
+    // Any write to the hashed fields must be picked up
+    header.nNonce++;
+    uint256 hashNonce = header.GetHash();
+    BOOST_CHECK(hashNonce != hash);
+    header.nNonce--;
+    BOOST_CHECK(header.GetHash() == hash);
+
+    // Copies hash the same, whether or not they carry the cached value
+    CBlockHeader copy(header);
+    BOOST_CHECK(copy.GetHash() == hash);
+    copy.nNonce++;
+    BOOST_CHECK(copy.GetHash() == hashNonce);
+    BOOST_CHECK(header.GetHash() == hash);
+
+    CBlock block(header);
+    BOOST_CHECK(block.GetHash() == hash);
+    BOOST_CHECK(block.GetBlockHeader().GetHash() == hash);
+
+    // Deserializing into a header that was already hashed
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << copy;
+    ss >> header;
+    BOOST_CHECK(header.GetHash() == hashNonce);
+}
+
+BOOST_AUTO_TEST_CASE(pre_check_block)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1528000000;
+    block.vtx.push_back(CTransaction(coinbase));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    PreCheckBlock(block);
+    BOOST_CHECK(block.fMerkleRootChecked);
+    BOOST_CHECK(block.fSignatureChecked);
+
+    CBlock cleared(block);
+    cleared.SetNull();
+    BOOST_CHECK(!cleared.fMerkleRootChecked && !cleared.fSignatureChecked && !cleared.fTransactionsChecked);
+
+    // Nothing that fails is remembered
+    CBlock badRoot(block);
+    badRoot.fMerkleRootChecked = badRoot.fSignatureChecked = badRoot.fTransactionsChecked = false;
+    badRoot.hashMerkleRoot = uint256(1);
+    PreCheckBlock(badRoot);
+    BOOST_CHECK(!badRoot.fMerkleRootChecked);
+    BOOST_CHECK(badRoot.fSignatureChecked);
+
+    CBlock badTx(block);
+    badTx.fMerkleRootChecked = badTx.fSignatureChecked = badTx.fTransactionsChecked = false;
+    coinbase.vout[0].nValue = -1;
+    badTx.vtx[0] = CTransaction(coinbase);
+    badTx.hashMerkleRoot = badTx.BuildMerkleTree();
+    PreCheckBlock(badTx);
+    BOOST_CHECK(badTx.fMerkleRootChecked);
+    BOOST_CHECK(!badTx.fTransactionsChecked);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,8 +4,11 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/script.h"
+#include "txdb.h"
 #include "uint256.h"
 
+#include <limits>
 #include <vector>
 #include <map>
 
@@ -41,7 +44,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             map_[it->first] = it->second.coins;
@@ -49,15 +52,45 @@ public:
                 // Randomly delete empty entries on write.
                 map_.erase(it->first);
             }
-            mapCoins.erase(it++);
+            if (fErase)
+                mapCoins.erase(it++);
+            else
+                it++;
         }
-        mapCoins.clear();
+        if (fErase)
+            mapCoins.clear();
         hashBestBlock_ = hashBlock;
         return true;
     }
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    //! Store a transaction the way the database did before Upgrade
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+    }
+};
+
+CCoins RandomCoins(unsigned int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = insecure_rand() % 100000;
+    coins.fCoinStake = true;
+    coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = insecure_rand();
+        coins.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return coins;
+}
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -83,6 +116,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
@@ -123,6 +157,13 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
         }
 
+        // Sometimes write the tip through to its base, keeping its entries
+        // or dropping all it can.
+        if (insecure_rand() % 200 == 0) {
+            BOOST_CHECK(stack.back()->Sync(insecure_rand() % 2 ? std::numeric_limits<size_t>::max() : 0));
+            synced_a_cache = true;
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
             for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
@@ -173,6 +214,127 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(synced_a_cache);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_memory_usage_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    const size_t nEmptyUsage = cache.DynamicMemoryUsage();
+
+    // Entries count with their scripts
+    std::vector<uint256> txids;
+    for (unsigned int i = 0; i < 1000; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier entry = cache.ModifyCoins(txids.back());
+        entry->nVersion = 1;
+        entry->vout.resize(1);
+        entry->vout[0].nValue = 1;
+        entry->vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(100, 0);
+    }
+    size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > nEmptyUsage + 1000 * 100);
+
+    // Modifications are accounted for as they happen
+    {
+        CCoinsModifier entry = cache.ModifyCoins(txids[0]);
+        entry->vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(1000, 0);
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nUsage);
+    nUsage = cache.DynamicMemoryUsage();
+    {
+        // A fresh entry that gets spent is gone entirely
+        CCoinsModifier entry = cache.ModifyCoins(txids[1]);
+        entry->Clear();
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nUsage);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 999U);
+
+    // Writing the entries through keeps them
+    nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 999U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+
+    // ... and a modified entry survives a sync that drops the clean ones
+    {
+        CCoinsModifier entry = cache.ModifyCoins(txids[2]);
+        entry->vout[0].nValue = 2;
+    }
+    BOOST_CHECK(cache.Sync(0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nUsage);
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txids[2])->vout[0].nValue, 2);
+    BOOST_CHECK(cache.HaveCoins(txids[3]));
+
+    // A full flush gives all the memory back
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nEmptyUsage);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output_test)
+{
+    CCoinsViewDBTest db;
+
+    // Transactions stored whole are split into outputs
+    uint256 txidLegacy = GetRandHash();
+    CCoins coinsLegacy = RandomCoins(300);
+    coinsLegacy.vout[1].SetNull();
+    db.WriteLegacyCoins(txidLegacy, coinsLegacy);
+    BOOST_CHECK(db.Upgrade());
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txidLegacy, coins));
+    BOOST_CHECK(coins == coinsLegacy);
+    BOOST_CHECK(db.Upgrade());
+
+    // Spending outputs leaves the others in place
+    uint256 txid = GetRandHash();
+    CCoins coinsExpected = RandomCoins(20);
+    {
+        CCoinsViewCache cache(&db);
+        *cache.ModifyCoins(txid) = coinsExpected;
+        BOOST_CHECK(cache.Flush());
+    }
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier entry = cache.ModifyCoins(txid);
+            BOOST_CHECK(*entry == coinsExpected);
+            entry->Spend(0);
+            entry->Spend(19);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    coinsExpected.vout[0].SetNull();
+    coinsExpected.vout[19].SetNull();
+    coinsExpected.Cleanup();
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+    BOOST_CHECK(db.GetCoins(txidLegacy, coins));
+    BOOST_CHECK(coins == coinsLegacy);
+
+    // A transaction coming back at another height is written again
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        coinsExpected.nHeight++;
+        *cache.ModifyCoins(txid) = coinsExpected;
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK_EQUAL(coins.nHeight, coinsExpected.nHeight);
+
+    // Spending everything removes the transaction
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(!db.GetCoins(txid, coins));
+    BOOST_CHECK(db.HaveCoins(txidLegacy));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
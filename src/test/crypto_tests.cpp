@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/neoscrypt.h"
 #include "crypto/rfc6979_hmac_sha256.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
@@ -10,8 +11,12 @@
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
 #include "random.h"
+#include "tinyformat.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 
+#include <algorithm>
+#include <string.h>
 #include <vector>
 
 #include <boost/assign/list_of.hpp>
@@ -282,4 +287,58 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+static void NeoscryptBatchInputs(unsigned int nCount, std::vector<unsigned char>& vIn, std::vector<unsigned char>& vOut,
+                                 std::vector<const unsigned char*>& vInputs, std::vector<unsigned char*>& vOutputs)
+{
+    vIn.resize(nCount * 80);
+    vOut.assign(nCount * 32, 0);
+    vInputs.resize(nCount);
+    vOutputs.resize(nCount);
+    for (unsigned int i = 0; i < nCount; i++) {
+        for (unsigned int j = 0; j < 80; j++)
+            vIn[i * 80 + j] = insecure_rand();
+        vInputs[i] = &vIn[i * 80];
+        vOutputs[i] = &vOut[i * 32];
+    }
+}
+
+BOOST_AUTO_TEST_CASE(neoscrypt_batch_matches_scalar)
+{
+    // Every batch size exercises full, padded and single-lane passes
+    for (unsigned int nCount = 0; nCount <= 2 * neoscrypt_batch_lanes() + 1; nCount++) {
+        std::vector<unsigned char> vIn, vOut;
+        std::vector<const unsigned char*> vInputs;
+        std::vector<unsigned char*> vOutputs;
+        NeoscryptBatchInputs(nCount, vIn, vOut, vInputs, vOutputs);
+
+        neoscrypt_batch(nCount ? &vInputs[0] : NULL, nCount ? &vOutputs[0] : NULL, nCount, 0x0);
+        for (unsigned int i = 0; i < nCount; i++) {
+            unsigned char hash[32];
+            neoscrypt(vInputs[i], hash, 0x0);
+            BOOST_CHECK(memcmp(hash, vOutputs[i], 32) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(neoscrypt_batch_throughput)
+{
+    const unsigned int nCount = 64;
+    std::vector<unsigned char> vIn, vOut;
+    std::vector<const unsigned char*> vInputs;
+    std::vector<unsigned char*> vOutputs;
+    NeoscryptBatchInputs(nCount, vIn, vOut, vInputs, vOutputs);
+
+    int64_t nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nCount; i++)
+        neoscrypt(vInputs[i], vOutputs[i], 0x0);
+    int64_t nScalar = std::max(GetTimeMicros() - nStart, (int64_t)1);
+
+    nStart = GetTimeMicros();
+    neoscrypt_batch(&vInputs[0], &vOutputs[0], nCount, 0x0);
+    int64_t nBatch = std::max(GetTimeMicros() - nStart, (int64_t)1);
+
+    BOOST_TEST_MESSAGE(strprintf("neoscrypt: %d hashes/s scalar, %d hashes/s batched %u wide",
+        nCount * 1000000LL / nScalar, nCount * 1000000LL / nBatch, neoscrypt_batch_lanes()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
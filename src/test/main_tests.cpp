@@ -6,6 +6,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "kernel.h"
 #include "main.h"
 
 #include <boost/test/unit_test.hpp>
@@ -49,4 +50,52 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(stake_kernel_search)
+{
+    CStakeKernelCandidate candidate;
+    candidate.prevout = COutPoint(uint256(7), 1);
+    candidate.nValue = 1000 * COIN;
+    candidate.nTimeBlockFrom = 1528000000;
+    candidate.nStakeModifier = 0x0123456789abcdefULL;
+    unsigned int nTimeTx = candidate.nTimeBlockFrom + nStakeMinAge + 1000;
+    unsigned int nBits = 0x1e00ffff;
+
+    // The first candidate is too young to stake
+    std::vector<CStakeKernelCandidate> vCandidates(2, candidate);
+    vCandidates[0].nTimeBlockFrom = nTimeTx - 10;
+
+    size_t nFound;
+    unsigned int nTimeTxFound;
+    uint256 hashProofOfStake;
+    BOOST_CHECK(FindStakeKernel(nBits, vCandidates, 0, nTimeTx, 45, nFound, nTimeTxFound, hashProofOfStake));
+    BOOST_CHECK_EQUAL(nFound, 1U);
+    BOOST_CHECK(nTimeTxFound > nTimeTx && nTimeTxFound <= nTimeTx + 45);
+
+    // Same hash and target as checking a single kernel
+    CDataStream ss(SER_GETHASH, 0);
+    ss << candidate.nStakeModifier;
+    BOOST_CHECK(hashProofOfStake == stakeHash(nTimeTxFound, ss, candidate.prevout.n, candidate.prevout.hash, candidate.nTimeBlockFrom));
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    BOOST_CHECK(stakeTargetHit(hashProofOfStake, candidate.nValue, bnTargetPerCoinDay));
+
+    BOOST_CHECK(!FindStakeKernel(nBits, vCandidates, 2, nTimeTx, 45, nFound, nTimeTxFound, hashProofOfStake));
+
+    // Searching on several threads finds the same first kernel
+    std::vector<CStakeKernelCandidate> vMany(1000, candidate);
+    for (unsigned int i = 0; i < vMany.size(); i++)
+        vMany[i].prevout.n = i;
+    nBits = 0x1c00ffff;
+    BOOST_CHECK(FindStakeKernel(nBits, vMany, 0, nTimeTx, 45, nFound, nTimeTxFound, hashProofOfStake, 1));
+    for (int nThreads = 2; nThreads <= 4; nThreads++) {
+        size_t nFoundThreads;
+        unsigned int nTimeTxFoundThreads;
+        uint256 hashThreads;
+        BOOST_CHECK(FindStakeKernel(nBits, vMany, 0, nTimeTx, 45, nFoundThreads, nTimeTxFoundThreads, hashThreads, nThreads));
+        BOOST_CHECK_EQUAL(nFoundThreads, nFound);
+        BOOST_CHECK_EQUAL(nTimeTxFoundThreads, nTimeTxFound);
+        BOOST_CHECK(hashThreads == hashProofOfStake);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
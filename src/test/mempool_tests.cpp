@@ -3,11 +3,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "miner.h"
 #include "txmempool.h"
 #include "util.h"
 
 #include <boost/test/unit_test.hpp>
 #include <list>
+#include <set>
 
 BOOST_AUTO_TEST_SUITE(mempool_tests)
 
@@ -99,4 +101,327 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSelectionIndexTest)
+{
+    // Parent with two children, added out of order as after a reorg
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    uint256 hashParent = txParent.GetHash();
+    uint256 hashChild0 = txChild[0].GetHash();
+    uint256 hashChild1 = txChild[1].GetHash();
+
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.setSanityCheck(true);
+    testPool.addUnchecked(hashChild0, CTxMemPoolEntry(txChild[0], 2000, 0, 10.0, 1));
+    testPool.addUnchecked(hashParent, CTxMemPoolEntry(txParent, 1000, 0, 30.0, 1));
+    testPool.addUnchecked(hashChild1, CTxMemPoolEntry(txChild[1], 3000, 0, 20.0, 1));
+
+    BOOST_CHECK(testPool.mapLinks[hashParent].setParents.empty());
+    BOOST_CHECK_EQUAL(testPool.mapLinks[hashParent].setChildren.size(), 2);
+    BOOST_CHECK(testPool.mapLinks[hashChild0].setParents.count(hashParent));
+    BOOST_CHECK(testPool.mapLinks[hashChild1].setParents.count(hashParent));
+
+    // Highest fee rate and priority last
+    BOOST_CHECK(testPool.mapTx.get<fee_rate>().rbegin()->GetTx().GetHash() == hashChild1);
+    BOOST_CHECK(testPool.mapTx.get<fee_rate>().begin()->GetTx().GetHash() == hashParent);
+    BOOST_CHECK(testPool.mapTx.get<selection_priority>().rbegin()->GetTx().GetHash() == hashParent);
+    BOOST_CHECK(testPool.mapTx.get<selection_priority>().begin()->GetTx().GetHash() == hashChild0);
+
+    // Prioritisation re-keys the entry
+    testPool.PrioritiseTransaction(hashChild0, hashChild0.ToString(), 100.0, 10000);
+    BOOST_CHECK(testPool.mapTx.get<fee_rate>().rbegin()->GetTx().GetHash() == hashChild0);
+    BOOST_CHECK(testPool.mapTx.get<selection_priority>().rbegin()->GetTx().GetHash() == hashChild0);
+    testPool.ClearPrioritisation(hashChild0);
+    BOOST_CHECK(testPool.mapTx.get<fee_rate>().rbegin()->GetTx().GetHash() == hashChild1);
+
+    // Priority grows with the height for all of them
+    double dPriority = testPool.mapTx.find(hashParent)->GetSelectionPriority();
+    testPool.SetPriorityHeight(11);
+    BOOST_CHECK(testPool.mapTx.find(hashParent)->GetSelectionPriority() > dPriority);
+    BOOST_CHECK_EQUAL(testPool.mapTx.get<selection_priority>().size(), 3);
+
+    // Confirming the parent leaves the children without in-pool parents
+    size_t nUsage = testPool.DynamicMemoryUsage();
+    std::vector<CTransaction> vtx(1, txParent);
+    std::list<CTransaction> conflicts;
+    testPool.removeForBlock(vtx, 10, conflicts);
+    BOOST_CHECK(testPool.DynamicMemoryUsage() < nUsage);
+    BOOST_CHECK_EQUAL(testPool.mapLinks.size(), 2);
+    BOOST_CHECK(testPool.mapLinks[hashChild0].setParents.empty());
+    BOOST_CHECK(testPool.mapLinks[hashChild1].setParents.empty());
+    BOOST_CHECK_EQUAL(testPool.mapTx.get<fee_rate>().size(), 2);
+
+    testPool.clear();
+    BOOST_CHECK(testPool.mapLinks.empty());
+    BOOST_CHECK(testPool.mapTx.get<selection_priority>().empty());
+    BOOST_CHECK(testPool.mapTx.get<fee_rate>().empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFreeHighPriorityTest)
+{
+    // A coin confirmed at height 0, spent without a fee at height 100,
+    // next to a fee paying spend of a coin that just confirmed
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    uint256 hashOld = GetRandHash();
+    uint256 hashNew = GetRandHash();
+    {
+        CCoinsModifier coins = view.ModifyCoins(hashOld);
+        coins->nVersion = 1;
+        coins->nHeight = 0;
+        coins->vout.resize(1);
+        coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        coins->vout[0].nValue = 1 * COIN;
+    }
+    {
+        CCoinsModifier coins = view.ModifyCoins(hashNew);
+        coins->nVersion = 1;
+        coins->nHeight = 99;
+        coins->vout.resize(1);
+        coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        coins->vout[0].nValue = 1 * COIN;
+    }
+
+    CMutableTransaction txFree;
+    txFree.vin.resize(1);
+    txFree.vin[0].prevout = COutPoint(hashOld, 0);
+    txFree.vout.resize(1);
+    txFree.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txFree.vout[0].nValue = 1 * COIN;
+    CMutableTransaction txFee;
+    txFee.vin.resize(1);
+    txFee.vin[0].prevout = COutPoint(hashNew, 0);
+    txFee.vout.resize(1);
+    txFee.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txFee.vout[0].nValue = 1 * COIN - 10000;
+    uint256 hashFree = txFree.GetHash();
+    uint256 hashFee = txFee.GetHash();
+
+    // The priority as AcceptToMemoryPool works it out at the tip
+    const int nHeight = 100;
+    double dPriorityFree = view.GetPriority(txFree, nHeight);
+    double dPriorityFee = view.GetPriority(txFee, nHeight);
+    BOOST_CHECK(AllowFree(dPriorityFree));
+    BOOST_CHECK(!AllowFree(dPriorityFee));
+
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.addUnchecked(hashFree, CTxMemPoolEntry(txFree, 0, 0, dPriorityFree, nHeight));
+    testPool.addUnchecked(hashFee, CTxMemPoolEntry(txFee, 10000, 0, dPriorityFee, nHeight));
+
+    // The miner takes the free one first for the next block, which the
+    // coin age gained in the pool alone wouldn't allow
+    testPool.SetPriorityHeight(nHeight + 1);
+    CTxMemPool::indexed_transaction_set::index<selection_priority>::type::reverse_iterator itPriority = testPool.mapTx.get<selection_priority>().rbegin();
+    BOOST_CHECK(itPriority->GetTx().GetHash() == hashFree);
+    BOOST_CHECK(AllowFree(itPriority->GetSelectionPriority()));
+    BOOST_CHECK(!AllowFree(itPriority->GetPriority(nHeight + 1) - dPriorityFree));
+    BOOST_CHECK(testPool.mapTx.get<fee_rate>().rbegin()->GetTx().GetHash() == hashFee);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    // txA <- txB, and an unrelated txC, all the same size
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.n = i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    tx[1].vin[0].prevout.hash = tx[0].GetHash();
+    tx[1].vin[0].prevout.n = 0;
+    uint256 hashA = tx[0].GetHash();
+    uint256 hashB = tx[1].GetHash();
+    uint256 hashC = tx[2].GetHash();
+
+    CTxMemPool pool(CFeeRate(1000));
+    pool.addUnchecked(hashA, CTxMemPoolEntry(tx[0], 1000, 10, 0.0, 1));
+    pool.addUnchecked(hashB, CTxMemPoolEntry(tx[1], 10000, 100, 0.0, 1));
+    pool.addUnchecked(hashC, CTxMemPoolEntry(tx[2], 5000, 100, 0.0, 1));
+    size_t nTxSize = pool.mapTx.find(hashA)->GetTxSize();
+
+    // The parent's package carries the child
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetSizeWithDescendants(), 2 * nTxSize);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetModFeesWithDescendants(), 11000);
+    BOOST_CHECK(pool.mapTx.find(hashA)->GetDescendantScore() == CFeeRate(11000, 2 * nTxSize));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashB)->GetCountWithDescendants(), 1);
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == hashC);
+
+    pool.PrioritiseTransaction(hashB, hashB.ToString(), 0.0, 5000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetModFeesWithDescendants(), 16000);
+    pool.ClearPrioritisation(hashB);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetModFeesWithDescendants(), 11000);
+
+    // Removing the child shrinks the parent's package
+    std::list<CTransaction> removed;
+    pool.remove(tx[1], removed, true);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetModFeesWithDescendants(), 1000);
+    pool.addUnchecked(hashB, CTxMemPoolEntry(tx[1], 10000, 100, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.mapTx.find(hashA)->GetModFeesWithDescendants(), 11000);
+
+    // Nothing to do below the limit
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // txC has the lowest package fee rate, and its rate plus the relay fee
+    // becomes the minimum fee
+    SetMockTime(42);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(!pool.exists(hashC));
+    CFeeRate minFee(CFeeRate(5000, nTxSize).GetFeePerK() + 1000);
+    BOOST_CHECK(pool.GetMinFee(1) == minFee);
+
+    // txA goes with its child
+    pool.TrimToSize(1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(CFeeRate(11000, 2 * nTxSize).GetFeePerK() + 1000));
+    minFee = pool.GetMinFee(1);
+
+    // The minimum fee only decays after a block, four times as fast
+    // with the pool below a quarter of the limit
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == minFee);
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 2, conflicts);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE / 4);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1000000).GetFeePerK(), minFee.GetFeePerK() / 2);
+
+    // and drops to zero under half the relay fee
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE * 11);
+    BOOST_CHECK(pool.GetMinFee(1000000) == CFeeRate(0));
+
+    // Expiry takes the descendants of old entries along
+    pool.addUnchecked(hashA, CTxMemPoolEntry(tx[0], 1000, 10, 0.0, 1));
+    pool.addUnchecked(hashB, CTxMemPoolEntry(tx[1], 10000, 100, 0.0, 1));
+    pool.addUnchecked(hashC, CTxMemPoolEntry(tx[2], 5000, 100, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.Expire(5), 0);
+    BOOST_CHECK_EQUAL(pool.Expire(50), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(hashC));
+    BOOST_CHECK_EQUAL(pool.mapTx.get<entry_time>().size(), 1);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolMemoryLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    for (int i = 0; i < 100; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout.hash = uint256(i + 1);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000 + i, 0, 0.0, 1));
+    }
+
+    // Half of what the pool uses is still well above the size of its
+    // transactions, which a limit on their size alone would not trim
+    size_t nLimit = pool.DynamicMemoryUsage() / 2;
+    BOOST_CHECK(pool.GetTotalTxSize() < nLimit);
+    pool.TrimToSize(nLimit);
+    BOOST_CHECK(pool.DynamicMemoryUsage() <= nLimit);
+    BOOST_CHECK(pool.size() > 0);
+    BOOST_CHECK(pool.size() < 100);
+
+    // The lowest fee rates went first
+    BOOST_CHECK_EQUAL(pool.mapTx.get<descendant_score>().begin()->GetFee(), 1000 + 100 - (int)pool.size());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolBlockTemplateBenchmark)
+{
+    // 10000 chains of 5 transactions each, spending coins added to the tip
+    const int nChains = 10000;
+    const int nChainLength = 5;
+    std::vector<uint256> vFunding;
+    std::set<uint256> setPool;
+    for (int i = 0; i < nChains; i++) {
+        uint256 hashFunding = GetRandHash();
+        {
+            CCoinsModifier coins = pcoinsTip->ModifyCoins(hashFunding);
+            coins->nVersion = 1;
+            coins->nHeight = 0;
+            coins->vout.resize(1);
+            coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+            coins->vout[0].nValue = 10 * COIN;
+        }
+        vFunding.push_back(hashFunding);
+
+        COutPoint prevout(hashFunding, 0);
+        CAmount nValue = 10 * COIN;
+        for (int j = 0; j < nChainLength; j++) {
+            CAmount nFee = 1000 * (1 + (i * nChainLength + j) % 97);
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prevout;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            tx.vout[0].nValue = nValue - nFee;
+            uint256 hash = tx.GetHash();
+            mempool.addUnchecked(hash, CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, chainActive.Height()));
+            setPool.insert(hash);
+            prevout = COutPoint(hash, 0);
+            nValue -= nFee;
+        }
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), nChains * nChainLength);
+
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    for (int nRun = 0; nRun < 2; nRun++) {
+        int64_t nStart = GetTimeMicros();
+        CBlockTemplate* pblocktemplate = CreateNewBlock(scriptPubKey, NULL, false);
+        int64_t nElapsed = GetTimeMicros() - nStart;
+        BOOST_REQUIRE(pblocktemplate);
+
+        // Every transaction comes after its in-pool parents
+        const CBlock& block = pblocktemplate->block;
+        std::set<uint256> setInBlock;
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            BOOST_CHECK(setPool.count(tx.GetHash()));
+            if (setPool.count(tx.vin[0].prevout.hash))
+                BOOST_CHECK(setInBlock.count(tx.vin[0].prevout.hash));
+            setInBlock.insert(tx.GetHash());
+        }
+        BOOST_CHECK(block.vtx.size() > 1);
+        BOOST_CHECK(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) < DEFAULT_BLOCK_MAX_SIZE);
+
+        BOOST_TEST_MESSAGE(strprintf("block template: %u of %u mempool transactions in %.2fms",
+            block.vtx.size() - 1, mempool.size(), nElapsed * 0.001));
+        delete pblocktemplate;
+    }
+
+    mempool.clear();
+    BOOST_FOREACH (const uint256& hashFunding, vFunding)
+        pcoinsTip->ModifyCoins(hashFunding)->Clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
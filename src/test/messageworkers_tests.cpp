@@ -0,0 +1,117 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messageworkers.h"
+#include "net.h"
+#include "protocol.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(messageworkers_tests)
+
+namespace {
+struct ProcessedMessage {
+    MessageShard shard;
+    CNode* pnode;
+    std::string strCommand;
+    int nValue;
+};
+
+void RecordMessage(std::vector<ProcessedMessage>* pvProcessed, MessageShard shard, CNode* pnode, const std::string& strCommand, CDataStream& vRecv)
+{
+    ProcessedMessage msg;
+    msg.shard = shard;
+    msg.pnode = pnode;
+    msg.strCommand = strCommand;
+    vRecv >> msg.nValue;
+    pvProcessed->push_back(msg);
+}
+
+void PushValue(CMessageWorkers& workers, MessageShard shard, CNode* pnode, const std::string& strCommand, int nValue)
+{
+    CDataStream vRecv(SER_NETWORK, PROTOCOL_VERSION);
+    vRecv << nValue;
+    workers.Push(shard, pnode, strCommand, vRecv);
+    BOOST_CHECK(vRecv.empty());
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(message_shards)
+{
+    MessageShard shard;
+    BOOST_CHECK(GetMessageShard("mnb", shard) && shard == SHARD_MASTERNODE);
+    BOOST_CHECK(GetMessageShard("dsq", shard) && shard == SHARD_MASTERNODE);
+    BOOST_CHECK(GetMessageShard("mvote", shard) && shard == SHARD_BUDGET);
+    BOOST_CHECK(GetMessageShard("getsporks", shard) && shard == SHARD_SPORK);
+    BOOST_CHECK(GetMessageShard("txlvote", shard) && shard == SHARD_SWIFTTX);
+    BOOST_CHECK(GetMessageShard("getaddr", shard) && shard == SHARD_ADDR);
+    BOOST_CHECK(!GetMessageShard("block", shard));
+    BOOST_CHECK(!GetMessageShard("tx", shard));
+    BOOST_CHECK(!GetMessageShard("version", shard));
+
+    BOOST_CHECK(GetInventoryShard(MSG_MASTERNODE_PING, shard) && shard == SHARD_MASTERNODE);
+    BOOST_CHECK(GetInventoryShard(MSG_BUDGET_FINALIZED_VOTE, shard) && shard == SHARD_BUDGET);
+    BOOST_CHECK(!GetInventoryShard(MSG_TX, shard));
+    BOOST_CHECK(!GetInventoryShard(MSG_SPORK, shard));
+}
+
+BOOST_AUTO_TEST_CASE(peers_take_turns)
+{
+    std::vector<ProcessedMessage> vProcessed;
+    CMessageWorkers workers(boost::bind(&RecordMessage, &vProcessed, _1, _2, _3, _4));
+    CNode nodeA(INVALID_SOCKET, CAddress(), "", true);
+    CNode nodeB(INVALID_SOCKET, CAddress(), "", true);
+
+    // A flood from one peer doesn't keep the other one waiting
+    PushValue(workers, SHARD_MASTERNODE, &nodeA, "mnp", 1);
+    PushValue(workers, SHARD_MASTERNODE, &nodeA, "mnp", 2);
+    PushValue(workers, SHARD_MASTERNODE, &nodeA, "mnp", 3);
+    PushValue(workers, SHARD_MASTERNODE, &nodeB, "mnb", 4);
+    PushValue(workers, SHARD_BUDGET, &nodeB, "mvote", 5);
+    BOOST_CHECK_EQUAL(workers.GetQueueSize(SHARD_MASTERNODE), 4U);
+    BOOST_CHECK_EQUAL(workers.GetQueueSize(SHARD_BUDGET), 1U);
+    BOOST_CHECK_EQUAL(nodeA.nWorkerQueueSize, 3 * sizeof(int));
+    BOOST_CHECK_EQUAL(nodeB.nWorkerQueueSize, 2 * sizeof(int));
+    BOOST_CHECK_EQUAL(nodeA.GetRefCount(), 3);
+
+    while (workers.ProcessNext(SHARD_MASTERNODE)) {}
+    BOOST_REQUIRE_EQUAL(vProcessed.size(), 4U);
+    const int vExpected[] = {1, 4, 2, 3};
+    for (unsigned int i = 0; i < vProcessed.size(); i++) {
+        BOOST_CHECK_EQUAL(vProcessed[i].shard, SHARD_MASTERNODE);
+        BOOST_CHECK_EQUAL(vProcessed[i].nValue, vExpected[i]);
+    }
+    BOOST_CHECK(vProcessed[1].pnode == &nodeB && vProcessed[1].strCommand == "mnb");
+    BOOST_CHECK_EQUAL(nodeA.nWorkerQueueSize, 0U);
+    BOOST_CHECK_EQUAL(nodeA.GetRefCount(), 0);
+
+    // The other shards keep their own queues
+    BOOST_CHECK_EQUAL(workers.GetQueueSize(SHARD_MASTERNODE), 0U);
+    BOOST_CHECK(workers.ProcessNext(SHARD_BUDGET));
+    BOOST_CHECK_EQUAL(vProcessed.back().nValue, 5);
+    BOOST_CHECK(!workers.ProcessNext(SHARD_BUDGET));
+    BOOST_CHECK_EQUAL(nodeB.nWorkerQueueSize, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(disconnected_peer)
+{
+    std::vector<ProcessedMessage> vProcessed;
+    CMessageWorkers workers(boost::bind(&RecordMessage, &vProcessed, _1, _2, _3, _4));
+    CNode node(INVALID_SOCKET, CAddress(), "", true);
+
+    PushValue(workers, SHARD_ADDR, &node, "addr", 1);
+    node.fDisconnect = true;
+
+    // Queued messages of a peer that went away are dropped
+    BOOST_CHECK(workers.ProcessNext(SHARD_ADDR));
+    BOOST_CHECK(vProcessed.empty());
+    BOOST_CHECK_EQUAL(node.nWorkerQueueSize, 0U);
+    BOOST_CHECK_EQUAL(node.GetRefCount(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hash.h"
+#include "net.h"
+#include "protocol.h"
+#include "serialize.h"
+#include "streams.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(make_net_message)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << std::string("payload") << 42;
+    CSerializeDataRef msg = MakeNetMessage("tx", ssPayload);
+    BOOST_REQUIRE_EQUAL(msg->size(), CMessageHeader::HEADER_SIZE + ssPayload.size());
+
+    CDataStream ssMessage(msg->begin(), msg->end(), SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr;
+    ssMessage >> hdr;
+    BOOST_CHECK(hdr.IsValid());
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), "tx");
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, ssPayload.size());
+    BOOST_CHECK(std::equal(ssPayload.begin(), ssPayload.end(), ssMessage.begin()));
+
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    BOOST_CHECK_EQUAL(hdr.nChecksum, nChecksum);
+}
+
+#ifndef WIN32
+
+namespace {
+/** A node whose socket is one end of a socket pair, with the other end returned in hRemote */
+CNode* CreateConnectedNode(SOCKET& hRemote, int nSendBufferSize)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    BOOST_REQUIRE(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nSendBufferSize, sizeof(nSendBufferSize)) == 0);
+    hRemote = fds[1];
+    BOOST_REQUIRE(SetSocketNonBlocking(hRemote, true));
+    return new CNode(fds[0], CAddress(), "", true);
+}
+
+/** Read everything that is waiting on hSocket */
+void ReceiveAll(SOCKET hSocket, std::vector<char>& vData)
+{
+    char buf[4096];
+    int nBytes;
+    while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        vData.insert(vData.end(), buf, buf + nBytes);
+}
+
+bool SameBytes(const std::vector<char>& vData, const CSerializeData& data)
+{
+    return vData.size() == data.size() && std::equal(data.begin(), data.end(), vData.begin());
+}
+
+/** Send what the node has queued until the queue is empty, draining the other end as we go */
+void Flush(CNode* pnode, SOCKET hRemote, std::vector<char>& vData)
+{
+    for (int i = 0; i < 100000; i++) {
+        {
+            LOCK(pnode->cs_vSend);
+            if (pnode->vSendMsg.empty())
+                break;
+            SocketSendData(pnode);
+        }
+        ReceiveAll(hRemote, vData);
+    }
+    ReceiveAll(hRemote, vData);
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(shared_messages)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << std::vector<char>(100000, 'x');
+    CSerializeDataRef msg = MakeNetMessage("block", ssPayload);
+
+    SOCKET hRemote1, hRemote2;
+    CNode* pnode1 = CreateConnectedNode(hRemote1, 4096);
+    CNode* pnode2 = CreateConnectedNode(hRemote2, 4096);
+
+    // Both send queues hold the same buffer instead of a copy each
+    pnode1->PushMessage(msg);
+    pnode2->PushMessage(msg);
+    BOOST_CHECK(pnode1->vSendMsg.front() == msg);
+    BOOST_CHECK(pnode2->vSendMsg.front() == msg);
+    BOOST_CHECK_EQUAL(msg.use_count(), 3);
+
+    std::vector<char> vData1, vData2;
+    Flush(pnode1, hRemote1, vData1);
+    Flush(pnode2, hRemote2, vData2);
+    BOOST_CHECK(SameBytes(vData1, *msg));
+    BOOST_CHECK(SameBytes(vData2, *msg));
+    BOOST_CHECK_EQUAL(pnode1->nSendSize, 0U);
+    BOOST_CHECK_EQUAL(msg.use_count(), 1);
+
+    delete pnode1;
+    delete pnode2;
+    CloseSocket(hRemote1);
+    CloseSocket(hRemote2);
+}
+
+BOOST_AUTO_TEST_CASE(gathered_send)
+{
+    SOCKET hRemote;
+    CNode* pnode = CreateConnectedNode(hRemote, 4096);
+
+    // More messages than one sendmsg() call takes, mixing private and
+    // shared ones, and partial sends of each through the small buffer
+    std::vector<char> vExpected;
+    for (int i = 0; i < 200; i++) {
+        std::vector<char> vPayload(i * 37 % 3000 + 1, (char)i);
+        CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+        ssPayload << vPayload;
+        CSerializeDataRef msg = MakeNetMessage("ping", ssPayload);
+        if (i % 2)
+            pnode->PushMessage("ping", vPayload);
+        else
+            pnode->PushMessage(msg);
+        vExpected.insert(vExpected.end(), msg->begin(), msg->end());
+    }
+
+    std::vector<char> vData;
+    Flush(pnode, hRemote, vData);
+    BOOST_CHECK(pnode->vSendMsg.empty());
+    BOOST_CHECK_EQUAL(pnode->nSendSize, 0U);
+    BOOST_CHECK_EQUAL(pnode->nSendOffset, 0U);
+    BOOST_CHECK_EQUAL(pnode->nSendBytes, vExpected.size());
+    BOOST_CHECK(vData == vExpected);
+
+    delete pnode;
+    CloseSocket(hRemote);
+}
+
+#endif // WIN32
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "accumulators.h"
+#include "main.h"
+#include "txdb.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace libzerocoin;
+
+BOOST_AUTO_TEST_SUITE(pubcoinindex_tests)
+
+namespace {
+std::vector<CBigNum> MakePubcoins(int nHeight, int nCount)
+{
+    std::vector<CBigNum> vPubcoins;
+    for (int i = 0; i < nCount; i++)
+        vPubcoins.push_back(CBigNum(nHeight * 100 + i));
+    return vPubcoins;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(index_range_and_erase)
+{
+    // Heights whose little-endian encodings would sort out of order
+    const int nHeights[] = {255, 256, 511, 65536};
+    for (int nHeight : nHeights) {
+        BOOST_REQUIRE(zerocoinDB->WritePubcoinIndex(nHeight, ZQ_ONE, MakePubcoins(nHeight, 2)));
+        BOOST_REQUIRE(zerocoinDB->WritePubcoinIndex(nHeight, ZQ_FIVE, MakePubcoins(nHeight, 1)));
+    }
+    // A block where every mint was filtered out is still indexed
+    BOOST_REQUIRE(zerocoinDB->WritePubcoinIndex(300, ZQ_ONE, std::vector<CBigNum>()));
+
+    std::vector<CBigNum> vPubcoins;
+    BOOST_CHECK(zerocoinDB->ReadPubcoinIndex(511, ZQ_ONE, vPubcoins));
+    BOOST_CHECK(vPubcoins == MakePubcoins(511, 2));
+    BOOST_CHECK(!zerocoinDB->ReadPubcoinIndex(512, ZQ_ONE, vPubcoins));
+
+    // The range is half open and only covers the one denomination
+    std::map<int, std::vector<CBigNum> > mapPubcoins;
+    BOOST_CHECK(zerocoinDB->ReadPubcoinIndexRange(256, 65536, ZQ_ONE, mapPubcoins));
+    BOOST_REQUIRE_EQUAL(mapPubcoins.size(), 3U);
+    BOOST_CHECK(mapPubcoins[256] == MakePubcoins(256, 2));
+    BOOST_CHECK(mapPubcoins[300].empty());
+    BOOST_CHECK(mapPubcoins[511] == MakePubcoins(511, 2));
+
+    mapPubcoins.clear();
+    BOOST_CHECK(zerocoinDB->ReadPubcoinIndexRange(0, 100000, ZQ_FIVE, mapPubcoins));
+    BOOST_CHECK_EQUAL(mapPubcoins.size(), 4U);
+
+    mapPubcoins.clear();
+    BOOST_CHECK(zerocoinDB->ReadPubcoinIndexRange(0, 100000, ZQ_TEN, mapPubcoins));
+    BOOST_CHECK(mapPubcoins.empty());
+
+    // Disconnecting a block erases its entries of the denominations it minted
+    CBlockIndex index;
+    index.nHeight = 511;
+    index.vMintDenominationsInBlock.push_back(ZQ_ONE);
+    BOOST_CHECK(EraseBlockPubcoins(&index));
+    BOOST_CHECK(!zerocoinDB->ReadPubcoinIndex(511, ZQ_ONE, vPubcoins));
+    BOOST_CHECK(zerocoinDB->ReadPubcoinIndex(511, ZQ_FIVE, vPubcoins));
+
+    mapPubcoins.clear();
+    BOOST_CHECK(zerocoinDB->ReadPubcoinIndexRange(0, 100000, ZQ_ONE, mapPubcoins));
+    BOOST_CHECK_EQUAL(mapPubcoins.size(), 4U);
+    BOOST_CHECK(!mapPubcoins.count(511));
+
+    for (int nHeight : nHeights) {
+        zerocoinDB->ErasePubcoinIndex(nHeight, ZQ_ONE);
+        zerocoinDB->ErasePubcoinIndex(nHeight, ZQ_FIVE);
+    }
+    zerocoinDB->ErasePubcoinIndex(300, ZQ_ONE);
+}
+
+BOOST_AUTO_TEST_CASE(range_pubcoins_of_active_chain)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pindexGenesis);
+    BOOST_REQUIRE(zerocoinDB->WritePubcoinIndex(0, ZQ_ONE, MakePubcoins(0, 3)));
+
+    // Nothing is read for a block that doesn't mint the denomination
+    std::map<int, std::vector<CBigNum> > mapPubcoins;
+    BOOST_CHECK(GetRangePubcoins(0, 1, ZQ_ONE, mapPubcoins));
+    BOOST_CHECK(mapPubcoins.empty());
+
+    // An indexed block is served from the index without reading it from disk
+    pindexGenesis->vMintDenominationsInBlock.push_back(ZQ_ONE);
+    BOOST_CHECK(GetRangePubcoins(0, 1, ZQ_ONE, mapPubcoins));
+    BOOST_REQUIRE_EQUAL(mapPubcoins.size(), 1U);
+    BOOST_CHECK(mapPubcoins[0] == MakePubcoins(0, 3));
+
+    std::vector<CBigNum> vPubcoins;
+    BOOST_CHECK(GetBlockPubcoins(pindexGenesis, ZQ_ONE, vPubcoins));
+    BOOST_CHECK(vPubcoins == MakePubcoins(0, 3));
+
+    BOOST_CHECK(EraseBlockPubcoins(pindexGenesis));
+    pindexGenesis->vMintDenominationsInBlock.clear();
+    BOOST_CHECK(!zerocoinDB->ReadPubcoinIndex(0, ZQ_ONE, vPubcoins));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
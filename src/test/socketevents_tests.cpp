@@ -0,0 +1,189 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/snodecoin-config.h"
+#endif
+
+#include "socketevents.h"
+#include "netbase.h"
+#include "tinyformat.h"
+#include "utiltime.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(socketevents_tests)
+
+#ifdef HAVE_SYS_EPOLL_H
+
+namespace {
+struct SocketPair {
+    SOCKET hLocal;
+    SOCKET hRemote;
+};
+
+SocketPair CreatePair()
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    SocketPair pair;
+    pair.hLocal = fds[0];
+    pair.hRemote = fds[1];
+    return pair;
+}
+
+void ClosePair(SocketPair& pair)
+{
+    CloseSocket(pair.hLocal);
+    CloseSocket(pair.hRemote);
+}
+
+/** Take the events reported right after registration, as every new socket is writable */
+void DrainEvents(CSocketEventsEpoll& events)
+{
+    std::vector<CSocketEventsEpoll::Event> vEvents;
+    do {
+        BOOST_REQUIRE(events.Wait(0, vEvents));
+    } while (!vEvents.empty());
+}
+
+/**
+ * Time nIterations round trips of one byte over an active peer while
+ * nIdle other peers are registered, checking that only the active peer is
+ * ever reported. Returns microseconds per iteration.
+ */
+double SoakIdlePeers(int nIdle, int nIterations)
+{
+    CSocketEventsEpoll events;
+    BOOST_REQUIRE(events.IsValid());
+
+    std::vector<SocketPair> vIdle;
+    for (int i = 0; i < nIdle; i++) {
+        vIdle.push_back(CreatePair());
+        BOOST_REQUIRE(events.AddSocket(vIdle.back().hLocal, &vIdle.back()));
+    }
+    SocketPair active = CreatePair();
+    BOOST_REQUIRE(events.AddSocket(active.hLocal, &active));
+    DrainEvents(events);
+
+    std::vector<CSocketEventsEpoll::Event> vEvents;
+    char ch = 0;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nIterations; i++) {
+        BOOST_REQUIRE(send(active.hRemote, &ch, 1, MSG_NOSIGNAL) == 1);
+        BOOST_REQUIRE(events.Wait(1000, vEvents));
+        BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+        BOOST_CHECK(vEvents[0].pData == &active);
+        BOOST_CHECK(vEvents[0].fRecv);
+        BOOST_REQUIRE(recv(active.hLocal, &ch, 1, 0) == 1);
+    }
+    double dPerIteration = (double)(GetTimeMicros() - nStart) / nIterations;
+
+    // Nothing but the active peer ever got data
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK(vEvents.empty());
+
+    for (size_t i = 0; i < vIdle.size(); i++)
+        ClosePair(vIdle[i]);
+    ClosePair(active);
+    return dPerIteration;
+}
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_edge_triggered)
+{
+    CSocketEventsEpoll events;
+    BOOST_REQUIRE(events.IsValid());
+
+    SocketPair pair = CreatePair();
+    int nData = 0;
+    BOOST_REQUIRE(events.AddSocket(pair.hLocal, &nData));
+
+    // A new socket is writable
+    std::vector<CSocketEventsEpoll::Event> vEvents;
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK(vEvents[0].pData == &nData);
+    BOOST_CHECK(vEvents[0].fSend);
+    BOOST_CHECK(!vEvents[0].fRecv);
+
+    // Incoming data is reported once, even if it is not read
+    const char pch[] = "data";
+    BOOST_REQUIRE(send(pair.hRemote, pch, sizeof(pch), MSG_NOSIGNAL) == (int)sizeof(pch));
+    BOOST_CHECK(events.Wait(1000, vEvents));
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK(vEvents[0].fRecv);
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK(vEvents.empty());
+
+    // More data makes a new edge
+    BOOST_REQUIRE(send(pair.hRemote, pch, sizeof(pch), MSG_NOSIGNAL) == (int)sizeof(pch));
+    BOOST_CHECK(events.Wait(1000, vEvents));
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK(vEvents[0].fRecv);
+
+    // The peer going away is reported as readable, for recv() to see the end
+    CloseSocket(pair.hRemote);
+    BOOST_CHECK(events.Wait(1000, vEvents));
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK(vEvents[0].fRecv);
+
+    // Nothing is reported after removal
+    BOOST_CHECK(events.RemoveSocket(pair.hLocal));
+    BOOST_CHECK(!events.RemoveSocket(pair.hLocal));
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_CHECK(vEvents.empty());
+    CloseSocket(pair.hLocal);
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_level_triggered)
+{
+    CSocketEventsEpoll events;
+    BOOST_REQUIRE(events.IsValid());
+
+    SocketPair pair = CreatePair();
+    BOOST_REQUIRE(events.AddSocket(pair.hLocal, &pair, false));
+
+    // Unread data keeps being reported
+    char ch = 0;
+    BOOST_REQUIRE(send(pair.hRemote, &ch, 1, MSG_NOSIGNAL) == 1);
+    std::vector<CSocketEventsEpoll::Event> vEvents;
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(events.Wait(1000, vEvents));
+        BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+        BOOST_CHECK(vEvents[0].fRecv);
+    }
+    BOOST_REQUIRE(recv(pair.hLocal, &ch, 1, 0) == 1);
+    BOOST_CHECK(events.Wait(0, vEvents));
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK(!vEvents[0].fRecv);
+    BOOST_CHECK(vEvents[0].fSend);
+
+    ClosePair(pair);
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_idle_peers_soak)
+{
+    const int nIterations = 5000;
+    const int nFewPeers = 16;
+    const int nManyPeers = 400;
+
+    // Warm up, so the first measurement doesn't pay for page faults
+    SoakIdlePeers(nFewPeers, nIterations / 10);
+
+    double dFew = SoakIdlePeers(nFewPeers, nIterations);
+    double dMany = SoakIdlePeers(nManyPeers, nIterations);
+    BOOST_TEST_MESSAGE(strprintf("socket events: %.2fus per iteration with %d idle peers, %.2fus with %d",
+        dFew, nFewPeers, dMany, nManyPeers));
+
+    // A scan over every peer would be 25 times slower here. Leave a wide
+    // margin for noise on busy machines.
+    BOOST_CHECK(dMany < dFew * 5 + 20);
+}
+
+#endif // HAVE_SYS_EPOLL_H
+
+BOOST_AUTO_TEST_SUITE_END()
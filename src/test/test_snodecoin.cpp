@@ -44,6 +44,7 @@ struct TestingSetup {
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        zerocoinDB = new CZerocoinDB(1 << 20, true);
         InitBlockIndex();
 #ifdef ENABLE_WALLET
         bool fFirstRun;
@@ -52,8 +53,10 @@ struct TestingSetup {
         RegisterValidationInterface(pwalletMain);
 #endif
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadBlockPreCheck);
+        }
         RegisterNodeSignals(GetNodeSignals());
     }
     ~TestingSetup()
@@ -65,6 +68,8 @@ struct TestingSetup {
         delete pwalletMain;
         pwalletMain = NULL;
 #endif
+        delete zerocoinDB;
+        zerocoinDB = NULL;
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
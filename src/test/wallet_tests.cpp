@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "wallet.h"
+#include "walletdb.h"
 
 #include <set>
 #include <stdint.h>
@@ -21,6 +22,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_AUTO_TEST_SUITE(wallet_tests)
@@ -305,4 +308,36 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(zerocoin_witness_erase)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    LOCK(pwalletMain->cs_wallet);
+
+    CZerocoinMint mintSpent(libzerocoin::ZQ_ONE, CBigNum(1001), CBigNum(1), CBigNum(2), false);
+    CZerocoinMint mintOrphan(libzerocoin::ZQ_FIVE, CBigNum(1003), CBigNum(3), CBigNum(4), false);
+    for (const CZerocoinMint& mint : {mintSpent, mintOrphan}) {
+        BOOST_CHECK(walletdb.WriteZerocoinMint(mint));
+        CZerocoinWitness witness(mint.GetValue());
+        witness.Update(CBigNum(7), 10, 30, uint256(30), 5);
+        BOOST_CHECK(walletdb.WriteZerocoinWitness(witness));
+    }
+
+    // Writing an unspent mint keeps the witness
+    CZerocoinWitness witnessRead;
+    BOOST_CHECK(walletdb.WriteZerocoinMint(mintSpent));
+    BOOST_CHECK(walletdb.ReadZerocoinWitness(mintSpent.GetValue(), witnessRead));
+    BOOST_CHECK_EQUAL(witnessRead.GetHeightAccEnd(), 30);
+
+    // Spending or archiving the mint drops it
+    mintSpent.SetUsed(true);
+    BOOST_CHECK(walletdb.WriteZerocoinMint(mintSpent));
+    BOOST_CHECK(!walletdb.ReadZerocoinWitness(mintSpent.GetValue(), witnessRead));
+    BOOST_CHECK(walletdb.ArchiveMintOrphan(mintOrphan));
+    BOOST_CHECK(!walletdb.ReadZerocoinWitness(mintOrphan.GetValue(), witnessRead));
+
+    BOOST_CHECK(walletdb.EraseZerocoinMint(mintSpent));
+    BOOST_CHECK(walletdb.UnarchiveZerocoin(mintOrphan));
+    BOOST_CHECK(walletdb.EraseZerocoinMint(mintOrphan));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #include <boost/test/unit_test.hpp>
 #include <iostream>
 #include <accumulators.h>
+#include <accumulatorcache.h>
 
 using namespace libzerocoin;
 
@@ -224,6 +225,13 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     BOOST_CHECK_MESSAGE(denom == pubCoin.getDenomination(), "Spend denomination must match original pubCoin");
     BOOST_CHECK_MESSAGE(coinSpend.Verify(accumulator), "CoinSpend object failed to validate");
 
+    //the batched accumulator proof must agree with the individual one
+    const AccumulatorProofBatch& batch = Params().Zerocoin_Params()->accumulatorParams.proofBatch;
+    BOOST_CHECK_MESSAGE(!batch.IsNull(), "Accumulator proof tables were not built with the parameters");
+    BOOST_CHECK_MESSAGE(coinSpend.Verify(accumulator, &batch), "CoinSpend object failed to validate in a batch");
+    Accumulator accumulatorWrong(Params().Zerocoin_Params(), CoinDenomination::ZQ_ONE);
+    BOOST_CHECK_MESSAGE(!coinSpend.Verify(accumulatorWrong, &batch), "CoinSpend object validated against the wrong accumulator in a batch");
+
     //serialize the spend
     CDataStream serializedCoinSpend2(SER_NETWORK, PROTOCOL_VERSION);
     serializedCoinSpend2 << coinSpend;
@@ -348,5 +356,75 @@ BOOST_AUTO_TEST_CASE(checksum_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(bignum_exponentiation_tests)
+{
+    cout << "Running bignum_exponentiation_tests\n";
+
+    const IntegerGroupParams& group = zerocoinParams.serialNumberSoKCommitmentGroup;
+    const CBigNum& n = zerocoinParams.accumulatorParams.accumulatorModulus;
+    const CBigNum& g_n = zerocoinParams.accumulatorParams.accumulatorQRNCommitmentGroup.g;
+    const CBigNum& h_n = zerocoinParams.accumulatorParams.accumulatorQRNCommitmentGroup.h;
+
+    // Fixed-base tables must match plain exponentiation, including
+    // exponents that are negative or larger than the group order
+    BOOST_CHECK(!group.gTable.IsNull() && !group.hTable.IsNull());
+    for (int i = 0; i < 10; i++) {
+        CBigNum e = CBigNum::randBignum(group.groupOrder * group.groupOrder);
+        if (i % 2)
+            e = -e;
+        BOOST_CHECK(group.gTable.pow_mod(e, group.modulus) == group.g.pow_mod(e, group.modulus));
+        BOOST_CHECK(group.hTable.pow_mod(e, group.modulus) == group.h.pow_mod(e, group.modulus));
+    }
+    BOOST_CHECK(group.gTable.pow_mod(CBigNum(0), group.modulus) == CBigNum(1));
+
+    // Multi-exponentiation must match the product of the single exponentiations
+    for (int i = 0; i < 10; i++) {
+        CBigNum x = CBigNum::randBignum(n);
+        CBigNum e1 = CBigNum::randBignum(n);
+        CBigNum e2 = CBigNum::randBignum(n * n);
+        CBigNum e3 = CBigNum::randBignum(CBigNum(2).pow(256));
+        if (i % 2)
+            e2 = -e2;
+        CBigNum expected = (x.pow_mod(e3, n) * g_n.pow_mod(e1, n) * h_n.pow_mod(e2, n)) % n;
+        BOOST_CHECK(CBigNum::pow_mod_multi({x, g_n, h_n}, {e3, e1, e2}, n) == expected);
+    }
+    BOOST_CHECK(CBigNum::pow_mod_multi({g_n, h_n}, {CBigNum(0), CBigNum(0)}, n) == CBigNum(1));
+    BOOST_CHECK(CBigNum::pow_mod_multi({}, {}, n) == CBigNum(1));
+}
+
+BOOST_AUTO_TEST_CASE(accumulator_cache_tests)
+{
+    cout << "Running accumulator_cache_tests\n";
+
+    // Two entries per stripe; checksums that are equal mod 8 share a stripe
+    mapArgs["-maxaccumulatorcachesize"] = "16";
+    CAccumulatorCacheStats before = GetAccumulatorCacheStats();
+
+    CBigNum bnValue;
+    BOOST_CHECK(!GetCachedAccumulatorValue(0x1000, bnValue));
+    SetCachedAccumulatorValue(0x1000, CBigNum(1));
+    SetCachedAccumulatorValue(0x1008, CBigNum(2));
+    BOOST_CHECK(GetCachedAccumulatorValue(0x1000, bnValue) && bnValue == CBigNum(1));
+
+    // 0x1008 is now least recently used and makes room for 0x1010
+    SetCachedAccumulatorValue(0x1010, CBigNum(3));
+    BOOST_CHECK(!GetCachedAccumulatorValue(0x1008, bnValue));
+    BOOST_CHECK(GetCachedAccumulatorValue(0x1000, bnValue) && bnValue == CBigNum(1));
+    BOOST_CHECK(GetCachedAccumulatorValue(0x1010, bnValue) && bnValue == CBigNum(3));
+
+    // Overwrite in place, then erase
+    SetCachedAccumulatorValue(0x1010, CBigNum(4));
+    BOOST_CHECK(GetCachedAccumulatorValue(0x1010, bnValue) && bnValue == CBigNum(4));
+    EraseCachedAccumulatorValue(0x1010);
+    BOOST_CHECK(!GetCachedAccumulatorValue(0x1010, bnValue));
+    EraseCachedAccumulatorValue(0x1000);
+
+    CAccumulatorCacheStats after = GetAccumulatorCacheStats();
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+    BOOST_CHECK_EQUAL(after.nHits - before.nHits, 4U);
+    BOOST_CHECK_EQUAL(after.nMisses - before.nMisses, 3U);
+
+    mapArgs.erase("-maxaccumulatorcachesize");
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,22 +9,134 @@
 
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 #include "accumulators.h"
+#include "crypto/common.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 using namespace libzerocoin;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+namespace
+{
+/**
+ * Key of a CCoinsOutput in the coin database. Outputs of the same transaction
+ * share the 'C' + txid prefix, so they are next to each other.
+ *
+ * Transactions used to be stored whole, as a CCoins under 'c' + txid, which
+ * CCoinsViewDB::Upgrade converts.
+ */
+struct CCoinsOutputKey {
+    char chType;
+    uint256 txid;
+    unsigned int n;
+
+    CCoinsOutputKey() : chType(0), n(0) {}
+    CCoinsOutputKey(const uint256& txidIn, unsigned int nIn) : chType('C'), txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Key of the pubcoins of one denomination minted in a block. The height is
+ * big-endian so that a cursor walks the blocks of a denomination in order.
+ */
+struct CPubcoinIndexKey {
+    char chType;
+    int nDenom;
+    int nHeight;
+
+    CPubcoinIndexKey() : chType(0), nDenom(0), nHeight(0) {}
+    CPubcoinIndexKey(int nHeightIn, CoinDenomination denom) : chType('p'), nDenom((int)denom), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(chType);
+        READWRITE(nDenom);
+        unsigned char vchHeight[4];
+        if (!ser_action.ForRead())
+            WriteBE32(vchHeight, (uint32_t)nHeight);
+        READWRITE(FLATDATA(vchHeight));
+        if (ser_action.ForRead())
+            nHeight = (int)ReadBE32(vchHeight);
+    }
+};
+}
+
+//! Move the cursor to the first record starting with key
+template <typename K>
+void static SeekTo(leveldb::Iterator* pcursor, const K& key)
 {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << key;
+    pcursor->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+}
+
+//! Read the output key at the cursor, false if the cursor is past the outputs of txid
+bool static ReadOutputKey(leveldb::Iterator* pcursor, const uint256& txid, CCoinsOutputKey& key)
+{
+    if (!pcursor->Valid())
+        return false;
+    leveldb::Slice slKey = pcursor->key();
+    if (slKey.size() == 0 || slKey[0] != 'C')
+        return false;
+    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+    ssKey >> key;
+    return txid == 0 || key.txid == txid;
+}
+
+template <typename V>
+void static ReadValue(leveldb::Iterator* pcursor, V& value)
+{
+    leveldb::Slice slValue = pcursor->value();
+    CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+    ssValue >> value;
+}
+
+void static BatchWriteCoins(const CLevelDBWrapper& db, CLevelDBBatch& batch, const uint256& hash, const CCoinsCacheEntry& entry)
+{
+    const CCoins& coins = entry.coins;
+
+    // Outputs never change once created, so only spent ones have to go and
+    // new ones be added. A reorg can bring a transaction back at another
+    // height though, so compare what is on disk. Fresh entries have nothing
+    // on disk to compare with.
+    std::vector<bool> vUnchanged(coins.vout.size(), false);
+    if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewCachedIterator());
+        CCoinsOutputKey key;
+        for (SeekTo(pcursor.get(), make_pair('C', hash)); ReadOutputKey(pcursor.get(), hash, key); pcursor->Next()) {
+            if (key.n >= coins.vout.size() || coins.vout[key.n].IsNull()) {
+                batch.Erase(key);
+                continue;
+            }
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            ssValue << CCoinsOutput(coins, key.n);
+            leveldb::Slice slValue = pcursor->value();
+            vUnchanged[key.n] = slValue.size() == ssValue.size() && memcmp(slValue.data(), &ssValue[0], ssValue.size()) == 0;
+        }
+    }
+
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull() && !vUnchanged[i])
+            batch.Write(CCoinsOutputKey(hash, i), CCoinsOutput(coins, i));
+    }
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
@@ -38,12 +150,25 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewCachedIterator());
+    coins.Clear();
+    bool fFound = false;
+    CCoinsOutputKey key;
+    for (SeekTo(pcursor.get(), make_pair('C', txid)); ReadOutputKey(pcursor.get(), txid, key); pcursor->Next()) {
+        CCoinsOutput output;
+        ReadValue(pcursor.get(), output);
+        output.ApplyTo(coins, key.n);
+        fFound = true;
+    }
+    return fFound;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(make_pair('c', txid));
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewCachedIterator());
+    CCoinsOutputKey key;
+    SeekTo(pcursor.get(), make_pair('C', txid));
+    return ReadOutputKey(pcursor.get(), txid, key);
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -54,19 +179,23 @@ uint256 CCoinsViewDB::GetBestBlock() const
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase)
 {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            BatchWriteCoins(db, batch, it->first, it->second);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            it++;
+        }
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
@@ -75,6 +204,54 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    SeekTo(pcursor.get(), 'c');
+    if (!pcursor->Valid() || pcursor->key()[0] != 'c')
+        return true;
+
+    LogPrintf("Upgrading the coin database to one record per output...\n");
+    uiInterface.InitMessage(_("Upgrading the coin database..."));
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    while (pcursor->Valid() && pcursor->key()[0] == 'c') {
+        // Each transaction moves in one batch, so stopping halfway leaves a
+        // database the next start continues with
+        CLevelDBBatch batch;
+        for (size_t nBatch = 0; nBatch < 10000 && pcursor->Valid() && pcursor->key()[0] == 'c'; nBatch++, pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txid;
+            CCoins coins;
+            try {
+                ssKey >> chType >> txid;
+                ReadValue(pcursor.get(), coins);
+            } catch (const std::exception& e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (!coins.vout[i].IsNull()) {
+                    batch.Write(CCoinsOutputKey(txid, i), CCoinsOutput(coins, i));
+                    nOutputs++;
+                }
+            }
+            batch.Erase(make_pair('c', txid));
+            nTransactions++;
+
+            // Txids are random, so their first byte tells how far along we are
+            if (nBatch == 0)
+                uiInterface.ShowProgress(_("Upgrading the coin database..."), *txid.begin() * 100 / 256);
+        }
+        if (!db.WriteBatch(batch))
+            return false;
+    }
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("Upgraded %u transactions into %u outputs\n", (unsigned int)nTransactions, (unsigned int)nOutputs);
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
@@ -118,57 +295,58 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
     return Read('l', nFile);
 }
 
+void static HashCoins(CHashWriter& ss, CCoinsStats& stats, const uint256& txhash, const CCoins& coins)
+{
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        const CTxOut& out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i + 1);
+            ss << out;
+            stats.nTotalAmount += out.nValue;
+        }
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
 {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    SeekTo(pcursor.get(), 'C');
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+    // The outputs of a transaction are gathered back into a CCoins, which
+    // keeps the hash the same as when transactions were stored whole
+    uint256 txhash;
+    CCoins coins;
+    CCoinsOutputKey key;
+    try {
+        for (; ReadOutputKey(pcursor.get(), 0, key); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            if (key.txid != txhash && !coins.vout.empty()) {
+                HashCoins(ss, stats, txhash, coins);
+                coins.Clear();
             }
-            pcursor->Next();
-        } catch (std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            txhash = key.txid;
+            CCoinsOutput output;
+            ReadValue(pcursor.get(), output);
+            output.ApplyTo(coins, key.n);
+            stats.nSerializedSize += pcursor->key().size() + pcursor->value().size();
         }
+        if (!coins.vout.empty())
+            HashCoins(ss, stats, txhash, coins);
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -366,3 +544,42 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(make_pair('a', nChecksum));
 }
+
+bool CZerocoinDB::WritePubcoinIndex(int nHeight, CoinDenomination denom, const std::vector<CBigNum>& vPubcoins)
+{
+    LogPrint("zero", "%s : height:%d denom:%d count:%d\n", __func__, nHeight, denom, vPubcoins.size());
+    return Write(CPubcoinIndexKey(nHeight, denom), vPubcoins);
+}
+
+bool CZerocoinDB::ReadPubcoinIndex(int nHeight, CoinDenomination denom, std::vector<CBigNum>& vPubcoins)
+{
+    return Read(CPubcoinIndexKey(nHeight, denom), vPubcoins);
+}
+
+bool CZerocoinDB::ReadPubcoinIndexRange(int nHeightStart, int nHeightEnd, CoinDenomination denom, std::map<int, std::vector<CBigNum> >& mapPubcoins) const
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    for (SeekTo(pcursor.get(), CPubcoinIndexKey(nHeightStart, denom)); pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0 || slKey[0] != 'p')
+                break;
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            CPubcoinIndexKey key;
+            ssKey >> key;
+            if (key.nDenom != (int)denom || key.nHeight >= nHeightEnd)
+                break;
+            ReadValue(pcursor.get(), mapPubcoins[key.nHeight]);
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return true;
+}
+
+bool CZerocoinDB::ErasePubcoinIndex(int nHeight, CoinDenomination denom)
+{
+    LogPrint("zero", "%s : height:%d denom:%d\n", __func__, nHeight, denom);
+    return Erase(CPubcoinIndexKey(nHeight, denom));
+}
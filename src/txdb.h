@@ -39,8 +39,11 @@ public:
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Convert a database that stores whole transactions to one record per output
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -89,6 +92,11 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+    bool WritePubcoinIndex(int nHeight, libzerocoin::CoinDenomination denom, const std::vector<CBigNum>& vPubcoins);
+    bool ReadPubcoinIndex(int nHeight, libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vPubcoins);
+    //! Read the indexed pubcoins of the blocks in [nHeightStart, nHeightEnd) with a single cursor
+    bool ReadPubcoinIndexRange(int nHeightStart, int nHeightEnd, libzerocoin::CoinDenomination denom, std::map<int, std::vector<CBigNum> >& mapPubcoins) const;
+    bool ErasePubcoinIndex(int nHeight, libzerocoin::CoinDenomination denom);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -8,17 +8,23 @@
 #include "txmempool.h"
 
 #include "clientversion.h"
+#include "core_memusage.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "version.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <boost/circular_buffer.hpp>
 
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
+                                     nModFee(0), dSelectionPriority(0.0), nCountWithDescendants(0), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -28,6 +34,16 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
+    nUsageSize = RecursiveDynamicUsage(tx);
+
+    // Until the pool says otherwise, the package is just this transaction
+    nModFee = nFee;
+    feeRate = CFeeRate(nFee, nTxSize);
+    dSelectionPriority = dPriority;
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
+    UpdateDescendantScore();
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -44,6 +60,39 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount nFeeDelta)
+{
+    nModFeesWithDescendants += nFeeDelta - (nModFee - nFee);
+    nModFee = nFee + nFeeDelta;
+    feeRate = CFeeRate(nModFee, nTxSize);
+    UpdateDescendantScore();
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeeDelta)
+{
+    nCountWithDescendants += nCountDelta;
+    nSizeWithDescendants += nSizeDelta;
+    nModFeesWithDescendants += nFeeDelta;
+    UpdateDescendantScore();
+}
+
+void CTxMemPoolEntry::SetDescendantState(uint64_t nCount, uint64_t nSize, CAmount nFees)
+{
+    nCountWithDescendants = nCount;
+    nSizeWithDescendants = nSize;
+    nModFeesWithDescendants = nFees;
+    UpdateDescendantScore();
+}
+
+void CTxMemPoolEntry::UpdateDescendantScore()
+{
+    // Zerocoin spends are mined first, so they are evicted last
+    if (tx.IsZerocoinSpend())
+        descendantScore = CFeeRate(std::numeric_limits<CAmount>::max() / 1000);
+    else
+        descendantScore = std::max(feeRate, CFeeRate(nModFeesWithDescendants, nSizeWithDescendants));
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -357,7 +406,13 @@ public:
 
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
-                                                       minRelayFee(_minRelayFee)
+                                                       minRelayFee(_minRelayFee),
+                                                       totalTxSize(0),
+                                                       cachedInnerUsage(0),
+                                                       nPriorityHeight(0),
+                                                       lastRollingFeeUpdate(GetTime()),
+                                                       blockSinceLastRollingFeeBump(false),
+                                                       rollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -410,18 +465,173 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        txiter it = mapTx.insert(entry).first;
+        const CTransaction& tx = it->GetTx();
         if(!tx.IsZerocoinSpend()) {
             for (unsigned int i = 0; i < tx.vin.size(); i++)
                 mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         }
+        addToSelectionIndex(hash);
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
+        cachedInnerUsage += entry.DynamicMemoryUsage();
     }
     return true;
 }
 
+void CTxMemPool::addToSelectionIndex(const uint256& hash)
+{
+    txiter it = mapTx.find(hash);
+    updateSelectionKeys(it);
+
+    const CTransaction& tx = it->GetTx();
+    TxLinks& links = mapLinks[hash];
+    if (!tx.IsZerocoinSpend()) {
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            linksmap_type::iterator itParent = mapLinks.find(txin.prevout.hash);
+            if (itParent == mapLinks.end())
+                continue;
+            if (links.setParents.insert(txin.prevout.hash).second)
+                cachedInnerUsage += memusage::IncrementalDynamicUsage(links.setParents);
+            if (itParent->second.setChildren.insert(hash).second)
+                cachedInnerUsage += memusage::IncrementalDynamicUsage(itParent->second.setChildren);
+        }
+    }
+
+    // Transactions from disconnected blocks can come back after their children
+    std::map<COutPoint, CInPoint>::iterator itNext = mapNextTx.lower_bound(COutPoint(hash, 0));
+    for (; itNext != mapNextTx.end() && itNext->first.hash == hash; itNext++) {
+        const uint256& hashChild = itNext->second.ptx->GetHash();
+        TxLinks& linksChild = mapLinks[hashChild];
+        if (links.setChildren.insert(hashChild).second)
+            cachedInnerUsage += memusage::IncrementalDynamicUsage(links.setChildren);
+        if (linksChild.setParents.insert(hash).second)
+            cachedInnerUsage += memusage::IncrementalDynamicUsage(linksChild.setParents);
+    }
+
+    recalculatePackage(it);
+    if (links.setChildren.empty()) {
+        updateAncestorPackages(hash, 1, it->GetTxSize(), it->GetModifiedFee());
+    } else {
+        // Some of its descendants can already be in an ancestor's package
+        // through another path, so count those packages again from scratch
+        std::set<uint256> setAncestors;
+        calculateAncestors(hash, setAncestors);
+        BOOST_FOREACH (const uint256& hashAncestor, setAncestors)
+            recalculatePackage(mapTx.find(hashAncestor));
+    }
+}
+
+void CTxMemPool::removeFromSelectionIndex(const uint256& hash)
+{
+    linksmap_type::iterator it = mapLinks.find(hash);
+    if (it == mapLinks.end())
+        return;
+    const TxLinks& links = it->second;
+    BOOST_FOREACH (const uint256& hashParent, links.setParents) {
+        std::set<uint256>& setChildren = mapLinks[hashParent].setChildren;
+        if (setChildren.erase(hash))
+            cachedInnerUsage -= memusage::IncrementalDynamicUsage(setChildren);
+    }
+    BOOST_FOREACH (const uint256& hashChild, links.setChildren) {
+        std::set<uint256>& setParents = mapLinks[hashChild].setParents;
+        if (setParents.erase(hash))
+            cachedInnerUsage -= memusage::IncrementalDynamicUsage(setParents);
+    }
+    cachedInnerUsage -= memusage::DynamicUsage(links.setParents) + memusage::DynamicUsage(links.setChildren);
+    mapLinks.erase(it);
+}
+
+void CTxMemPool::updateSelectionKeys(txiter it)
+{
+    const uint256 hash = it->GetTx().GetHash();
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+
+    CAmount nModFeeOld = it->GetModifiedFee();
+    mapTx.modify(it, update_fee_delta(nFeeDelta));
+    mapTx.modify(it, update_selection_priority(getSelectionPriority(*it, dPriorityDelta)));
+
+    // The fee is also part of every ancestor's package
+    if (it->GetModifiedFee() != nModFeeOld)
+        updateAncestorPackages(hash, 0, 0, it->GetModifiedFee() - nModFeeOld);
+}
+
+double CTxMemPool::getSelectionPriority(const CTxMemPoolEntry& entry, double dPriorityDelta) const
+{
+    // Zerocoin spends go ahead of everything else to get into the next block
+    if (entry.GetTx().IsZerocoinSpend())
+        return std::numeric_limits<double>::max();
+
+    // An entry can be newer than the tip after a reorg
+    return entry.GetPriority(std::max(nPriorityHeight, entry.GetHeight())) + dPriorityDelta;
+}
+
+void CTxMemPool::calculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const
+{
+    std::vector<uint256> vToVisit(1, hash);
+    while (!vToVisit.empty()) {
+        linksmap_type::const_iterator it = mapLinks.find(vToVisit.back());
+        vToVisit.pop_back();
+        if (it == mapLinks.end())
+            continue;
+        BOOST_FOREACH (const uint256& hashParent, it->second.setParents) {
+            if (setAncestors.insert(hashParent).second)
+                vToVisit.push_back(hashParent);
+        }
+    }
+}
+
+void CTxMemPool::updateAncestorPackages(const uint256& hash, int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeeDelta)
+{
+    std::set<uint256> setAncestors;
+    calculateAncestors(hash, setAncestors);
+    BOOST_FOREACH (const uint256& hashAncestor, setAncestors)
+        mapTx.modify(mapTx.find(hashAncestor), update_descendant_state(nCountDelta, nSizeDelta, nFeeDelta));
+}
+
+void CTxMemPool::recalculatePackage(txiter it)
+{
+    uint64_t nCount = 1;
+    uint64_t nSize = it->GetTxSize();
+    CAmount nFees = it->GetModifiedFee();
+
+    std::set<uint256> setDescendants;
+    std::vector<uint256> vToVisit(1, it->GetTx().GetHash());
+    while (!vToVisit.empty()) {
+        const TxLinks& visit = mapLinks[vToVisit.back()];
+        vToVisit.pop_back();
+        BOOST_FOREACH (const uint256& hashChild, visit.setChildren) {
+            if (!setDescendants.insert(hashChild).second)
+                continue;
+            vToVisit.push_back(hashChild);
+            txiter itChild = mapTx.find(hashChild);
+            nCount++;
+            nSize += itChild->GetTxSize();
+            nFees += itChild->GetModifiedFee();
+        }
+    }
+    mapTx.modify(it, set_descendant_state(nCount, nSize, nFees));
+}
+
+void CTxMemPool::SetPriorityHeight(unsigned int nHeight)
+{
+    LOCK(cs);
+    if (nHeight == nPriorityHeight)
+        return;
+    nPriorityHeight = nHeight;
+
+    // Every key changes. Walking the hashed index is safe, as the txid does
+    // not change.
+    for (txiter it = mapTx.begin(); it != mapTx.end(); it++) {
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        ApplyDeltas(it->GetTx().GetHash(), dPriorityDelta, nFeeDelta);
+        mapTx.modify(it, update_selection_priority(getSelectionPriority(*it, dPriorityDelta)));
+    }
+}
+
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
@@ -442,13 +652,18 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        // Collect everything first, so that the packages of ancestors which
+        // stay in the pool can be reduced before any links are taken apart
+        std::vector<uint256> vRemove;
+        std::set<uint256> setRemove;
         while (!txToRemove.empty()) {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            if (!mapTx.count(hash) || !setRemove.insert(hash).second)
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
+            vRemove.push_back(hash);
             if (fRecursive) {
+                const CTransaction& tx = mapTx.find(hash)->GetTx();
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
@@ -456,12 +671,29 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
+        }
+        // Without fRecursive this assumes that any children which stay have
+        // no other path to the remaining ancestors, as when removing for a block
+        BOOST_FOREACH (const uint256& hash, vRemove) {
+            txiter it = mapTx.find(hash);
+            std::set<uint256> setAncestors;
+            calculateAncestors(hash, setAncestors);
+            BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+                if (!setRemove.count(hashAncestor))
+                    mapTx.modify(mapTx.find(hashAncestor), update_descendant_state(-1, -(int64_t)it->GetTxSize(), -it->GetModifiedFee()));
+            }
+        }
+        BOOST_FOREACH (const uint256& hash, vRemove) {
+            txiter it = mapTx.find(hash);
+            const CTransaction& tx = it->GetTx();
             BOOST_FOREACH (const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
 
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            mapTx.erase(hash);
+            removeFromSelectionIndex(hash);
+            totalTxSize -= it->GetTxSize();
+            cachedInnerUsage -= it->DynamicMemoryUsage();
+            mapTx.erase(it);
             nTransactionsUpdated++;
         }
     }
@@ -472,11 +704,10 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
-            if (it2 != mapTx.end())
+            if (mapTx.find(txin.prevout.hash) != mapTx.end())
                 continue;
             const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
             if (fSanityCheck) assert(coins);
@@ -516,9 +747,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
     BOOST_FOREACH (const CTransaction& tx, vtx) {
-        uint256 hash = tx.GetHash();
-        if (mapTx.count(hash))
-            entries.push_back(mapTx[hash]);
+        txiter it = mapTx.find(tx.GetHash());
+        if (it != mapTx.end())
+            entries.push_back(*it);
     }
     minerPolicyEstimator->seenBlock(entries, nBlockHeight, minRelayFee);
     BOOST_FOREACH (const CTransaction& tx, vtx) {
@@ -527,6 +758,8 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 
@@ -535,7 +768,9 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapLinks.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
     ++nTransactionsUpdated;
 }
 
@@ -547,21 +782,23 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     uint64_t checkTotal = 0;
+    uint64_t innerUsage = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
-        checkTotal += it->second.GetTxSize();
-        const CTransaction& tx = it->second.GetTx();
+        checkTotal += it->GetTxSize();
+        innerUsage += it->DynamicMemoryUsage();
+        const CTransaction& tx = it->GetTx();
         bool fDependsWait = false;
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
-                const CTransaction& tx2 = it2->second.GetTx();
+                const CTransaction& tx2 = it2->GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
             } else {
@@ -576,7 +813,7 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
             i++;
         }
         if (fDependsWait)
-            waitingOnDependants.push_back(&it->second);
+            waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
             CTxUndo undo;
@@ -602,15 +839,141 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     }
     for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
-        const CTransaction& tx = it2->second.GetTx();
+        indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         assert(it2 != mapTx.end());
+        const CTransaction& tx = it2->GetTx();
         assert(&tx == it->second.ptx);
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
     assert(totalTxSize == checkTotal);
+
+    assert(mapLinks.size() == mapTx.size());
+    for (linksmap_type::const_iterator it = mapLinks.begin(); it != mapLinks.end(); it++) {
+        indexed_transaction_set::const_iterator itEntry = mapTx.find(it->first);
+        assert(itEntry != mapTx.end());
+        innerUsage += memusage::DynamicUsage(it->second.setParents) + memusage::DynamicUsage(it->second.setChildren);
+
+        // Count the package again from the links
+        uint64_t nCountCheck = 1;
+        uint64_t nSizeCheck = itEntry->GetTxSize();
+        CAmount nFeesCheck = itEntry->GetModifiedFee();
+        std::set<uint256> setDescendants;
+        std::vector<uint256> vToVisit(1, it->first);
+        while (!vToVisit.empty()) {
+            linksmap_type::const_iterator itVisit = mapLinks.find(vToVisit.back());
+            vToVisit.pop_back();
+            assert(itVisit != mapLinks.end());
+            BOOST_FOREACH (const uint256& hashChild, itVisit->second.setChildren) {
+                if (!setDescendants.insert(hashChild).second)
+                    continue;
+                vToVisit.push_back(hashChild);
+                indexed_transaction_set::const_iterator itChild = mapTx.find(hashChild);
+                assert(itChild != mapTx.end());
+                nCountCheck++;
+                nSizeCheck += itChild->GetTxSize();
+                nFeesCheck += itChild->GetModifiedFee();
+            }
+        }
+        assert(itEntry->GetCountWithDescendants() == nCountCheck);
+        assert(itEntry->GetSizeWithDescendants() == nSizeCheck);
+        assert(itEntry->GetModFeesWithDescendants() == nFeesCheck);
+
+        BOOST_FOREACH (const uint256& hashParent, it->second.setParents) {
+            linksmap_type::const_iterator it2 = mapLinks.find(hashParent);
+            assert(it2 != mapLinks.end() && it2->second.setChildren.count(it->first));
+        }
+        BOOST_FOREACH (const uint256& hashChild, it->second.setChildren) {
+            linksmap_type::const_iterator it2 = mapLinks.find(hashChild);
+            assert(it2 != mapLinks.end() && it2->second.setParents.count(it->first));
+        }
+    }
+
+    assert(innerUsage == cachedInnerUsage);
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        size_t nUsage = DynamicMemoryUsage();
+        if (nUsage < sizelimit / 4)
+            halflife /= 4;
+        else if (nUsage < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(rollingMinimumFeeRate), minRelayFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    // Entries take several times their serialized size with the indexes and
+    // links around them, so the limit is on the memory the pool uses
+    while (DynamicMemoryUsage() > sizelimit && !mapTx.empty()) {
+        descendantscoreindex_type::iterator it = mapTx.get<descendant_score>().begin();
+
+        // A transaction needs to pay more than what was evicted to get back
+        // in, so the pool does not refill with the same package right away
+        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minRelayFee.GetFeePerK());
+        trackPackageRemoved(removed);
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        CTransaction tx = it->GetTx();
+        std::list<CTransaction> removedTxs;
+        remove(tx, removedTxs, true);
+        nTxnRemoved += removedTxs.size();
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0))
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    std::vector<CTransaction> vExpired;
+    const entrytimeindex_type& index = mapTx.get<entry_time>();
+    for (entrytimeindex_type::const_iterator it = index.begin(); it != index.end() && it->GetTime() < time; it++)
+        vExpired.push_back(it->GetTx());
+
+    int nRemoved = 0;
+    BOOST_FOREACH (const CTransaction& tx, vExpired) {
+        // Already gone if it descends from an earlier one
+        if (!mapTx.count(tx.GetHash()))
+            continue;
+        std::list<CTransaction> removed;
+        remove(tx, removed, true);
+        nRemoved += removed.size();
+    }
+    return nRemoved;
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -619,19 +982,30 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        vtxid.push_back((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back(mi->GetTx().GetHash());
 }
 
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
-    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
-    result = i->second.GetTx();
+    result = i->GetTx();
     return true;
 }
 
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    // Estimate the overhead of mapTx to be 15 pointers per entry, two for the
+    // hashed index and three for each ordered one, plus the bucket array
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() +
+           memusage::MallocUsage(sizeof(void*) * mapTx.bucket_count()) +
+           memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) +
+           memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -681,6 +1055,9 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end())
+            updateSelectionKeys(it);
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -700,6 +1077,9 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
 {
     LOCK(cs);
     mapDeltas.erase(hash);
+    txiter it = mapTx.find(hash);
+    if (it != mapTx.end())
+        updateSelectionKeys(it);
 }
 
 
@@ -9,12 +9,20 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/unordered_map.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -43,10 +51,22 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
 
+    // Index keys, which the pool changes through mapTx.modify()
+    CAmount nModFee;                 //! Fee, with prioritisetransaction deltas
+    CFeeRate feeRate;                //! ... and the fee rate it gives
+    double dSelectionPriority;       //! Priority at the pool's priority height, with deltas
+    uint64_t nCountWithDescendants;  //! Number of in-pool descendants, plus this transaction
+    uint64_t nSizeWithDescendants;   //! ... their total size
+    CAmount nModFeesWithDescendants; //! ... and total fees, with deltas
+    CFeeRate descendantScore;        //! Higher of feeRate and the package fee rate
+
+    void UpdateDescendantScore();
+
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
     CTxMemPoolEntry();
@@ -58,8 +78,81 @@ public:
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+
+    CAmount GetModifiedFee() const { return nModFee; }
+    CFeeRate GetModFeeRate() const { return feeRate; }
+    double GetSelectionPriority() const { return dSelectionPriority; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+    CFeeRate GetDescendantScore() const { return descendantScore; }
+
+    /** Set the prioritisetransaction fee delta, which also counts towards the package */
+    void UpdateFeeDelta(CAmount nFeeDelta);
+    void UpdateSelectionPriority(double dNewPriority) { dSelectionPriority = dNewPriority; }
+    /** Add a descendant to the package, or take one away with negative deltas */
+    void UpdateDescendantState(int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeeDelta);
+    void SetDescendantState(uint64_t nCount, uint64_t nSize, CAmount nFees);
+};
+
+// Helpers for modifying the index keys of entries in CTxMemPool::mapTx
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _nFeeDelta) : nFeeDelta(_nFeeDelta) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(nFeeDelta); }
+
+private:
+    CAmount nFeeDelta;
+};
+
+struct update_selection_priority
+{
+    update_selection_priority(double _dPriority) : dPriority(_dPriority) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateSelectionPriority(dPriority); }
+
+private:
+    double dPriority;
+};
+
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _nCountDelta, int64_t _nSizeDelta, CAmount _nFeeDelta) : nCountDelta(_nCountDelta), nSizeDelta(_nSizeDelta), nFeeDelta(_nFeeDelta) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateDescendantState(nCountDelta, nSizeDelta, nFeeDelta); }
+
+private:
+    int64_t nCountDelta;
+    int64_t nSizeDelta;
+    CAmount nFeeDelta;
 };
 
+struct set_descendant_state
+{
+    set_descendant_state(uint64_t _nCount, uint64_t _nSize, CAmount _nFees) : nCount(_nCount), nSize(_nSize), nFees(_nFees) {}
+    void operator()(CTxMemPoolEntry& e) { e.SetDescendantState(nCount, nSize, nFees); }
+
+private:
+    uint64_t nCount;
+    uint64_t nSize;
+    CAmount nFees;
+};
+
+/** Extracts the txid of an entry, the key of the hashed index of CTxMemPool::mapTx */
+struct mempoolentry_txid
+{
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+// Tags for the ordered indexes of CTxMemPool::mapTx
+struct descendant_score {};
+struct entry_time {};
+struct fee_rate {};
+struct selection_priority {};
+
 class CMinerPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -102,12 +195,75 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of the entries and their links
+    unsigned int nPriorityHeight; //! Height the priority index is keyed for
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    /**
+     * The pool's entries, indexed by:
+     *
+     * - txid, hashed for lookups
+     * - descendant score, lowest package first for TrimToSize
+     * - the time they entered the pool, for Expire
+     * - modified fee rate and selection priority, which CreateNewBlock walks
+     *   highest first instead of sorting the whole pool
+     *
+     * The ordered indexes break ties by txid, so walks over them are
+     * deterministic.
+     */
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            boost::multi_index::hashed_unique<mempoolentry_txid, CCoinsKeyHasher>,
+            boost::multi_index::ordered_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::composite_key<
+                    CTxMemPoolEntry,
+                    boost::multi_index::const_mem_fun<CTxMemPoolEntry, CFeeRate, &CTxMemPoolEntry::GetDescendantScore>,
+                    mempoolentry_txid> >,
+            boost::multi_index::ordered_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::composite_key<
+                    CTxMemPoolEntry,
+                    boost::multi_index::const_mem_fun<CTxMemPoolEntry, int64_t, &CTxMemPoolEntry::GetTime>,
+                    mempoolentry_txid> >,
+            boost::multi_index::ordered_unique<
+                boost::multi_index::tag<fee_rate>,
+                boost::multi_index::composite_key<
+                    CTxMemPoolEntry,
+                    boost::multi_index::const_mem_fun<CTxMemPoolEntry, CFeeRate, &CTxMemPoolEntry::GetModFeeRate>,
+                    mempoolentry_txid> >,
+            boost::multi_index::ordered_unique<
+                boost::multi_index::tag<selection_priority>,
+                boost::multi_index::composite_key<
+                    CTxMemPoolEntry,
+                    boost::multi_index::const_mem_fun<CTxMemPoolEntry, double, &CTxMemPoolEntry::GetSelectionPriority>,
+                    mempoolentry_txid> > > >
+        indexed_transaction_set;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    typedef indexed_transaction_set::index<descendant_score>::type descendantscoreindex_type;
+    typedef indexed_transaction_set::index<entry_time>::type entrytimeindex_type;
+    typedef indexed_transaction_set::index<fee_rate>::type feerateindex_type;
+    typedef indexed_transaction_set::index<selection_priority>::type priorityindex_type;
+
+    /** An entry's in-pool dependencies, for block assembly and package tracking */
+    struct TxLinks {
+        std::set<uint256> setParents;  //! In-pool transactions this one spends
+        std::set<uint256> setChildren; //! In-pool transactions spending this one
+    };
+    typedef boost::unordered_map<uint256, TxLinks, CCoinsKeyHasher> linksmap_type;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    linksmap_type mapLinks;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
@@ -137,6 +293,26 @@ public:
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /** Re-key the priority index for a block at nHeight; does nothing if it already is */
+    void SetPriorityHeight(unsigned int nHeight);
+
+    /**
+     * The minimum fee rate to get into the pool, which is raised whenever
+     * packages are evicted and decays again as blocks come in, faster the
+     * further the memory usage of the pool is below sizelimit.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions from the pool until its memory usage is no more
+     * than sizelimit, lowest descendant score first, and raise the minimum
+     * fee to above the package fee rate of what was removed.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove transactions which entered the pool before time, and their descendants. Returns the number removed. */
+    int Expire(int64_t time);
+
     unsigned long size()
     {
         LOCK(cs);
@@ -147,6 +323,8 @@ public:
         LOCK(cs);
         return totalTxSize;
     }
+    /** Estimate of the memory the pool takes, including its indexes */
+    size_t DynamicMemoryUsage() const;
 
     bool exists(uint256 hash)
     {
@@ -165,6 +343,16 @@ public:
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
+
+private:
+    void addToSelectionIndex(const uint256& hash);
+    void removeFromSelectionIndex(const uint256& hash);
+    void updateSelectionKeys(txiter it);
+    double getSelectionPriority(const CTxMemPoolEntry& entry, double dPriorityDelta) const;
+    void calculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const;
+    void updateAncestorPackages(const uint256& hash, int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeeDelta);
+    void recalculatePackage(txiter it);
+    void trackPackageRemoved(const CFeeRate& rate);
 };
 
 /** 
@@ -44,6 +44,7 @@ bool bSpendZeroConfChange = true;
 bool bdisableSystemnotifications = false; // Those bubbles can be annoying and slow down the UI when you get lots of trx
 bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
+int nStakeThreads = DEFAULT_STAKE_THREADS;
 
 /**
  * Fees smaller than this (in usno) are considered zero fee (for transaction creation)
@@ -329,6 +330,64 @@ void CWallet::SetBestChain(const CBlockLocator& loc)
     walletdb.WriteBestBlock(loc);
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    if (pindex->nHeight < Params().Zerocoin_StartHeight())
+        return;
+
+    //witnesses can only advance when a new accumulator checkpoint is generated, which can be on any of
+    //the blocks connected since the last tip, so catch up from the last checkpoint the witnesses were advanced at
+    int nCheckpointHeight = pindex->nHeight - pindex->nHeight % 10;
+
+    //gather what each witness has to take in under the locks, the math is done without them
+    vector<pair<CZerocoinMint, CWitnessMints> > vWitnessMints;
+    {
+        LOCK2(cs_main, cs_wallet);
+        if (nCheckpointHeight == nLastWitnessCheckpointHeight)
+            return;
+        nLastWitnessCheckpointHeight = nCheckpointHeight;
+
+        CWalletDB walletdb(strWalletFile);
+        list<CZerocoinMint> listMints = walletdb.ListMintedCoins(true, true, false);
+        for (const CZerocoinMint& mint : listMints) {
+            CZerocoinWitness witnessCache(mint.GetValue());
+            walletdb.ReadZerocoinWitness(mint.GetValue(), witnessCache);
+
+            //advance the witness as far as a spend with the highest security level would go
+            libzerocoin::PublicCoin pubCoin(Params().Zerocoin_Params(), mint.GetValue(), mint.GetDenomination());
+            CWitnessMints mints;
+            if (!GetAccumulatorWitnessMints(pubCoin, 100, &witnessCache, mints) || mints.nHeightAccEnd <= witnessCache.GetHeightAccEnd())
+                continue;
+            vWitnessMints.push_back(make_pair(mint, mints));
+        }
+    }
+
+    vector<CZerocoinWitness> vWitnesses;
+    for (const pair<CZerocoinMint, CWitnessMints>& witnessMints : vWitnessMints) {
+        const CZerocoinMint& mint = witnessMints.first;
+        libzerocoin::PublicCoin pubCoin(Params().Zerocoin_Params(), mint.GetValue(), mint.GetDenomination());
+        libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(), mint.GetDenomination());
+        libzerocoin::AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoin);
+        CZerocoinWitness witnessCache(mint.GetValue());
+        AddAccumulatorWitnessMints(pubCoin, witnessMints.second, accumulator, witness, &witnessCache);
+        vWitnesses.push_back(witnessCache);
+    }
+
+    //the mint may have been spent, or its witness advanced by a spend, in the meantime
+    LOCK(cs_wallet);
+    CWalletDB walletdb(strWalletFile);
+    for (const CZerocoinWitness& witnessCache : vWitnesses) {
+        CZerocoinMint mint;
+        if (!walletdb.ReadZerocoinMint(witnessCache.GetPubCoin(), mint) || mint.IsUsed())
+            continue;
+        CZerocoinWitness witnessStored;
+        if (walletdb.ReadZerocoinWitness(witnessCache.GetPubCoin(), witnessStored) && witnessStored.GetHeightAccEnd() >= witnessCache.GetHeightAccEnd())
+            continue;
+        if (!walletdb.WriteZerocoinWitness(witnessCache))
+            LogPrintf("%s : failed to write zerocoin witness\n", __func__);
+    }
+}
+
 bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn, bool fExplicit)
 {
     LOCK(cs_wallet); // nWalletVersion
@@ -2840,33 +2899,29 @@ bool CWallet::CreateTransaction(CScript scriptPubKey, const CAmount& nValue, CWa
     return CreateTransaction(vecSend, wtxNew, reservekey, nFeeRet, strFailReason, coinControl, coin_type, useIX, nFeePay);
 }
 
-// ppcoin: create coin stake transaction
-bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, unsigned int& nTxNewTime)
-{
-    // The following split & combine thresholds are important to security
-    // Should not be adjusted if you don't understand the consequences
-    //int64_t nCombineThreshold = 0;
-
-    txNew.vin.clear();
-    txNew.vout.clear();
+// presstab HyperStake - Initialize as static and don't update the set on every run of SearchStakeKernel() in order to lighten resource use
+static std::set<pair<const CWalletTx*, unsigned int> > setStakeCoins;
+static int nLastStakeSetUpdate = 0;
 
-    // Mark coin stake transaction
-    CScript scriptEmpty;
-    scriptEmpty.clear();
-    txNew.vout.push_back(CTxOut(0, scriptEmpty));
+// Kernel candidates of setStakeCoins, so that each round only hashes
+static std::vector<CStakeKernelCandidate> vStakeCandidates;
+static std::vector<pair<const CWalletTx*, unsigned int> > vStakeCandidateCoins;
+// Set while some coins have no stake modifier yet
+static bool fStakeCandidatesIncomplete = false;
 
+// ppcoin: find a stake kernel among our coins
+bool CWallet::SearchStakeKernel(unsigned int nBits, CStakeKernel& kernel)
+{
     // Choose coins to use
     CAmount nBalance = GetBalance();
 
     if (mapArgs.count("-reservebalance") && !ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
-        return error("CreateCoinStake : invalid reserve balance amount");
+        return error("SearchStakeKernel : invalid reserve balance amount");
 
     if (nBalance <= nReserveBalance)
         return false;
 
-    // presstab HyperStake - Initialize as static and don't update the set on every run of CreateCoinStake() in order to lighten resource use
-    static std::set<pair<const CWalletTx*, unsigned int> > setStakeCoins;
-    static int nLastStakeSetUpdate = 0;
+    bool fUpdateCandidates = fStakeCandidatesIncomplete;
 
     if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime) {
         setStakeCoins.clear();
@@ -2874,108 +2929,155 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             return false;
 
         nLastStakeSetUpdate = GetTime();
+        fUpdateCandidates = true;
     }
 
     if (setStakeCoins.empty())
         return false;
 
-    vector<const CWalletTx*> vwtxPrev;
+    for (const CStakeKernelCandidate& candidate : vStakeCandidates) {
+        if (fUpdateCandidates)
+            break;
+        fUpdateCandidates = IsStakeKernelCandidateStale(candidate);
+    }
 
-    CAmount nCredit = 0;
-    CScript scriptPubKeyKernel;
+    if (fUpdateCandidates) {
+        LOCK(cs_main);
+
+        // Keep the candidates of unspent coins that a reorganisation did not touch
+        std::map<COutPoint, CStakeKernelCandidate> mapKeep;
+        for (const CStakeKernelCandidate& candidate : vStakeCandidates) {
+            if (!IsStakeKernelCandidateStale(candidate))
+                mapKeep.insert(make_pair(candidate.prevout, candidate));
+        }
+
+        vStakeCandidates.clear();
+        vStakeCandidateCoins.clear();
+        fStakeCandidatesIncomplete = false;
+        for (const PAIRTYPE(const CWalletTx*, unsigned int)& pcoin : setStakeCoins) {
+            COutPoint prevout(pcoin.first->GetHash(), pcoin.second);
+            CStakeKernelCandidate candidate;
+            std::map<COutPoint, CStakeKernelCandidate>::const_iterator itKeep = mapKeep.find(prevout);
+            if (itKeep != mapKeep.end()) {
+                candidate = itKeep->second;
+            } else {
+                BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
+                if (it == mapBlockIndex.end()) {
+                    if (fDebug)
+                        LogPrintf("SearchStakeKernel() failed to find block index \n");
+                    continue;
+                }
+                if (!GetStakeKernelCandidate(it->second, prevout, pcoin.first->vout[pcoin.second].nValue, candidate)) {
+                    fStakeCandidatesIncomplete = true;
+                    continue;
+                }
+            }
+            vStakeCandidates.push_back(candidate);
+            vStakeCandidateCoins.push_back(pcoin);
+        }
+    }
 
     //prevent staking a time that won't be accepted
     if (GetAdjustedTime() <= chainActive.Tip()->nTime)
         MilliSleep(10000);
 
-    BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins) {
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
-        BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end())
-            pindex = it->second;
-        else {
-            if (fDebug)
-                LogPrintf("CreateCoinStake() failed to find block index \n");
+    //hash every candidate inside of FindStakeKernel()
+    size_t nStart = 0;
+    size_t nFound;
+    unsigned int nTimeTx = GetAdjustedTime();
+    while (FindStakeKernel(nBits, vStakeCandidates, nStart, nTimeTx, nHashDrift, nFound, kernel.nTime, kernel.hashProofOfStake, nStakeThreads)) {
+        nStart = nFound + 1;
+
+        //Double check that this will pass time requirements
+        if (kernel.nTime <= chainActive.Tip()->GetMedianTimePast()) {
+            LogPrintf("SearchStakeKernel() : kernel found, but it is too far in the past \n");
             continue;
         }
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
+        // Found a kernel
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("SearchStakeKernel : kernel found prevout=%s nTimeTx=%u hashProof=%s\n",
+                vStakeCandidates[nFound].prevout.ToString(), kernel.nTime, kernel.hashProofOfStake.ToString());
 
-        bool fKernelFound = false;
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
+        kernel.pwtx = vStakeCandidateCoins[nFound].first;
+        kernel.nOut = vStakeCandidateCoins[nFound].second;
+        return true;
+    }
+    return false;
+}
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
-            }
+// ppcoin: create coin stake transaction
+bool CWallet::CreateCoinStake(const CKeyStore& keystore, const CStakeKernel& kernel, CMutableTransaction& txNew)
+{
+    // The following split & combine thresholds are important to security
+    // Should not be adjusted if you don't understand the consequences
+    //int64_t nCombineThreshold = 0;
 
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : kernel found\n");
-
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-                break;
-            }
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                break; // only support pay to public key and pay to address
-            }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                    break; // unable to find corresponding public key
-                }
+    txNew.vin.clear();
+    txNew.vout.clear();
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else
-                scriptPubKeyOut = scriptPubKeyKernel;
+    // Mark coin stake transaction
+    CScript scriptEmpty;
+    scriptEmpty.clear();
+    txNew.vout.push_back(CTxOut(0, scriptEmpty));
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+    CAmount nBalance = GetBalance();
+    if (nBalance <= nReserveBalance)
+        return false;
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            const CBlockIndex* pIndex0 = chainActive.Tip();
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(pIndex0->nHeight);
+    vector<const CWalletTx*> vwtxPrev;
 
-            //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
-            if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+    CAmount nCredit = 0;
+    CScript scriptPubKeyKernel;
 
+    vector<valtype> vSolutions;
+    txnouttype whichType;
+    CScript scriptPubKeyOut;
+    scriptPubKeyKernel = kernel.pwtx->vout[kernel.nOut].scriptPubKey;
+    if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
+        return error("CreateCoinStake : failed to parse kernel");
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+    if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+        return false; // only support pay to public key and pay to address
+    }
+    if (whichType == TX_PUBKEYHASH) // pay to address type
+    {
+        //convert to pay to public key type
+        CKey key;
+        if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
             if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-            fKernelFound = true;
-            break;
+                LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+            return false; // unable to find corresponding public key
         }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
-    }
+
+        scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+    } else
+        scriptPubKeyOut = scriptPubKeyKernel;
+
+    txNew.vin.push_back(CTxIn(kernel.pwtx->GetHash(), kernel.nOut));
+    nCredit += kernel.pwtx->vout[kernel.nOut].nValue;
+    vwtxPrev.push_back(kernel.pwtx);
+    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+
+    //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+    const CBlockIndex* pIndex0 = chainActive.Tip();
+    uint64_t nTotalSize = kernel.pwtx->vout[kernel.nOut].nValue + GetBlockValue(pIndex0->nHeight);
+
+    //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
+    if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+
+    if (fDebug && GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
+
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
 
     // Calculate reward
     CAmount nReward;
-    const CBlockIndex* pIndex0 = chainActive.Tip();
     nReward = GetBlockValue(pIndex0->nHeight);
     nCredit += nReward;
 
@@ -4487,7 +4589,13 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
     libzerocoin::AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoinSelected);
     string strFailReason = "";
     int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason)) {
+    CZerocoinWitness witnessCache(pubCoinSelected.getValue());
+    CWalletDB(strWalletFile).ReadZerocoinWitness(pubCoinSelected.getValue(), witnessCache);
+    int nHeightCached = witnessCache.GetHeightAccEnd();
+    bool fWitness = GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, &witnessCache);
+    if (witnessCache.GetHeightAccEnd() != nHeightCached && !CWalletDB(strWalletFile).WriteZerocoinWitness(witnessCache))
+        LogPrintf("%s : failed to write zerocoin witness\n", __func__);
+    if (!fWitness) {
         receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZSND_FAILED_ACCUMULATOR_INITIALIZATION);
         LogPrintf("%s : %s \n", __func__, receipt.GetStatusMessage());
         return false;
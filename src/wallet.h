@@ -44,6 +44,7 @@ extern bool bSpendZeroConfChange;
 extern bool bdisableSystemnotifications;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
+extern int nStakeThreads;
 
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
@@ -154,6 +155,18 @@ public:
     StringMap destdata;
 };
 
+/** A stake kernel found among the wallet's coins by CWallet::SearchStakeKernel() */
+struct CStakeKernel
+{
+    const CWalletTx* pwtx;
+    unsigned int nOut;
+    //! Coinstake time at which the kernel meets the target
+    unsigned int nTime;
+    uint256 hashProofOfStake;
+
+    CStakeKernel() : pwtx(NULL), nOut(0), nTime(0), hashProofOfStake(0) {}
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -228,6 +241,8 @@ public:
     bool fWalletUnlockAnonymizeOnly;
     std::string strWalletFile;
     bool fBackupMints;
+    //! Accumulator checkpoint height the zerocoin witness caches were last advanced at
+    int nLastWitnessCheckpointHeight;
 
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
@@ -286,6 +301,7 @@ public:
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
+        nLastWitnessCheckpointHeight = 0;
 
         // Stake Settings
         nHashDrift = 45;
@@ -481,7 +497,10 @@ public:
     int GenerateObfuscationOutputs(int nTotalValue, std::vector<CTxOut>& vout);
     bool CreateCollateralTransaction(CMutableTransaction& txCollateral, std::string& strReason);
     bool ConvertList(std::vector<CTxIn> vCoins, std::vector<int64_t>& vecAmounts);
-    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, unsigned int& nTxNewTime);
+    //! Search the stakeable coins for a kernel meeting nBits, without building anything
+    bool SearchStakeKernel(unsigned int nBits, CStakeKernel& kernel);
+    //! Build and sign the coinstake transaction spending a kernel found by SearchStakeKernel()
+    bool CreateCoinStake(const CKeyStore& keystore, const CStakeKernel& kernel, CMutableTransaction& txNew);
     bool MultiSend();
     void AutoCombineDust();
     void AutoZeromint();
@@ -579,6 +598,7 @@ public:
         return nChange;
     }
     void SetBestChain(const CBlockLocator& loc);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
 
     DBErrors LoadWallet(bool& fFirstRunRet);
     DBErrors ZapWalletTx(std::vector<CWalletTx>& vWtx);
@@ -1055,6 +1055,11 @@ bool CWalletDB::WriteZerocoinMint(const CZerocoinMint& zerocoinMint)
     uint256 hash = Hash(ss.begin(), ss.end());
 
     Erase(make_pair(string("zerocoin"), hash));
+
+    //a spent mint won't need its witness again
+    if (zerocoinMint.IsUsed() && !EraseZerocoinWitness(zerocoinMint.GetValue()))
+        LogPrintf("%s : failed to erase zerocoin witness\n", __func__);
+
     return Write(make_pair(string("zerocoin"), hash), zerocoinMint, true);
 }
 
@@ -1073,9 +1078,39 @@ bool CWalletDB::EraseZerocoinMint(const CZerocoinMint& zerocoinMint)
     ss << zerocoinMint.GetValue();
     uint256 hash = Hash(ss.begin(), ss.end());
 
+    if (!EraseZerocoinWitness(zerocoinMint.GetValue()))
+        LogPrintf("%s : failed to erase zerocoin witness\n", __func__);
+
     return Erase(make_pair(string("zerocoin"), hash));
 }
 
+bool CWalletDB::WriteZerocoinWitness(const CZerocoinWitness& zerocoinWitness)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << zerocoinWitness.GetPubCoin();
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Write(make_pair(string("zcwitness"), hash), zerocoinWitness, true);
+}
+
+bool CWalletDB::ReadZerocoinWitness(const CBigNum& bnPubCoinValue, CZerocoinWitness& zerocoinWitness)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnPubCoinValue;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Read(make_pair(string("zcwitness"), hash), zerocoinWitness);
+}
+
+bool CWalletDB::EraseZerocoinWitness(const CBigNum& bnPubCoinValue)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnPubCoinValue;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Erase(make_pair(string("zcwitness"), hash));
+}
+
 bool CWalletDB::ArchiveMintOrphan(const CZerocoinMint& zerocoinMint)
 {
     CDataStream ss(SER_GETHASH, 0);
@@ -1092,6 +1127,9 @@ bool CWalletDB::ArchiveMintOrphan(const CZerocoinMint& zerocoinMint)
         return false;
     }
 
+    if (!EraseZerocoinWitness(zerocoinMint.GetValue()))
+        LogPrintf("%s : failed to erase zerocoin witness of orphaned mint\n", __func__);
+
     return true;
 }
 
@@ -32,6 +32,7 @@ class CWallet;
 class CWalletTx;
 class CZerocoinMint;
 class CZerocoinSpend;
+class CZerocoinWitness;
 class uint160;
 class uint256;
 
@@ -165,6 +166,9 @@ public:
     bool WriteZerocoinSpendSerialEntry(const CZerocoinSpend& zerocoinSpend);
     bool EraseZerocoinSpendSerialEntry(const CBigNum& serialEntry);
     bool ReadZerocoinSpendSerialEntry(const CBigNum& bnSerial);
+    bool WriteZerocoinWitness(const CZerocoinWitness& zerocoinWitness);
+    bool ReadZerocoinWitness(const CBigNum& bnPubCoinValue, CZerocoinWitness& zerocoinWitness);
+    bool EraseZerocoinWitness(const CBigNum& bnPubCoinValue);
 
 private:
     CWalletDB(const CWalletDB&);
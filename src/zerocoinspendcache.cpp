@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zerocoinspendcache.h"
+
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <set>
+#include <utility>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Valid zerocoin spend cache, to avoid verifying the serial number signature
+ * of knowledge and the accumulator proof of knowledge twice for every spend
+ * (once when accepted into memory pool, and again when accepted into the
+ * block chain)
+ */
+class CZerocoinSpendCache
+{
+private:
+    //! spenddata_type is (spend hash, accumulator checksum):
+    typedef std::pair<uint256, uint32_t> spenddata_type;
+    std::set<spenddata_type> setValid;
+    boost::shared_mutex cs_spendcache;
+
+public:
+    bool Get(const uint256& hashSpend, uint32_t nChecksum)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+        return setValid.count(spenddata_type(hashSpend, nChecksum)) > 0;
+    }
+
+    void Set(const uint256& hashSpend, uint32_t nChecksum)
+    {
+        // DoS prevention: a spend verifies in milliseconds but is only a
+        // few dozen bytes here, so the default keeps this well under 1MB
+        int64_t nMaxCacheSize = GetArg("-maxzerocoinspendcachesize", DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, for the same reason as the signature cache
+            std::set<spenddata_type>::iterator it = setValid.lower_bound(spenddata_type(GetRandHash(), 0));
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(spenddata_type(hashSpend, nChecksum));
+    }
+
+    void Erase(const uint256& hashSpend, uint32_t nChecksum)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+        setValid.erase(spenddata_type(hashSpend, nChecksum));
+    }
+};
+
+CZerocoinSpendCache zerocoinSpendCache;
+
+}
+
+uint256 GetZerocoinSpendHash(const CTxIn& txin)
+{
+    return Hash(txin.scriptSig.begin(), txin.scriptSig.end());
+}
+
+bool IsZerocoinSpendVerified(const uint256& hashSpend, uint32_t nChecksum)
+{
+    return zerocoinSpendCache.Get(hashSpend, nChecksum);
+}
+
+void SetZerocoinSpendVerified(const uint256& hashSpend, uint32_t nChecksum)
+{
+    zerocoinSpendCache.Set(hashSpend, nChecksum);
+}
+
+void EraseZerocoinSpendVerified(const uint256& hashSpend, uint32_t nChecksum)
+{
+    zerocoinSpendCache.Erase(hashSpend, nChecksum);
+}
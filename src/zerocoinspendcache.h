@@ -0,0 +1,24 @@
+// Copyright (c) 2018 The Snodecoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SNODECOIN_ZEROCOINSPENDCACHE_H
+#define SNODECOIN_ZEROCOINSPENDCACHE_H
+
+#include <stdint.h>
+
+class CTxIn;
+class uint256;
+
+//! -maxzerocoinspendcachesize default (entries)
+static const int64_t DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE = 10000;
+
+/** Hash identifying the serialized CoinSpend carried by a zerocoin spend input */
+uint256 GetZerocoinSpendHash(const CTxIn& txin);
+
+/** Whether the proofs of this spend already verified against the accumulator with this checksum */
+bool IsZerocoinSpendVerified(const uint256& hashSpend, uint32_t nChecksum);
+void SetZerocoinSpendVerified(const uint256& hashSpend, uint32_t nChecksum);
+void EraseZerocoinSpendVerified(const uint256& hashSpend, uint32_t nChecksum);
+
+#endif // SNODECOIN_ZEROCOINSPENDCACHE_H